@@ -10,14 +10,26 @@
 //   visualiser [OPTIONS...]
 //     [-c configfile]
 //          // visualisation settings, if omitted looks for visparam.ini and if not found is a 48-chip heatmap
-//     [-replay savedspinnfile [replaymultiplier]]
+//     [-replay savedspinnfile [replaymultiplier|max]]
 //          // instead of live data you can replay a previous saved .spinn file.  Speed of playback may also
-//          //   be chosen.  e.g. 0.25 = quarter original speed, 1 = original speed, 10 = ten times faster
+//          //   be chosen.  e.g. 0.25 = quarter original speed, 1 = original speed, 10 = ten times faster,
+//          //   max = as fast as it can be decoded
 //     [-l2g localtoglobalmapfile]
 //     [-g2l globaltolocalmapfile]
 //       // these options are used together to map split neural populations to aggregated ones (from PACMAN)
 //     [-ip source machine]
 //          //  specify IP address of machine you want to listen to (if omitted first packet received is source dynamically)
+//     [-benchdecode [packets]]
+//          // time decoding packets (default 1000000) for the configured simulation, then exit
+//     [-benchthreads [threads [packets]]]
+//          // time 1 up to threads (default 4) decode threads sharing the packets, then exit
+//     [-benchcolour [frames]]
+//          // time colouring frames (default 100) of the configured plot with each colour mapping kernel, then exit
+//     [-generate [spikes/s [seconds]] [uniform|hotspot|sweep]]
+//          // act as the board: send packets for the configured simulation to -ip (else 127.0.0.1) at spikes/s
+//          //   (default 100000) for seconds (default 10, 0 for ever) over the chosen key distribution, then exit
+//     [-benchingest [seconds] [uniform|hotspot|sweep]]
+//          // step up generated load on loopback for seconds (default 1) a step, reporting socket & queue losses, then exit
 //
 // --------------------------------------------------------------------------------------------------
 //
@@ -25,6 +37,42 @@
 //
 // Current Version:
 // ----------------
+// 17th Oct 2026-    CP SDPPORTS parameter listens on further ports through one epoll loop, and packets are tagged with the board
+//                     they came from. BOARDS="host[:chipx:chipy], ..." takes only those boards, offsetting the chips in their
+//                     keys (or SDP addresses) into one machine.
+// 17th Oct 2026-    CP simparams may name several parameter groups, each a panel with its own decoder & data tiled in the one window,
+//                     sharing the receiver and decoders. KEYBASE & KEYMASK parameters pick each panel's keys.
+// 17th Oct 2026-    CP with DECODETHREADS>1, RETINA/RETINA2/COCHLEA decoders count spikes into their own shards, merged under the lock
+//                     once per history line or frame rather than locking every packet. -benchthreads [threads [packets]]
+// 17th Oct 2026-    CP renderer takes immediate_data as copies the decoders publish between packets through a triple buffer, so no
+//                     torn frames and the renderer never writes (or loses increments in) the decoders' data.
+// 17th Oct 2026-    CP DECAYPROPORTION decay worked out from each point's last update time when it's read, not swept every frame,
+//                     so quiet points cost nothing and decay doesn't depend on the frame rate.
+// 17th Oct 2026-    CP history also kept at fixed time resolutions (1ms..1s bins) so zooming refills the plot at once rather than
+//                     starting empty, and zooms out to 10+ minutes. PYRAMIDLEVELS, PYRAMIDBIN, PYRAMIDLINES, PYRAMIDEVENTS parameters.
+// 17th Oct 2026-    CP history lines stamped with their time bin, so quiet lines read as empty rather than being cleared.
+// 17th Oct 2026-    CP history in one cache line aligned block, values as floats or 1/2 byte saturating spike counts. HISTORYTYPE parameter.
+// 17th Oct 2026-    CP LINES/RASTER/EEGSTYLE kept in a ring of texture columns, so each frame only draws the lines new since the last frame
+// 17th Oct 2026-    CP RASTER drawn from per history line event lists (neuron, count) kept alongside the dense history, so its cost
+//                     follows the spikes in the window not window x population. RASTEREVENTS parameter.
+// 17th Oct 2026-    CP frames coloured in one pass by an SSE2/AVX2/scalar colour mapping kernel picked at startup, -benchcolour [frames]
+// 17th Oct 2026-    CP INTERPOLATED drawn as one linear filtered texture coloured through per colour map lookup tables (also used for tiles)
+// 17th Oct 2026-    CP tiled/histogram plot and mini-plot drawn from vertex arrays (corners kept, colours rewritten each frame), a draw call a grid
+// 17th Oct 2026-    CP -generate sends valid packets for HEATMAP/RATEPLOT/RETINA/RETINA2/COCHLEA/CPUUTIL at a spike rate & key distribution,
+//                     -benchingest steps up that load on loopback and reports socket & queue losses against offered load
+// 17th Oct 2026-    CP any replay multiplier, or "max" to replay unthrottled; replay prints packets/s, spikes/s & decode CPU at the end
+// 17th Oct 2026-    CP replay feeds the decoders' rings directly (no UDP loopback or listening port), lossless, timeline timestamps
+// 17th Oct 2026-    CP replay timeline: seek (Home/End/Page Up/Down, click the timeline), step frames (, .), loop a range (( )), history rebuilt on a seek
+// 17th Oct 2026-    CP replay maps the recording a window at a time and sends from the mapping, no counting pass or packet arrays
+// 17th Oct 2026-    CP .spinn v2 recordings: header, 1MB chunks written in one go, chunk time index. Legacy .spinn still replays
+// 17th Oct 2026-    CP spikes saved by a recorder thread fed from a lock free queue (RECORDQUEUE parameter), new binary .spikes format
+// 17th Oct 2026-    CP REPORTDIR & POPULATION parameters: key maps loaded from PACMAN placement_by_vertex/edge_routing_info reports
+// 17th Oct 2026-    CP RETINA2 decodes through a routing key -> pixel table built from the board files, unmapped keys counted not printed
+// 17th Oct 2026-    CP packet decoding split into per-SIMULATION decoder policies chosen once after paramload (select_decoder),
+//                     -benchdecode [packets] command line option times the decoder for the configured simulation
+// 17th Oct 2026-    CP receive/decode/render pipeline: receiver fills SPSC packet rings, DECODETHREADS decoders empty them,
+//                     display() draws from a snapshot. DECODETHREADS, PACKETRING, STATSINTERVAL parameters.
+// 17th Oct 2026-    CP input_thread_SDP takes batches of datagrams per syscall with recvmmsg (RECVBATCH parameter), ingest stats on exit
 // 4th Sep 2013-     CP incorporated visualiser for the Cochlea from Qian Lui
 // 2nd Sep 2013-     CP rewrote the cpu temperature routine to calculate locally, tabs replaced by 3 spaces, added INITZERO option for data starting at zero rather than undefined.
 // 29th Aug 2013-    CP immediate_data became a float (for better decay)
@@ -61,8 +109,14 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include <unistd.h>  // included for Fedora 17 Fedora17  28th September 2012 - CP
 #include <libconfig.h> // included 14/04/13 for file based parameter parsing, (needs libconfig-dev(el))
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // SSE2 / AVX2 colour mapping, chosen at run time
+#endif
 using namespace std;
 
 // --------------------------------------------------------------------------------------------------
@@ -120,6 +174,12 @@ int BOARD=3;
 double TIMEWINDOW = 3.5;                                            // default time width of a window
 float displayWindow = TIMEWINDOW;
 int HISTORYSIZE=3500,MAXRASTERISEDNEURONS=1024;                     // data set sizes
+int HISTORYTYPE=0;                                                  // bytes per history value: 1 or 2 (saturating spike counts), 4 (float), 0 to suit the SIMULATION
+int RASTEREVENTS=262144;                                            // spikes kept for drawing the raster, per data set (rounded up to a power of 2)
+int PYRAMIDLEVELS=4;                                                // time resolutions the history is also kept at (0 for none)
+int PYRAMIDBIN=1000;                                                // us of the finest of them, each of the others 10x the last
+int PYRAMIDLINES=1000;                                              // bins kept at each resolution
+int PYRAMIDEVENTS=1048576;                                          // values logged for the finest resolution (rounded up to a power of 2)
 
 int WINBORDER = 110, WINHEIGHT = 700, WINWIDTH = 850;               // defaults for window sizing
 int DISPLAYKEY = 1, KEYWIDTH = 50;
@@ -141,20 +201,134 @@ int XFLIP=0,YFLIP=0,VECTORFLIP=0,ROTATEFLIP=0;                      //   default
 int xflip=XFLIP,yflip=YFLIP,vectorflip=VECTORFLIP,rotateflip=ROTATEFLIP;  // of the data
 
 int SDPPORT=17894;                                                  // which UDP port are we expecting our SDP traffic on
+char SDPPORTS[200]="";                                              // further ports to listen on as well (e.g. "17895, 17896"), say one per board
+char BOARDS[400]="";                                                // boards to take packets from, "host[:chipx:chipy], ..." (empty: any that send)
+int RECVBATCH=32;                                                   // max number of datagrams taken off the socket per recvmmsg syscall
+int DECODETHREADS=1;                                                // number of decode threads fed by the receiver (each has its own packet ring), spike counts only
+int PACKETRING=4096;                                                // slots in each receive->decode packet ring (rounded up to a power of 2)
+int RECORDQUEUE=65536;                                              // spikes that can be waiting for the recorder thread (rounded up to a power of 2)
+int STATSINTERVAL=0;                                                // if non-zero, print pipeline stats (queue depths etc.) every this many seconds
 
 int FIXEDPOINT=16;                                                  // number of bits in word of data that are to the right of the decimal place
 
 long int BITSOFPOPID=0;              // number of bits of population in each core (pow of 2); 0 for implicit core==popID
 
 double ALTERSTEPSIZE=1.0;      // the step size used when altering the data to send
-double DECAYPROPORTION=0.0;     // how quickly does the raster plot diminish
+double DECAYPROPORTION=0.0;     // how quickly does the raster plot diminish (the proportion left after each 1/MAXFRAMERATE s)
 
 char POPULATION_CORES[50];
+char REPORTDIR[200]="";                 // PACMAN reports directory (e.g. results/latest), if set key mappings are taken from its reports
+char POPULATION[64]="";                 // and the name of the population (vertex) that's to be displayed
+unsigned int KEYBASE=0, KEYMASK=0;      // with several panels, this one takes the keys (or packets) whose key & KEYMASK is KEYBASE (see panel_share)
 
 //float* immediate_data;           // this stores the value of each plotted point data (time == now)  - superfluous
-float** history_data;       // this stores the historic value the plotted points (double the initial width should be sufficient)
-float** history_data_set2;    // 2nd set of data for ancillary raster plot window
+// the history of each plotted point's value, HISTORYSIZE lines of them in one block, with each line starting on a
+//   cache line. Values are floats, or for spiking visualisations saturating counts in 1 or 2 bytes (0 meaning no data,
+//   n a value of n-1, which is all a count needs and takes a quarter or an eighth of the memory).
+#define HISTORYALIGN 64
+typedef struct {
+   unsigned char *data;
+   int size;                  // bytes per value: 1, 2 or 4 (a float)
+   size_t stride;             // bytes per line
+} historyring_t;
+historyring_t history_data;         // this stores the historic value the plotted points (double the initial width should be sufficient)
+historyring_t history_data_set2;    // 2nd set of data for ancillary raster plot window
+// each history line (in both sets, and their raster events) is stamped with the time bin it holds, counted from the
+//   start, so lines left over from earlier trips round the ring read as empty without being cleared. A line is only
+//   cleared when data for its new time bin first arrives.
+#define HISTORYNEVER -1       // stamp of a line that's never been written
+#define HISTORYBUSY -2        // stamp of a line being cleared for new data
+int64_t *historyepoch;        // for each history line, the time bin it holds
+int64_t historynow=0;         // the time bin being added to now (on the right hand side)
+float historytimeperindex=0;  // time per history line (s) the lines were last filled for
+volatile int refillwanted=0;  // the renderer wants the lines refilled for a new time per line (a decoder does it)
+int64_t refillline;           //   up to this line
+float refilltimeperindex;     //   at this time per line (s)
+
+// the history is also kept at fixed time resolutions (e.g. 1ms, 10ms, 100ms, 1s bins), so when the time per history line
+//   changes (the window is zoomed or resized) the lines can be refilled straight away from the finest resolution that
+//   still has that time, rather than starting again empty. The finest is a log of the values in the order they arrive
+//   (so it costs in proportion to the data rather than the number of points), and each of its bins is folded into the
+//   one that covers it at the next resolution as soon as it's complete, and so on up. The coarser ones are dense.
+#define PYRAMIDMAXLEVELS 8
+typedef struct {
+   uint id;                   // data point index
+   float value;
+} pyramidevent_t;
+
+typedef struct {
+   historyring_t data;        // PYRAMIDLINES bins (but not the finest, which is in the log)
+   int64_t *epoch;            // for each, the bin (counted from the start) it holds
+   int64_t *first, *end;      // the finest only: for each bin, the span [first,end) of the log it used
+   int64_t binus;             // us per bin
+   int line;                  // the one being written now
+} pyramidlevel_t;
+pyramidlevel_t pyramid[PYRAMIDMAXLEVELS];
+pyramidevent_t *pyramidlog;   // the finest resolution's values
+unsigned int pyramidmask;     // log size-1
+int64_t pyramidlogged=0;      // values ever logged (the next goes in pyramidlog[pyramidlogged & pyramidmask])
+
+// RASTER: alongside the dense history, each data set keeps the points written in each history line as a list of
+//   events, so a raster is drawn from the spikes in the window rather than by scanning window x population. The events
+//   of all the lines go into one ring in the order they arrive, and each line notes the span of the ring it used. A line
+//   whose events aren't contiguous (out of order packets), or have since been overwritten, is drawn from the dense data.
+typedef struct {
+   uint id;                   // data point (neuron) index
+   uint count;                // times it was written (spiked) in this history line
+} rasterevent_t;
+
+typedef struct {
+   rasterevent_t *events;     // the ring
+   unsigned int mask;         // ring size-1
+   int64_t written;           // events ever added (the next goes in events[written & mask])
+   int64_t *first, *end;      // for each history line, the span [first,end) of its events
+   char *dense;               // for each history line, set if its events are incomplete
+   int64_t *slot;             // for each data point, where its latest event is (so repeats in a line are counted)
+   int openline;              // the history line events were last added to
+} eventhistory_t;
+eventhistory_t historyevents, historyevents2;    // for history_data and history_data_set2
+int *rasterrow;               // which raster row shows each data point, the inverse of tiledata
 float* immediate_data;        // this creates a buffer tally for the Ethernet packets (1 ID = one plotted point)
+float* displaydata;           // the renderer's snapshot of immediate_data taken at the start of each frame
+
+// colour maps as lookup tables, COLOURLUTSIZE steps from low to high water, packed RGBA (map 0 is for an unknown colourused, black)
+#define COLOURLUTSIZE 1024
+unsigned int colourlut[9][COLOURLUTSIZE];
+unsigned int colouralpha;     // just the alpha byte of a packed colour, cleared for points with no data
+unsigned int *datacolours;    // this frame's packed RGBA for each data point, from the colour mapping kernel
+float *datafills;             // and where each sits between the water marks (0.0-1.0, a percentage of the scale /100)
+
+// INTERPOLATED: the data is coloured through the lookup table into an RGBA image (a texel per point), and drawn as one
+//   linear filtered texture so the blending between points is done by the texture filtering
+GLuint heatmaptexture=0;
+int heatmaptexturewidth, heatmaptextureheight;   // powers of 2, the image goes in the bottom left corner
+
+// LINES, RASTER and EEGSTYLE: the scrolling plot is kept in a texture used as a ring of columns, one per history line.
+//   Each frame only the lines that have arrived since the last are drawn (where they'd normally go, at the right of the
+//   plot), they're copied into the ring, and the plot is drawn as one textured quad from where the ring now starts.
+//   Anything that changes how the older lines look (window size, mode, scale, flips...) has the whole window drawn again.
+#define SCROLLOVERLAP 4       // lines either side of those copied that are drawn again (late data, wide points and lines)
+typedef struct {
+   GLuint texture;
+   int width, height;         // of the texture, powers of 2
+   int64_t lastline;          // newest history line (counting from the start) put in the ring, -1 for none yet
+   float look[16];            // what the lines in the ring were drawn with
+} scrollplot_t;
+scrollplot_t scrollplots[2];  // for the main window and win2 (each has its own GL context)
+int historyrewrites=0;        // counts the times history lines already plotted are rewritten (replay seeks)
+unsigned int *heatmapimage;   // xdim*ydim packed RGBA texels, a row per y coordinate
+int *tilepixel;               // where each tile's texel is in heatmapimage
+
+// the tiled/histogram plot and the mini-plot are drawn from vertex arrays: tile corners are only worked out again when
+//   the layout changes, each frame just rewrites the colours (shared by both grids)
+typedef struct {
+   GLfloat *corners;           // (x,y) of the 4 corners of each tile
+   float layout[6];            // where and how big the tiles were when the corners were worked out
+} tilegrid_t;
+tilegrid_t maingrid, minigrid;
+GLubyte *tilecolours;         // RGBA for each corner of each tile, alpha 0 where there's no data so it isn't drawn
+int *tiledata;                // which data point each tile shows, after any flips / rotation
+int tiledataflips=-1;         // the flips tiledata was worked out for
 
 int** maplocaltoglobal; // always 2 wide.  Size of mapping from X&Y coords #of pops
 int** mapglobaltolocal; // and the reverse from the 2nd file
@@ -186,6 +360,7 @@ int** mapglobaltolocal; // and the reverse from the 2nd file
 #define THERMAL        6
 #define RED        7
 #define BLUE        8
+#define COLOURMAPS  8
 
 // view mode
 #define TILED         1
@@ -201,6 +376,7 @@ char plotvaluesinblocks=0;    // set non-zero if you just want the coloured bloc
 char somethingtoplot=0;        // determines when we should update the screen (no point in plotting no change eh?)
 char freezedisplay=0;        // whether we should pause the display updates (and send a pause packet to the sim)
 int64_t freezetime;        // when pausing the simulation we hold time at the time of pausing (for screen display purposes)
+char replayrebuilding=0;    // set while a replay seek rebuilds the history from the recording (decoded even though the display is frozen)
 int boxsize=40, gap=5;        // used for button creation and gaps between these boxes and the edge of the screen
 int win1 = 0;            // the main graphics window used by OpenGL
 int win2 = 0;            // a test for windows spawned from the main window
@@ -218,6 +394,7 @@ int modesubmenu=0;        // for mode submenu
 int coloursubmenu=0;        // for colours submenu
 int transformsubmenu=0;        // for plot transformation submenu
 int filesubmenu=0;        // for save file submenu
+int replaysubmenu=0;        // for replay timeline submenu
 char needtorebuildmenu=0;    // if a menu is open we can't reconfigure it. So we queue the request.
 char menuopen=0;        // a callback populates this as 1 or 0 depened on whether a menu is open or not.
 char editmode=1,livebox=-1;    // for user feedback - box selection and whether edit mode is toggled on/off.
@@ -248,24 +425,25 @@ int ID_OFFSET;
 
 // FILE OPERATIONS
 float playbackmultiplier=1.0;        // when using a recorded input file, 1=realtime, 0.25=quarter speed, 15=15x speed (specified by optional CLI argument)
+char replayunthrottled=0;        // replay as fast as the decoders will go, ignoring the recorded times ("max" CLI multiplier)
 FILE *fileinput = NULL;            // if the user chooses to provide data as input this is the handle
+char configfilename[200]="";       // the configuration file we were started with (goes in recordings)
 
-char outputfileformat=0;        // 3 states. 0 = no writing, 1=.spinn UDP payload format, 2 = neurotools format
-char writingtofile=0;            // 3 states.  1=busy writing, 2=paused, 0=not paused, not busy.
+char outputfileformat=0;        // 4 states. 0 = no writing, 1=.spinn UDP payload format, 2 = neurotools format, 3 = binary spike records
+char writingtofile=0;            // 2=paused, 0=not paused (a packet going into a .spinn file holds spinnlock while it does).
 FILE *fileoutput = NULL;
 
 
 int mappingfilesread=0,maplocaltoglobalsize,mapglobaltolocalsize;  // logs how bug each array actually gets (might not be full!)
 
 
-int lasthistorylineupdated=0;                        // this is stored so that rows that have not been updated between then and now can be cleared out
-
 int counter=0;                                // number of times the display loop has been entered
 int pktcount=0;                                // total aggregate of packets received and processed
 int64_t printpktgone=0;                            // if set non zero, this is the time the last Eth packet message was sent, idle function checks for 1s before stopping displaying it
 struct timeval startimeus;                        // for retrieval of the time in us at the start of the simulation
 int64_t starttimez,firstreceivetimez=0;                    // storage of persistent times in us
 int64_t keepalivetime;                            // used by code to send out a packet every few seconds to keep ARP entries alive
+int64_t laststatstime=0;                            // when we last printed the pipeline stats (if STATSINTERVAL is set)
 unsigned int minneuridrx=10000000;                    // we only need to raster plot the number of neurons firing in a raster plot, (smallest neurid received).
 unsigned int maxneuridrx=0;                        // we only need to raster plot the number of neurons firing in a raster plot, (largest neurid received).
 
@@ -285,6 +463,7 @@ int tempcountcp = 0;        // recording number of spikes per screenful!
 //network parameters for the SDP and SpiNNaker protocols
 
 #define MAXBLOCKSIZE        364             // maximum possible Ethernet payload words for a packet- (SpiNN:1500-20-8-18) (SDP:1500-20-8-26)
+#define SDPHEADERLEN        26              // bytes of SDP header (to the end of arg3) before any user data
 #define SPINN_HELLO        0x41            // SpiNNaker raw format uses this as a discovery protocol
 #define P2P_SPINN_PACKET     0x3A               // P2P SpiNNaker output packets (Stimulus from SpiNNaker to outside world)
 #define STIM_IN_SPINN_PACKET     0x49               // P2P SpiNNaker input packets (Stimulus from outside world)
@@ -327,6 +506,61 @@ typedef struct
    short incoming_packet_size;
    unsigned char payload[];
 } spinnaker_saved_file_t;
+#pragma pack()                      // back to natural alignment for everything else
+
+// .spinn v2 recording: a header, then fixed size chunks each holding a chunk header and legacy style
+//   [short len][int64 offset us][payload] records, then an index of the chunk headers (written on close).
+//   Chunk n is at headersize + n*chunksize, so a reader can go straight to any chunk and get file stats
+//   from the header and index without reading the packets. Legacy files (just the records) are still read.
+#define SPINN2MAGIC       "SPINNV2"         // a legacy file starts with a record length, which is never this
+#define SPINN2HEADERSIZE  512
+#define SPINN2CHUNKSIZE   (1024*1024)
+#define REPLAYWINDOW      (16*1024*1024)    // how much of a recording is mapped at once during replay
+
+typedef struct {
+   char magic[8];
+   int64_t recordingstart;       // wall clock (us since epoch) when the recording was opened
+   int64_t indexoffset;          // where the chunk index is in the file, 0 if the recording wasn't closed properly
+   int32_t version;              // 2
+   int32_t headersize;           // bytes before the first chunk
+   int32_t chunksize;            // bytes in every chunk
+   int32_t numchunks;
+   int32_t simulation;           // SIMULATION it was recorded from
+   int32_t xdimensions, ydimensions, eachchipx, eachchipy;
+   int64_t packets;              // in the whole file
+   int64_t lasttime;             // us offset of the last packet
+   char configfile[200];         // configuration file and title in use when recording
+   char title[50];
+} spinn2header_t;                // padded to SPINN2HEADERSIZE on disk
+
+typedef struct {
+   int64_t firsttime, lasttime;  // us offsets of the first and last packets in the chunk
+   int32_t packets;              // number of packets in the chunk
+   int32_t bytesused;            // bytes of records that follow this header
+} spinn2chunk_t;
+
+spinn2header_t recordheader;       // the .spinn recording being written
+unsigned char *recordchunk=NULL;   // the chunk being filled (written out in one go when full)
+spinn2chunk_t *recordindex=NULL;   // headers of the chunks written so far
+int recordindexsize=0;
+
+spinn2header_t replayheader;       // the .spinn v2 file being replayed
+spinn2chunk_t *replayindex=NULL;   // its chunk index
+int64_t replaystarttime=-1;        // wall clock (us) that corresponds to time offset 0 in the file
+int replaybehind=0;                // set once we've warned about not keeping up
+int replayfd=-1;                   // replay maps the file a window at a time and sends straight from the mapping
+off_t replayfilesize=0;
+unsigned char *replaywindow=NULL;  // the mapped window, file bytes replaywindowstart..+replaywindowlength
+off_t replaywindowstart=0;
+size_t replaywindowlength=0;
+char replaying=0;                  // playing back a recording, so the timeline controls are live
+char replaylegacy=0;               // a legacy file has no index, so it's indexed as far as it has been read
+off_t replaylegacyscanned=0;       //   (up to here)
+off_t *replaychunkoffset=NULL;     // file offset of the first record in each chunk of replayindex
+int replayindexallocated=0;
+int64_t replayseekto=-1;           // recording time (us) the user has asked to go to, picked up by the replay thread
+int64_t replayloopstart=-1, replayloopend=-1;    // when both are set the replay loops round this range
+int64_t replaysentto=0;            // recording time of the last packet passed on (where an unthrottled replay has got to)
 
 
 
@@ -336,13 +570,93 @@ char portno_input[6];
 struct addrinfo hints_input, hints_output, *servinfo_input, *p_input, *servinfo, *p;
 struct sockaddr_storage their_addr_input;
 int rv_input;
-int numbytes_input;
-struct sdp_msg * scanptr;
-struct spinnpacket * scanptrspinn;
 in_addr spinnakerboardip;
 int spinnakerboardport=0;
 char spinnakerboardipset=0;
-unsigned char buffer_input[1515];  //buffer for network packets (waaaaaaaaaaay too big, but not a problem here)
+pthread_mutex_t boardlock = PTHREAD_MUTEX_INITIALIZER;     // held by a decoder while it learns the board from its first packet
+
+#define RECVSLOTSIZE 1515                // size of each slot in the receive arena (waaaaaaaaaaay too big for a packet, but not a problem here)
+struct mmsghdr *recvmsgs;                // one message header per datagram in a batch
+struct iovec *recviovecs;                // each pointing at a ring slot (or the arena)
+int64_t recvsyscalls=0, recvpackets=0;   // ingest counters, packets/syscall tells us how well we are batching
+int recvbatchmax=0;                      // most packets we've taken off the socket in one go
+int64_t recvwaits=0;                     // times a ring was full, so we left the packets in the socket for a while
+
+// several ports and several boards: a socket per port, watched together by epoll when there's more than one, and each
+//   datagram tagged with the board it came from. A board's chip offset (BOARDS) moves its SDP packets' source chip to
+//   where that board sits in the machine, so boards that were booted separately show as the one machine.
+#define MAXLISTENERS 16
+#define MAXSOURCES 64
+int listenfds[MAXLISTENERS];             // sockfd_input is the first of these
+int listenports[MAXLISTENERS];
+int64_t listenerpackets[MAXLISTENERS];
+int numlisteners=0;
+int epollfd=-1;
+
+typedef struct {
+   in_addr ip;
+   int chipx, chipy;                     // added to the chip coordinates of the board's keys (or SDP packets), 0-255
+   int64_t packets;
+   int64_t offmachine;                   // keys (or packets) the offset put off the edge of the machine, dropped
+} packetsource_t;
+
+packetsource_t packetsources[MAXSOURCES];
+volatile int numsources=0;               // only the receive thread adds to these (boards not in BOARDS, as they're heard)
+int boardslisted=0;                      // BOARDS named this many, and packets from any other board are dropped
+int64_t unlistedpackets=0;
+
+// receive -> decode pipeline. The receive thread recvmmsg's straight into the slots of a single producer / single
+//   consumer ring, each decode thread owns one ring.  Slow decoding (or file writing) then never holds up the socket.
+typedef struct {
+   int64_t receivetime;                  // us, when the batch holding this datagram came off the socket
+   struct sockaddr_in from;              // where it came from
+   short listener;                       // the port (listenfds index) it arrived on
+   short source;                         // and the board (packetsources index), -1 for one BOARDS doesn't name
+   int length;                           // bytes in payload
+   unsigned char payload[RECVSLOTSIZE];
+} ringslot_t;
+
+typedef struct {
+   ringslot_t *slots;
+   unsigned int size;                    // number of slots, a power of 2
+   volatile unsigned int head __attribute__((aligned(64)));    // next slot to fill, only written by the receive thread
+   volatile unsigned int tail __attribute__((aligned(64)));    // next slot to decode, only written by the decode thread
+   volatile int consumerwaiting;         // decode thread is asleep waiting for packets
+   pthread_mutex_t waitlock;
+   pthread_cond_t waitcond;
+   unsigned int highwater;               // deepest this queue has been
+   unsigned int filling;                 // (receiver's) slots filled from the batch it's sharing out, not yet handed over
+   int64_t pushed, decoded, full;        // full = the receiver found no room here (and left the packets in the socket)
+} packetring_t;
+
+packetring_t *packetrings;               // DECODETHREADS of these
+ringslot_t *recvarena=NULL;              // with >1 decoder, where a batch lands to be shared out between the rings by source
+// spike recording (NeuroTools or binary). Decoders queue (time, neuron) records, the recorder thread formats and
+//   writes them in large blocks. Decoders are the only producers, and are serialised by decodelock if there's >1
+//   (or by savelock, when several panels' decoders are saving at once).
+typedef struct {
+   int64_t timems;                       // ms since the first packet
+   uint neuronid;
+} spikerecord_t;
+
+typedef struct {
+   spikerecord_t *records;
+   unsigned int size;                    // a power of 2
+   volatile unsigned int head __attribute__((aligned(64)));    // next record to fill, written by the decoder(s)
+   volatile unsigned int tail __attribute__((aligned(64)));    // next record to write out, written by the recorder thread
+   int64_t written, dropped;             // dropped = queue full, or no file open by the time it was written
+} spikequeue_t;
+
+spikequeue_t spikequeue;
+pthread_mutex_t recorderlock = PTHREAD_MUTEX_INITIALIZER;  // held by the recorder thread while it writes a block, and when closing the file
+pthread_mutex_t savelock = PTHREAD_MUTEX_INITIALIZER;      // held by a decoder for a packet when other panels' could be saving too
+pthread_mutex_t spinnlock = PTHREAD_MUTEX_INITIALIZER;     // held while a packet is added to a .spinn recording, and while one's opened or closed
+#define RECORDBLOCK (1024*1024)          // bytes formatted before each fwrite
+
+pthread_mutex_t decodelock = PTHREAD_MUTEX_INITIALIZER;    // serialises updates to (a panel's) plot data when there's more than one decoder, or a replay can seek
+int64_t framesdrawn=0;                   // render stage counter
+int64_t spikesdecoded=0;                 // spike events the decoders have seen (for the replay throughput summary)
+pthread_t *decodethreads=NULL;           // so we can ask how much CPU the decode stage has used
 
 int SPINN5_new[8][8]={
 0, 3, 8, 15, -1, -1, -1, -1, 
@@ -376,6 +690,39 @@ int OFFSET_NEURON_ID[5][16] = {
 int **BOARD_CONF;
 int *POPULATION_CHIP;
 int **POPULATION_CORE; 
+// key map built from the PACMAN placement and edge routing reports: one entry per core (slice) of every population
+#define MAXPOPULATIONS 256
+typedef struct {
+   char name[64];                        // vertex name as given in the reports
+   int size;                             // number of atoms (neurons)
+} pacmanpopulation_t;
+
+typedef struct {
+   uint key, mask;                       // routing key of the core (x<<24 | y<<16 | p<<11) and the mask covering its neurons
+   short population;                     // index into pacmanpopulations
+   int sliceoffset;                      // atom number of this core's neuron 0 within its population
+   int atoms;                            // neurons on this core
+} keyrange_t;
+
+pacmanpopulation_t pacmanpopulations[MAXPOPULATIONS];
+int numpacmanpopulations=0;
+keyrange_t *keyranges=NULL;              // sorted by key, for binary search
+int numkeyranges=0;
+
+int *retinalut=NULL;                     // RETINA2: (chip x, chip y, core) from a routing key -> pixel of neuron 0 on that core, -1 if not ours
+int retinalutchipsx=8, retinalutchipsy=8;  // RETINA2: the chips the lookup covers, a board's 8x8 or as far as BOARDS / the reports reach
+int64_t retinaunmapped=0;                // RETINA2: spike keys that didn't map to a pixel
+int64_t heatmapoverflows=0;              // HEATMAP: packets from chips (or with more data) than the plot has room for
+
+// traffic generator (-generate) and ingest benchmark (-benchingest): valid packets for the configured SIMULATION
+#define KEYSUNIFORM      0               // every key as likely as the next
+#define KEYSHOTSPOT      1               // 9 in 10 spikes from the first 16th of the keys, a bright patch of stimulus
+#define KEYSSWEEP        2               // a 16th of the keys active at once, moving along a key a packet, like a moving bar
+#define GENERATEBATCH    64              // datagrams handed to the kernel per sendmmsg
+uint *generatorkeys=NULL;                // keys (or chip addresses) the generator picks from, all of which land on the plot
+int generatorkeycount=0;
+int generatorspikesperpacket=1;          // spikes (or plotted values) carried by each generated packet
+int generatordistribution=KEYSUNIFORM;   // how the generated spikes are spread over the keys
 //end of variables for sdp spinnaker packet receiver - some could be local really - but with pthread they may need to be more visible
 
 
@@ -383,6 +730,7 @@ int **POPULATION_CORE;
 void error(char *msg);
 //void init_udp_server_spinnaker();
 void init_sdp_listening();
+void init_packet_rings();
 //void* input_thread (void *ptr);
 void* input_thread_SDP (void *ptr);
 void init_sdp_sender();
@@ -391,7 +739,9 @@ void sdp_sender(unsigned short dest_add, unsigned char dest_port, unsigned int c
 void create_new_window();
 void destroy_new_window();
 void display_win2();
+void display_panels(void);
 void filemenu (void);
+void replaymenu (void);
 void transformmenu (void);
 void modemenu (void);
 void colmenu (void);
@@ -399,14 +749,28 @@ void mymenu (int value);
 void rebuildmenu (void);
 void safelyshut(void);
 void open_or_close_output_file(void);
+void print_ingest_stats(void);
+void record_packet(unsigned char *packetbuffer, short length, int64_t timeoffset);
+void pyramid_refill(int64_t currentline, float timeperindex);
+void benchmark_decode(int64_t packets);
+void benchmark_colour(int frames);
+int parse_key_distribution(const char *name);
+int build_generator_keys(void);
+int generator_socket(void);
+int64_t generate_traffic(int sockfd, double spikespersecond, double seconds, int64_t *sendfailures);
+void benchmark_ingest(double stepseconds);
+void select_decoder(void);
+void build_retina_lut(int populationchips);
+int load_pacman_reports(const char *reportdir);
+void build_retina_lut_from_reports(const char *populationname);
 int paramload(void);
 // end of prototypes
 
 
-// setup socket for SDP frame receiving on port SDPPORT defined about (usually 17894)
-void init_sdp_listening()
+// setup a socket for SDP frame receiving on a port (usually 17894)
+int bind_sdp_port(int port)
 {
-   snprintf (portno_input, 6, "%d", SDPPORT);
+   snprintf (portno_input, 6, "%d", port);
 
    bzero(&hints_input, sizeof(hints_input));
    hints_input.ai_family = AF_INET; // set to AF_INET to force IPv4
@@ -443,10 +807,104 @@ void init_sdp_listening()
    }
 
    freeaddrinfo(servinfo_input);
+   return sockfd_input;
+}
+
+// the boards BOARDS names, in order, with their chip offsets: "host[:chipx:chipy], ..."
+void init_packet_sources()
+{
+   char board[200];
+   for (const char *at=BOARDS; *at!=0 && numsources<MAXSOURCES; ) {
+      int length=strcspn(at, ", ");
+      if (length>0) {
+         snprintf(board, sizeof(board), "%.*s", length, at);
+         packetsource_t *source = &packetsources[numsources];
+         char *offsets = strchr(board, ':');
+         if (offsets!=NULL) {
+            *offsets++=0;
+            source->chipx=(int)strtol(offsets, &offsets, 0);
+            if (*offsets==':') source->chipy=(int)strtol(offsets+1, NULL, 0);
+            if (source->chipx<0 || source->chipx>255 || source->chipy<0 || source->chipy>255) {
+               fprintf(stderr, "BOARDS: %s's chips can't be offset by (%d,%d), chip coordinates are 0-255\n", board, source->chipx, source->chipy);
+               exit(1);
+            }
+         }
+         hostent *validipfound = gethostbyname(board);
+         if (!validipfound) {
+            fprintf(stderr, "BOARDS: can't resolve %s\n", board);
+            exit(1);
+         }
+         source->ip = *(in_addr *)validipfound->h_addr;
+         printf("Board %d: %s, chips offset by (%d,%d).\n", numsources, inet_ntoa(source->ip), source->chipx, source->chipy);
+         numsources++;
+      }
+      at+=length;
+      at+=strspn(at, ", ");
+   }
+   boardslisted=numsources;
+}
+
+// listen on SDPPORT and any SDPPORTS, through epoll if there's more than the one
+void init_sdp_listening()
+{
+   listenports[numlisteners++]=SDPPORT;
+   for (char *at=SDPPORTS; *at!=0 && numlisteners<MAXLISTENERS; ) {
+      int port=(int)strtol(at, &at, 0);
+      if (port>0 && port!=SDPPORT) listenports[numlisteners++]=port;
+      at+=strspn(at, ", ");
+      if (*at!=0 && (*at<'0' || *at>'9')) break;         // (not a port number, so give up on the rest)
+   }
+   for (int i=0; i<numlisteners; i++) listenfds[i]=bind_sdp_port(listenports[i]);
+   sockfd_input=listenfds[0];
+
+   if (numlisteners>1) {
+      epollfd=epoll_create(MAXLISTENERS);
+      if (epollfd==-1) {
+         perror("SDP listener: epoll_create");
+         exit(-1);
+      }
+      for (int i=0; i<numlisteners; i++) {
+         struct epoll_event event;
+         event.events=EPOLLIN;
+         event.data.u32=i;
+         if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfds[i], &event)==-1) {
+            perror("SDP listener: epoll_ctl");
+            exit(-1);
+         }
+      }
+      printf("Listening on %d ports from %d.\n", numlisteners, SDPPORT);
+   }
+   init_packet_sources();
+
+   // preallocate the message headers so a whole batch of datagrams can be taken off the socket in one recvmmsg call
+   if (RECVBATCH<1) RECVBATCH=1;
+   recvmsgs = (struct mmsghdr*) calloc(RECVBATCH, sizeof(struct mmsghdr));
+   recviovecs = (struct iovec*) calloc(RECVBATCH, sizeof(struct iovec));
+   for (int i=0; i<RECVBATCH; i++) {
+      recviovecs[i].iov_len = RECVSLOTSIZE;
+      recvmsgs[i].msg_hdr.msg_iov = &recviovecs[i];
+      recvmsgs[i].msg_hdr.msg_iovlen = 1;
+   }
 
    //printf ("SDP UDP listener setup complete!\n");      // here ends the UDP listener setup witchcraft
 }
 
+// the rings between the packet source (receiver or replay) and the decode threads
+void init_packet_rings()
+{
+   if (DECODETHREADS<1) DECODETHREADS=1;
+   unsigned int ringsize=1;
+   while (ringsize<(unsigned int)PACKETRING || ringsize<(unsigned int)RECVBATCH) ringsize<<=1;
+   packetrings = (packetring_t*) calloc(DECODETHREADS, sizeof(packetring_t));
+   for (int i=0; i<DECODETHREADS; i++) {
+      packetrings[i].slots = (ringslot_t*) malloc(ringsize*sizeof(ringslot_t));
+      packetrings[i].size = ringsize;
+      pthread_mutex_init(&packetrings[i].waitlock, NULL);
+      pthread_cond_init(&packetrings[i].waitcond, NULL);
+   }
+   if (DECODETHREADS>1) recvarena = (ringslot_t*) malloc(RECVBATCH*sizeof(ringslot_t));
+}
+
 void *get_in_addr(struct sockaddr *sa)
 {
    if (sa->sa_family == AF_INET) {
@@ -456,513 +914,1788 @@ void *get_in_addr(struct sockaddr *sa)
    return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-void* input_thread_SDP (void *ptr)
+// -----------------------------------------------------------------------------------------------------
+// Per-SIMULATION packet decoders. Each visualisation's decoding is a policy (a struct with a static decode()), and
+// select_decoder() picks one once after paramload. The common packet handling in decode_sdp_packet<> is then
+// instantiated for that policy alone, so the per-packet path has no tests of SIMULATION and uses the constants below.
+
+struct decodeconstants {
+   float fixedpointscale;        // 1/2^FIXEDPOINT, for fixed point data words
+   int chipblock;                // EACHCHIPX*EACHCHIPY, number of plotted values per chip
+   int chipsacross;              // XDIMENSIONS/EACHCHIPX
+   int chipsdown;                // YDIMENSIONS/EACHCHIPY
+   uint numberofpoints;          // XDIMENSIONS*YDIMENSIONS
+   float integratordecay;        // exp(-0.001/0.03) for the integrator demo
+   unsigned int stiminpacket;    // STIM_IN_SPINN_PACKET already in network byte order
+   int decaying;                 // DECAYPROPORTION>0
+   float decayperus;             // log(DECAYPROPORTION) per us at MAXFRAMERATE
+} dc;
+
+// decay: rather than every point of immediate_data being decayed each frame, each notes when it was last updated and is
+//   decayed for the time since when it's next added to or drawn. So points with no activity cost nothing, and the decay
+//   is the same whatever the frame rate.
+int64_t *immediatetime;       // for each point, when (us) it was last updated
+int64_t decodenow;            // when the packet being decoded arrived (a panel's decoders are serialised)
+
+// the renderer never reads immediate_data itself. When it wants a frame's worth the decoders publish a copy, between
+//   packets, through three buffers so neither side ever waits for the other: the decoders fill one, the renderer reads
+//   another, and the third is the latest published. Each side swaps its own with that one with an atomic exchange.
+#define SNAPFRESH 4                         // (in snapmiddle) published since the renderer last took one
+float *immediatesnap[3];
+int64_t snaptime[3];                        // when (us) each was published, which its values are decayed to
+volatile int snapmiddle=2;                  // the latest published, | SNAPFRESH
+int snapwriter=0;                           // the decoders'
+int snapreader=1;                           // the renderer's
+volatile int snapwanted=1;                  // the renderer has taken the last one, so would like another
+volatile int immediateclearwanted=0;        // the renderer wants immediate_data cleared (the decoders do it)
+
+// the decoder in use, set by select_decoder() once the parameters are known
+void (*process_sdp_packet) (unsigned char *packetbuffer, int numbytes_input, struct sockaddr_in *si_other, int64_t nowtime) = NULL;
+
+// Panels: simparams may name several parameter groups ("input,conv_0,pool_0"), and each becomes a panel of its own -
+// its own decoder, data, history and plot - tiled in the one window and fed by the one receiver and set of decoders.
+// The globals above that are per visualisation are the defaults: each panel has its own copy of them in a
+// panelstate_t, and from here on their names are those of the panel the calling thread has switched to (thispanel).
+// So a decoder just switches to the panel a packet is for, and takes that panel's decodelock, not anyone else's; and
+// the renderer switches to each panel to draw it, reading what its decoders publish (the snapshots) without a lock.
+// Not everything knows about panels yet: with more than one, the decoders don't count into shards (DECODETHREADS>1
+// locks per packet as before); the spawned second window (win2) and its bespoke drawing don't know about panels; and the
+// -l2g/-g2l map files and the BOARD==5 position files are read into the first panel only.
+#define PANELSTATE \
+   PANELVAR(SIMULATION) PANELVAR(TITLE) PANELVAR(STARTMODE) PANELVAR(STARTCOLOUR) PANELVAR(displaymode) \
+   PANELVAR(colourused) PANELVAR(BLACKBACKGROUND) PANELVAR(INITZERO) PANELVAR(XDIMENSIONS) PANELVAR(YDIMENSIONS) \
+   PANELVAR(EACHCHIPX) PANELVAR(EACHCHIPY) PANELVAR(XCHIPS) PANELVAR(YCHIPS) PANELVAR(BOARD) PANELVAR(TIMEWINDOW) \
+   PANELVAR(displayWindow) PANELVAR(HISTORYSIZE) PANELVAR(MAXRASTERISEDNEURONS) PANELVAR(HISTORYTYPE) \
+   PANELVAR(RASTEREVENTS) PANELVAR(PYRAMIDLEVELS) PANELVAR(PYRAMIDBIN) PANELVAR(PYRAMIDLINES) PANELVAR(PYRAMIDEVENTS) \
+   PANELVAR(DISPLAYKEY) PANELVAR(KEYWIDTH) PANELVAR(DISPLAYXLABELS) PANELVAR(DISPLAYYLABELS) PANELVAR(keyWidth) \
+   PANELVAR(windowBorder) PANELVAR(windowHeight) PANELVAR(windowWidth) PANELVAR(HIWATER) PANELVAR(LOWATER) \
+   PANELVAR(lowwatermark) PANELVAR(highwatermark) PANELVAR(DYNAMICSCALE) PANELVAR(PERCENTAGESCALE) \
+   PANELVAR(LABELBYCHIP) PANELVAR(DISPLAYMINIPLOT) PANELVAR(XFLIP) PANELVAR(YFLIP) PANELVAR(VECTORFLIP) \
+   PANELVAR(ROTATEFLIP) PANELVAR(xflip) PANELVAR(yflip) PANELVAR(vectorflip) PANELVAR(rotateflip) \
+   PANELVAR(FIXEDPOINT) PANELVAR(BITSOFPOPID) PANELVAR(ALTERSTEPSIZE) PANELVAR(DECAYPROPORTION) \
+   PANELVAR(POPULATION_CORES) PANELVAR(POPULATION) PANELVAR(KEYBASE) PANELVAR(KEYMASK) \
+   PANELVAR(history_data) PANELVAR(history_data_set2) PANELVAR(historyepoch) PANELVAR(historynow) \
+   PANELVAR(historytimeperindex) PANELVAR(refillwanted) PANELVAR(refillline) \
+   PANELVAR(refilltimeperindex) PANELVAR(pyramid) PANELVAR(pyramidlog) PANELVAR(pyramidmask) PANELVAR(pyramidlogged) \
+   PANELVAR(historyevents) PANELVAR(historyevents2) PANELVAR(rasterrow) PANELVAR(immediate_data) PANELVAR(displaydata) \
+   PANELVAR(datacolours) PANELVAR(datafills) PANELVAR(heatmaptexture) PANELVAR(heatmaptexturewidth) \
+   PANELVAR(heatmaptextureheight) PANELVAR(scrollplots) PANELVAR(historyrewrites) PANELVAR(heatmapimage) \
+   PANELVAR(tilepixel) PANELVAR(maingrid) PANELVAR(minigrid) PANELVAR(tilecolours) PANELVAR(tiledata) \
+   PANELVAR(tiledataflips) PANELVAR(maplocaltoglobal) PANELVAR(mapglobaltolocal) PANELVAR(plotvaluesinblocks) \
+   PANELVAR(xdim) PANELVAR(ydim) PANELVAR(plotWidth) PANELVAR(printlabels) PANELVAR(fullscreen) \
+   PANELVAR(oldwindowBorder) PANELVAR(gridlines) PANELVAR(livebox) PANELVAR(alternorth) PANELVAR(altereast) \
+   PANELVAR(altersouth) PANELVAR(alterwest) PANELVAR(biasediting) PANELVAR(rasterpopulation) \
+   PANELVAR(biascurrent) PANELVAR(N_PER_PROC) PANELVAR(ID_OFFSET) PANELVAR(minneuridrx) PANELVAR(maxneuridrx) \
+   PANELVAR(retinalut) PANELVAR(dc) PANELVAR(immediatetime) PANELVAR(immediatesnap) PANELVAR(snaptime) \
+   PANELVAR(snapmiddle) PANELVAR(snapwriter) PANELVAR(snapreader) PANELVAR(snapwanted) \
+   PANELVAR(immediateclearwanted) PANELVAR(process_sdp_packet) \
+   PANELVAR(decodelock) PANELVAR(decodenow) PANELVAR(spikesdecoded) PANELVAR(retinaunmapped) PANELVAR(heatmapoverflows)
+
+#define MAXPANELS 16
+typedef struct {
+   #define PANELVAR(v) __typeof__(::v) v;
+   PANELSTATE
+   #undef PANELVAR
+} panelstate_t;
+
+panelstate_t panelstates[MAXPANELS];
+__thread panelstate_t *thispanel=&panelstates[0];    // the panel the calling thread is working on
+
+// panel 0 starts with the defaults, and each after it as a copy of the one before, for its parameters to change
+void init_panel_state (int p)
 {
-   struct sockaddr_in si_other; // for incoming frames
-   socklen_t addr_len_input =sizeof (struct sockaddr_in);
-   int64_t sincefirstpacket,nowtime;
-   char sdp_header_len=26;
-   unsigned char xsrc,ysrc;
-   unsigned int i, xcoord, ycoord;
+   if (p==0) {
+      #define PANELVAR(v) memcpy((void*)&panelstates[0].v, (void*)&(v), sizeof(v));
+      PANELSTATE
+      #undef PANELVAR
+   } else {
+      memcpy((void*)&panelstates[p], (void*)&panelstates[p-1], sizeof(panelstate_t));
+   }
+   pthread_mutex_init(&panelstates[p].decodelock, NULL);
+}
+
+#define SIMULATION              (thispanel->SIMULATION)
+#define TITLE                   (thispanel->TITLE)
+#define STARTMODE               (thispanel->STARTMODE)
+#define STARTCOLOUR             (thispanel->STARTCOLOUR)
+#define displaymode             (thispanel->displaymode)
+#define colourused              (thispanel->colourused)
+#define BLACKBACKGROUND         (thispanel->BLACKBACKGROUND)
+#define INITZERO                (thispanel->INITZERO)
+#define XDIMENSIONS             (thispanel->XDIMENSIONS)
+#define YDIMENSIONS             (thispanel->YDIMENSIONS)
+#define EACHCHIPX               (thispanel->EACHCHIPX)
+#define EACHCHIPY               (thispanel->EACHCHIPY)
+#define XCHIPS                  (thispanel->XCHIPS)
+#define YCHIPS                  (thispanel->YCHIPS)
+#define BOARD                   (thispanel->BOARD)
+#define TIMEWINDOW              (thispanel->TIMEWINDOW)
+#define displayWindow           (thispanel->displayWindow)
+#define HISTORYSIZE             (thispanel->HISTORYSIZE)
+#define MAXRASTERISEDNEURONS    (thispanel->MAXRASTERISEDNEURONS)
+#define HISTORYTYPE             (thispanel->HISTORYTYPE)
+#define RASTEREVENTS            (thispanel->RASTEREVENTS)
+#define PYRAMIDLEVELS           (thispanel->PYRAMIDLEVELS)
+#define PYRAMIDBIN              (thispanel->PYRAMIDBIN)
+#define PYRAMIDLINES            (thispanel->PYRAMIDLINES)
+#define PYRAMIDEVENTS           (thispanel->PYRAMIDEVENTS)
+#define DISPLAYKEY              (thispanel->DISPLAYKEY)
+#define KEYWIDTH                (thispanel->KEYWIDTH)
+#define DISPLAYXLABELS          (thispanel->DISPLAYXLABELS)
+#define DISPLAYYLABELS          (thispanel->DISPLAYYLABELS)
+#define keyWidth                (thispanel->keyWidth)
+#define windowBorder            (thispanel->windowBorder)
+#define windowHeight            (thispanel->windowHeight)
+#define windowWidth             (thispanel->windowWidth)
+#define HIWATER                 (thispanel->HIWATER)
+#define LOWATER                 (thispanel->LOWATER)
+#define lowwatermark            (thispanel->lowwatermark)
+#define highwatermark           (thispanel->highwatermark)
+#define DYNAMICSCALE            (thispanel->DYNAMICSCALE)
+#define PERCENTAGESCALE         (thispanel->PERCENTAGESCALE)
+#define LABELBYCHIP             (thispanel->LABELBYCHIP)
+#define DISPLAYMINIPLOT         (thispanel->DISPLAYMINIPLOT)
+#define XFLIP                   (thispanel->XFLIP)
+#define YFLIP                   (thispanel->YFLIP)
+#define VECTORFLIP              (thispanel->VECTORFLIP)
+#define ROTATEFLIP              (thispanel->ROTATEFLIP)
+#define xflip                   (thispanel->xflip)
+#define yflip                   (thispanel->yflip)
+#define vectorflip              (thispanel->vectorflip)
+#define rotateflip              (thispanel->rotateflip)
+#define FIXEDPOINT              (thispanel->FIXEDPOINT)
+#define BITSOFPOPID             (thispanel->BITSOFPOPID)
+#define ALTERSTEPSIZE           (thispanel->ALTERSTEPSIZE)
+#define DECAYPROPORTION         (thispanel->DECAYPROPORTION)
+#define POPULATION_CORES        (thispanel->POPULATION_CORES)
+#define POPULATION              (thispanel->POPULATION)
+#define KEYBASE                 (thispanel->KEYBASE)
+#define KEYMASK                 (thispanel->KEYMASK)
+#define history_data            (thispanel->history_data)
+#define history_data_set2       (thispanel->history_data_set2)
+#define historyepoch            (thispanel->historyepoch)
+#define historynow              (thispanel->historynow)
+#define historytimeperindex     (thispanel->historytimeperindex)
+#define refillwanted            (thispanel->refillwanted)
+#define refillline              (thispanel->refillline)
+#define refilltimeperindex      (thispanel->refilltimeperindex)
+#define pyramid                 (thispanel->pyramid)
+#define pyramidlog              (thispanel->pyramidlog)
+#define pyramidmask             (thispanel->pyramidmask)
+#define pyramidlogged           (thispanel->pyramidlogged)
+#define historyevents           (thispanel->historyevents)
+#define historyevents2          (thispanel->historyevents2)
+#define rasterrow               (thispanel->rasterrow)
+#define immediate_data          (thispanel->immediate_data)
+#define displaydata             (thispanel->displaydata)
+#define datacolours             (thispanel->datacolours)
+#define datafills               (thispanel->datafills)
+#define heatmaptexture          (thispanel->heatmaptexture)
+#define heatmaptexturewidth     (thispanel->heatmaptexturewidth)
+#define heatmaptextureheight    (thispanel->heatmaptextureheight)
+#define scrollplots             (thispanel->scrollplots)
+#define historyrewrites         (thispanel->historyrewrites)
+#define heatmapimage            (thispanel->heatmapimage)
+#define tilepixel               (thispanel->tilepixel)
+#define maingrid                (thispanel->maingrid)
+#define minigrid                (thispanel->minigrid)
+#define tilecolours             (thispanel->tilecolours)
+#define tiledata                (thispanel->tiledata)
+#define tiledataflips           (thispanel->tiledataflips)
+#define maplocaltoglobal        (thispanel->maplocaltoglobal)
+#define mapglobaltolocal        (thispanel->mapglobaltolocal)
+#define plotvaluesinblocks      (thispanel->plotvaluesinblocks)
+#define xdim                    (thispanel->xdim)
+#define ydim                    (thispanel->ydim)
+#define plotWidth               (thispanel->plotWidth)
+#define printlabels             (thispanel->printlabels)
+#define fullscreen              (thispanel->fullscreen)
+#define oldwindowBorder         (thispanel->oldwindowBorder)
+#define gridlines               (thispanel->gridlines)
+#define livebox                 (thispanel->livebox)
+#define alternorth              (thispanel->alternorth)
+#define altereast               (thispanel->altereast)
+#define altersouth              (thispanel->altersouth)
+#define alterwest               (thispanel->alterwest)
+#define biasediting             (thispanel->biasediting)
+#define rasterpopulation        (thispanel->rasterpopulation)
+#define biascurrent             (thispanel->biascurrent)
+#define N_PER_PROC              (thispanel->N_PER_PROC)
+#define ID_OFFSET               (thispanel->ID_OFFSET)
+#define minneuridrx             (thispanel->minneuridrx)
+#define maxneuridrx             (thispanel->maxneuridrx)
+#define retinalut               (thispanel->retinalut)
+#define dc                      (thispanel->dc)
+#define immediatetime           (thispanel->immediatetime)
+#define immediatesnap           (thispanel->immediatesnap)
+#define snaptime                (thispanel->snaptime)
+#define snapmiddle              (thispanel->snapmiddle)
+#define snapwriter              (thispanel->snapwriter)
+#define snapreader              (thispanel->snapreader)
+#define snapwanted              (thispanel->snapwanted)
+#define immediateclearwanted    (thispanel->immediateclearwanted)
+#define process_sdp_packet      (thispanel->process_sdp_packet)
+#define decodelock              (thispanel->decodelock)
+#define spikesdecoded           (thispanel->spikesdecoded)
+#define retinaunmapped          (thispanel->retinaunmapped)
+#define heatmapoverflows        (thispanel->heatmapoverflows)
+#define decodenow               (thispanel->decodenow)
+
+// a point's value at 'now'
+static inline float immediate_value (int point, int64_t now)
+{
+   float value=immediate_data[point];
+   if (!dc.decaying || !(value>(NOTDEFINEDFLOAT+1))) return value;
+   int64_t since=now-immediatetime[point];
+   return (since>0) ? value*expf(dc.decayperus*(float)since) : value;
+}
+
+// set a point's value now, handing it back for the history (ids past the plot are dropped, as history_store does)
+static inline float immediate_set (uint point, float value)
+{
+   if (point>=dc.numberofpoints) return value;    // (off the plot)
+   immediate_data[point]=value;
+   if (dc.decaying) immediatetime[point]=decodenow;
+   return value;
+}
+
+static inline float immediate_add (uint point, float value)
+{
+   if (point>=dc.numberofpoints) return value;    // (off the plot)
+   return immediate_set(point, immediate_value(point, decodenow)+value);
+}
+
+void clear_immediate (float *data)
+{
+   for (int i=0; i<(xdim*ydim); i++) data[i]=INITZERO?0.0:NOTDEFINEDFLOAT;
+}
+
+// the renderer has asked the decoders for something (a snapshot, a clear, a refill)
+static inline int decoders_asked (void)
+{
+   return snapwanted || immediateclearwanted || refillwanted;
+}
+
+// decoder side, serialised like the decoding: do what the renderer's asked for, and publish a copy of immediate_data
+//   if one's wanted
+void publish_immediate (void)
+{
+   if (immediateclearwanted) {
+      immediateclearwanted=0;
+      clear_immediate(immediate_data);
+   }
+   if (refillwanted) {
+      refillwanted=0;                          // (before the refill, so a request made during it isn't lost)
+      __sync_synchronize();
+      pyramid_refill(refillline, refilltimeperindex);
+   }
+   if (!snapwanted) return;
+   snapwanted=0;                            // (before the copy, so a request made during it isn't lost)
    struct timeval stopwatchus;
+   gettimeofday(&stopwatchus,NULL);
+   int64_t now = (freezedisplay==1) ? freezetime : (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   float *snap=immediatesnap[snapwriter];
+   if (dc.decaying) for (int i=0; i<(xdim*ydim); i++) snap[i]=immediate_value(i, now);
+   else memcpy(snap, immediate_data, xdim*ydim*sizeof(float));
+   snaptime[snapwriter]=now;
+   __sync_synchronize();                    // the copy is complete before it's published
+   snapwriter = __sync_lock_test_and_set(&snapmiddle, snapwriter|SNAPFRESH) & ~SNAPFRESH;
+}
 
-   //printf("Listening for SDP frames.");
+// renderer side: the decoders have been asked for something (a snapshot, a clear, a refill). One that's asleep for want of
+//   packets is woken to do it now, rather than when its wait times out.
+void wake_decoders (void)
+{
+   __sync_synchronize();                    // (the request is seen before we look to see who's asleep)
+   for (int i=0; packetrings!=NULL && i<DECODETHREADS; i++) {
+      packetring_t *ring = &packetrings[i];
+      if (ring->consumerwaiting) {
+         pthread_mutex_lock(&ring->waitlock);
+         pthread_cond_signal(&ring->waitcond);
+         pthread_mutex_unlock(&ring->waitlock);
+      }
+   }
+}
 
-   while (1) {                             // for ever ever, ever ever.
-      int numAdditionalBytes = 0;
-
-      if ((numbytes_input = recvfrom(sockfd_input, buffer_input, sizeof buffer_input , 0,
-                                     (sockaddr*)&si_other, (socklen_t*)&addr_len_input)) == -1) {
-
-         printf("Error line 441: : %s\n",strerror(errno));
-         perror((char*)"error recvfrom");
-         exit(-1);                    // will only get here if there's an error getting the input frame off the Ethernet
-      }
-
-      scanptr = (sdp_msg*) buffer_input;              // pointer to our packet in the buffer from the Ethernet
-      scanptrspinn = (spinnpacket*) buffer_input;          // pointer to our packet in the buffer from the Ethernet
-      numAdditionalBytes = numbytes_input-sdp_header_len;    // used for SDP only
-
-      if(scanptrspinn->cmd_rc!=htonl(SPINN_HELLO)) {    // we process only spinnaker packets that are non-hellos
-
-         if (spinnakerboardipset==0) {                // if no ip: set ip,port && init
-            // if we don't already know the SpiNNaker board IP then we learn that this is our board to listen to
-            spinnakerboardip=si_other.sin_addr;
-            spinnakerboardport=htons(si_other.sin_port);
-            spinnakerboardipset++;
-            init_sdp_sender();
-            printf("Pkt Received from %s on port: %d\n", inet_ntoa(si_other.sin_addr),htons(si_other.sin_port));
-         }        // record the IP address of our SpiNNaker board.
-
-         if (spinnakerboardport==0) {                // if no port: set port && init
-            // if we don't already know the SpiNNaker port, then we get this dynamically from an incoming message.
-            spinnakerboardport=htons(si_other.sin_port);
-            init_sdp_sender();
-            printf("Pkt Received from %s on port: %d\n", inet_ntoa(si_other.sin_addr),htons(si_other.sin_port));
-         }        // record the port number we are being spoken to upon, and open the SDP connection externally.
-
-         // ip && port are now set, so process this SpiNNaker packet
-
-
-         /*
-                 //For debugging if you like that sort of thing... (usually commented)
-                 if (scanptrspinn->cmd_rc!=htonl(SPINN_HELLO)) {
-                   printf ("received SDP packet of %d bytes\n", numbytes_input);
-                   printf ("Header of %d Bytes, Data of %d Bytes\n",sdp_header_len,numAdditionalBytes);
-                   printf("ip_time_out: %d. Padded by: %d\n",scanptr->ip_time_out,scanptr->pad);
-                   printf("flags: %d. Tagged by: %d\n",scanptr->flags,scanptr->tag);
-                   printf("dest_port: %d. srce_port: %d\n",scanptr->dest_port,scanptr->srce_port);
-                   printf("dest_addr: %d. srce_addr: %d\n",scanptr->dest_addr,scanptr->srce_addr);
-                   printf("cmd_rc: %d.\n",scanptr->cmd_rc);
-                   printf("arg1: %d.\n",scanptr->arg1);
-                   printf("arg2: %d.\n",scanptr->arg2);
-                   printf("arg3: %d.\n",scanptr->arg3);
-                   printf("data[0]: %x.\n",scanptr->data[0]);
-                   printf("data[1]: %x.\n",scanptr->data[1]);
-                   printf("\n");
-                 }
-         */
-
-         gettimeofday(&stopwatchus,NULL);                // grab current time
-         nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
-         if (firstreceivetimez==0) firstreceivetimez=nowtime;        // if 1st packet then note it's arrival
-         sincefirstpacket = (nowtime-firstreceivetimez)/1000;        // how long in ms since visualisation got 1st valid packet.
-
-         float timeperindex = displayWindow / (float) plotWidth;    // time in seconds per history index in use (or pixel displayed)
-         //printf("Here, with timeperindex:%f, and y_scaling_factor:%f. Display Window = %f fps.\n",timeperindex,y_scaling_factor,displayWindow);
-         int updateline=((nowtime-starttimez)/(int64_t)(timeperindex*1000000)) % (HISTORYSIZE);    // which index is being updated (on the right hand side)
-
-         if (updateline<0 || updateline>HISTORYSIZE) {
-            printf("Error line 500: Updateline out of bounds: %d. Time per Index: %f. \n  Times - Now:%lld  Start:%lld \n",updateline, timeperindex, (long long int)nowtime, (long long int)starttimez); // CPDEBUG
-         } else {
-            if (freezedisplay==0) {
-               int linestoclear = updateline-lasthistorylineupdated;            // work out how many lines have gone past without activity.
-               // when window is reduced updateline reduces. ths causes an underflow construed as a wraparound. TODO.
-               if (linestoclear<0 && (updateline+500)>lasthistorylineupdated) linestoclear=0;        // to cover any underflow when resizing plotting window smaller (wrapping difference will be <500)
-               if (linestoclear<0) linestoclear = (updateline+HISTORYSIZE)-lasthistorylineupdated;     // if has wrapped then work out the true value
-               int numberofdatapoints=xdim*ydim;
-               for (int i=0; i<linestoclear; i++) {
-                  //printf("%d - %d =  %d (with WindowWidth: %d)\n",updateline, lasthistorylineupdated, linestoclear, windowWidth);
-                  for (int j=0; j<numberofdatapoints; j++) history_data[(1+i+lasthistorylineupdated)%(HISTORYSIZE)][j]= INITZERO?0.0:NOTDEFINEDFLOAT;  // nullify data in the quiet period
-                  if (win2) {
-                     numberofdatapoints=MAXRASTERISEDNEURONS;                // bespoke for Discovery demo
-                     for (int j=0; j<numberofdatapoints; j++) history_data_set2[(1+i+lasthistorylineupdated)%(HISTORYSIZE)][j]=INITZERO?0.0:NOTDEFINEDFLOAT;  // nullify data in the quiet period
-                  }
-               }
-               // printf("%d - %d =  %d (with WindowWidth: %d)\n",updateline, lasthistorylineupdated, linestoclear, windowWidth);
-               lasthistorylineupdated=updateline;
-            }
-         }
+// renderer side: the latest published copy, and when it was taken
+float* take_immediate (int64_t *taken)
+{
+   if (snapmiddle & SNAPFRESH) {
+      __sync_synchronize();
+      snapreader = __sync_lock_test_and_set(&snapmiddle, snapreader) & ~SNAPFRESH;
+      snapwanted=1;
+      wake_decoders();
+   }
+   *taken=snaptime[snapreader];
+   return immediatesnap[snapreader];
+}
 
-         if (SIMULATION==RETINA) {
-            if (freezedisplay==0 && htonl(scanptrspinn->cmd_rc)==STIM_IN_SPINN_PACKET) {    // if we are not paused & we got the proper command
-               for (int i=0; i<(numbytes_input-18)/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-                  uint spikerID=scanptrspinn->data[i]&0xFF;    // Get the firing neuron ID (mask off last 8 bits for neuronID ignoring chip/coreID)
-                  immediate_data[spikerID]+=1;            // Set the bit to say it's arrived
-                  if (spikerID<minneuridrx) minneuridrx=spikerID;
-                  if (spikerID>maxneuridrx) maxneuridrx=spikerID;
-                  history_data[updateline][spikerID]=immediate_data[spikerID];  // add to count in this interval
-                  if (outputfileformat==2) {                // write to output file only if required and in NeuroTools format (2)
-                     if (writingtofile==0) {
-                        writingtofile=1;        // 3 states.  1=busy writing, 2=paused, 0=not paused, not busy can write.
-                        fprintf(fileoutput,"%lld.0\t%d.0\n",(long long int)sincefirstpacket,spikerID);      // neurotools format (ms and NeurID)
-                        writingtofile=0;        // note write finished
-                     }
-                  }
-                  //printf("Data Processed: %d, Data Raw:%d.\n",spikerID, immediate_data[spikerID]);
-               }        //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
-               somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
-            }
-         }
+// queue a spike for the recorder thread if we're saving spikes (and not paused). Never blocks: if the queue is full it's counted as dropped.
+// decoders drop data while the display is paused, unless it's a replay seek putting back the history
+static inline int decodefrozen (void)
+{
+   return freezedisplay!=0 && replayrebuilding==0;
+}
+
+static inline void record_spike (int64_t sincefirstpacket, uint neuronid)
+{
+   if (outputfileformat<2 || writingtofile!=0 || replayrebuilding!=0) return;
+   unsigned int head=spikequeue.head;
+   if (head-spikequeue.tail >= spikequeue.size) {
+      spikequeue.dropped++;
+      return;
+   }
+   spikequeue.records[head & (spikequeue.size-1)].timems = sincefirstpacket;
+   spikequeue.records[head & (spikequeue.size-1)].neuronid = neuronid;
+   __sync_synchronize();                    // record is complete before the recorder can see it
+   spikequeue.head=head+1;
+}
+
+// note that data point id has been written in history line 'line' (its events are added to the ring, or counted if it's there already)
+static inline void note_event (eventhistory_t *eh, int line, uint id)
+{
+   if (line!=eh->openline) {                   // moving to another line
+      if (eh->first[line]==eh->end[line]) eh->first[line]=eh->end[line]=eh->written;    // nothing in it yet, starts here
+      else if (eh->end[line]!=eh->written) eh->dense[line]=1;    // can't carry on from where it left off
+      eh->openline=line;
+   }
+   if (eh->dense[line]) return;
+   int64_t at=eh->slot[id];
+   if (at>=eh->first[line] && at<eh->end[line]) {
+      eh->events[at & eh->mask].count++;       // already has an event in this line
+      return;
+   }
+   if (eh->written-eh->first[line]>eh->mask) {
+      eh->dense[line]=1;                        // more events in this line than the ring holds
+      return;
+   }
+   rasterevent_t *event=&eh->events[eh->written & eh->mask];
+   event->id=id;
+   event->count=1;
+   eh->slot[id]=eh->written;
+   __sync_synchronize();                        // event is complete before the renderer can see it
+   eh->end[line]=++eh->written;
+}
+
+static inline void clear_events (eventhistory_t *eh, int line)
+{
+   eh->first[line]=eh->end[line]=eh->written;
+   eh->dense[line]=0;
+}
+
+// is this history line's data from the last HISTORYSIZE time bins?
+static inline int history_current (int line)
+{
+   int64_t epoch=historyepoch[line];
+   return epoch<=historynow && epoch>historynow-HISTORYSIZE;
+}
 
+// a value as stored, whatever time it's from
+static inline float history_raw (historyring_t *h, int line, int point)
+{
+   unsigned char *at=h->data+(line*h->stride);
+   if (h->size==1) return at[point] ? (float)(at[point]-1) : NOTDEFINEDFLOAT;
+   if (h->size==2) return ((unsigned short*)at)[point] ? (float)(((unsigned short*)at)[point]-1) : NOTDEFINEDFLOAT;
+   return ((float*)at)[point];
+}
+
+static inline float history_value (historyring_t *h, int line, int point)
+{
+   if (!history_current(line)) return INITZERO?0.0:NOTDEFINEDFLOAT;    // (as if cleared)
+   return history_raw(h, line, point);
+}
 
-         if (SIMULATION==SEVILLERETINA) {
-            uint commandcode=scanptr->cmd_rc;
-            uint columnnum=scanptr->arg1;
-            uint numofrows=scanptr->arg2;
-            uint numofcols=scanptr->arg3;
-
-            if (freezedisplay==0 && commandcode==0x4943) {            // if we are not paused, going to I.C. the seville retina
-               for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of signed shorts)
-                  short datain1=(scanptr->data[i])&0xFFFF;    // 1st of the pair
-                  short datain2=(scanptr->data[i]>>16)&0xFFFF;    // 2nd of the pair
-                  uint pixelid=columnnum*numofrows+(i*2);        // 1st pixel ID
-                  //printf("(%d,%d) %d   and  (%d,%d) %d.\n",columnnum,i*2,datain1,columnnum,(i*2)+1,datain2);
-                  //printf("[%d] --  %d) %d,  %d) %d  from 0x%x.\n",pixelid,i*2,datain1,(i*2)+1,datain2,scanptr->data[i]);
-                  immediate_data[pixelid]=datain1;        // store 1st pixel ID
-                  history_data[updateline][pixelid]=immediate_data[pixelid];            // replace any data here already
-                  immediate_data[pixelid+1]=datain2;        // store 2nd pixel ID
-                  history_data[updateline][pixelid+1]=immediate_data[pixelid+1];            // replace any data here already
+// (forced inline as the decoders store every value through here, and it's only cheap if the size test goes with it)
+static inline __attribute__((always_inline)) void history_set (historyring_t *h, int line, int point, float value)
+{
+   unsigned char *at=h->data+(line*h->stride);
+   if (h->size==4) {
+      ((float*)at)[point]=value;
+      return;
+   }
+   int64_t most = (h->size==1) ? 0xFF : 0xFFFF;
+   int64_t count = (int64_t)(value+(float)1.5);          // rounded, +1
+   if (count<1) count=1; else if (count>most) count=most;
+   if (value<=(NOTDEFINEDFLOAT+1)) count=0;              // no data
+   if (h->size==1) at[point]=count;
+   else ((unsigned short*)at)[point]=count;
+}
+
+// nullify the first 'points' of a history line
+void history_clear (historyring_t *h, int line, int points)
+{
+   unsigned char *at=h->data+(line*h->stride);
+   if (h->size==4) {
+      float nodata=INITZERO?0.0:NOTDEFINEDFLOAT;
+      for (int j=0; j<points; j++) ((float*)at)[j]=nodata;
+   } else if (INITZERO==0) {
+      memset(at, 0, points*h->size);                       // (0 is no data)
+   } else {
+      for (int j=0; j<points; j++) history_set(h, line, j, 0.0);
+   }
+}
+
+void alloc_history (historyring_t *h, int size, int points, int lines)
+{
+   void *block;
+   h->size=size;
+   h->stride=((points*size)+HISTORYALIGN-1) & ~(size_t)(HISTORYALIGN-1);
+   if (posix_memalign(&block, HISTORYALIGN, lines*h->stride)!=0) {
+      fprintf(stderr, "Can't allocate %ld bytes of history.\n", (long)(lines*h->stride));
+      exit(1);
+   }
+   h->data=(unsigned char*)block;    // (left as it comes, as no line is read until it's claimed for some data)
+}
+
+// nullify a history line that's had no data written (a quiet period)
+void clear_history_line (int line)
+{
+   history_clear(&history_data, line, xdim*ydim);
+   clear_events(&historyevents, line);
+   if (win2) {
+      history_clear(&history_data_set2, line, MAXRASTERISEDNEURONS);    // bespoke for Discovery demo
+      clear_events(&historyevents2, line);
+   }
+}
+
+// make a history line ready for the data of time bin 'epoch', clearing it if it still holds an older bin's. Returns as
+//   soon as another decode thread has done it.
+void claim_history_line (int line, int64_t epoch)
+{
+   for (;;) {
+      int64_t was=*(volatile int64_t*)&historyepoch[line];
+      if (was==epoch) return;
+      if (was!=HISTORYBUSY && __sync_bool_compare_and_swap(&historyepoch[line], was, (int64_t)HISTORYBUSY)) break;
+   }
+   clear_history_line(line);
+   __sync_synchronize();                        // the clear is complete before the line is used
+   historyepoch[line]=epoch;
+}
+
+// forget all the history (e.g. when it's about to be rebuilt for a different time)
+void forget_history (void)
+{
+   for (int i=0; i<HISTORYSIZE; i++) historyepoch[i]=HISTORYNEVER;
+   for (int l=0; l<PYRAMIDLEVELS; l++)
+      for (int i=0; i<PYRAMIDLINES; i++) pyramid[l].epoch[i]=HISTORYNEVER;
+}
+
+void alloc_pyramid (int size, int points)
+{
+   if (PYRAMIDLEVELS>PYRAMIDMAXLEVELS) PYRAMIDLEVELS=PYRAMIDMAXLEVELS;
+   if (PYRAMIDLINES<1 || PYRAMIDBIN<1) PYRAMIDLEVELS=0;
+   if (PYRAMIDLEVELS<=0) return;
+   unsigned int logsize=1;
+   while (logsize<(unsigned int)PYRAMIDEVENTS) logsize<<=1;
+   pyramidlog = (pyramidevent_t*) malloc(logsize*sizeof(pyramidevent_t));
+   pyramidmask = logsize-1;
+   int64_t binus=PYRAMIDBIN;
+   for (int l=0; l<PYRAMIDLEVELS; l++, binus*=10) {
+      if (l==0) {
+         pyramid[l].first = (int64_t*) calloc(PYRAMIDLINES, sizeof(int64_t));
+         pyramid[l].end = (int64_t*) calloc(PYRAMIDLINES, sizeof(int64_t));
+      } else {
+         alloc_history(&pyramid[l].data, size, points, PYRAMIDLINES);
+      }
+      pyramid[l].epoch = (int64_t*) malloc(PYRAMIDLINES*sizeof(int64_t));
+      pyramid[l].binus = binus;
+      pyramid[l].line = 0;
+   }
+}
+
+void free_pyramid (void)
+{
+   for (int l=0; l<PYRAMIDLEVELS; l++) {
+      if (l==0) {
+         free(pyramid[l].first);
+         free(pyramid[l].end);
+      } else {
+         free(pyramid[l].data.data);
+      }
+      free(pyramid[l].epoch);
+   }
+   if (PYRAMIDLEVELS>0) free(pyramidlog);
+}
+
+// the span of the log a bin of the finest resolution has, or 0 if it's been overwritten since
+static inline int pyramid_logged (int line, int64_t *first, int64_t *end)
+{
+   *first = pyramid[0].first[line];
+   *end = (line==pyramid[0].line) ? pyramidlogged : pyramid[0].end[line];    // (the bin being written is still growing)
+   return *first>=pyramidlogged-(int64_t)pyramidmask-1;
+}
+
+// put the latest value of each point in one bin into another (of the same size values), if it has one
+void fold_bin (historyring_t *from, int fromline, historyring_t *to, int toline, int points)
+{
+   unsigned char *src=from->data+(fromline*from->stride), *dst=to->data+(toline*to->stride);
+   if (from->size==4) {
+      for (int j=0; j<points; j++) if (((float*)src)[j]>(NOTDEFINEDFLOAT+1) && (INITZERO==0 || ((float*)src)[j]!=0)) ((float*)dst)[j]=((float*)src)[j];
+   } else if (from->size==2) {
+      for (int j=0; j<points; j++) if (((unsigned short*)src)[j]>(INITZERO?1:0)) ((unsigned short*)dst)[j]=((unsigned short*)src)[j];
+   } else {
+      for (int j=0; j<points; j++) if (src[j]>(INITZERO?1:0)) dst[j]=src[j];
+   }
+}
+
+// put the values logged in a bin of the finest resolution into a dense line, latest last
+int fold_log (int line, historyring_t *to, int toline)
+{
+   int64_t first, end;
+   if (!pyramid_logged(line, &first, &end)) return 0;
+   for (int64_t e=first; e<end; e++) history_set(to, toline, pyramidlog[e & pyramidmask].id, pyramidlog[e & pyramidmask].value);
+   return 1;
+}
+
+// point a level of the pyramid at its bin for this time (us since the start), clearing it if it held an older bin. The
+//   bin it leaves is complete so is folded into the next level's. Decoders are serialised, and the refill is done by
+//   one of them, so nothing else is looking at the same time.
+void claim_pyramid_bin (int l, int64_t sincestart)
+{
+   pyramidlevel_t *level=&pyramid[l];
+   int64_t bin=sincestart/level->binus;
+   int line=bin % PYRAMIDLINES;
+   if (level->epoch[line]==bin) {
+      level->line=line;
+      return;
+   }
+   int64_t left=level->epoch[level->line];
+   if (l==0) level->end[level->line]=pyramidlogged;    // (complete)
+   if (l+1<PYRAMIDLEVELS && left>=0) {
+      claim_pyramid_bin(l+1, left*level->binus);    // (which may in turn fold that level's last bin up)
+      if (l==0) fold_log(level->line, &pyramid[1].data, pyramid[1].line);
+      else fold_bin(&level->data, level->line, &pyramid[l+1].data, pyramid[l+1].line, xdim*ydim);
+   }
+   level->epoch[line]=HISTORYNEVER;
+   __sync_synchronize();
+   if (l==0) level->first[line]=level->end[line]=pyramidlogged;
+   else history_clear(&level->data, line, xdim*ydim);
+   __sync_synchronize();                        // cleared before it's seen as this bin's
+   level->epoch[line]=bin;
+   level->line=line;
+}
+
+// refill the history lines shown for a new time per line from the pyramid. Each line takes the latest value of each
+//   point in the bins it covers, from the finest resolution with bins no longer than a line that still has its time
+//   (or coarser ones, which spread over several lines, as the data gets older). Decoder side, when the renderer asks.
+void pyramid_refill (int64_t currentline, float timeperindex)
+{
+   int64_t usperline=(int64_t)(timeperindex*1000000);
+   if (PYRAMIDLEVELS==0 || usperline<=0) return;
+   int finest=0;
+   while (finest+1<PYRAMIDLEVELS && pyramid[finest+1].binus<=usperline) finest++;
+   int lines=(plotWidth+1<HISTORYSIZE) ? plotWidth+1 : HISTORYSIZE;
+   for (int k=0; k<lines && currentline-k>=0; k++) {
+      int64_t bin=currentline-k;
+      int line=bin % (HISTORYSIZE);
+      int64_t from=bin*usperline, to=from+usperline;    // (us since the start)
+      for (int l=finest; l<PYRAMIDLEVELS; l++) {
+         pyramidlevel_t *level=&pyramid[l];
+         int filled=0;
+         int64_t last=(level->binus<=usperline) ? to/level->binus : (to+level->binus-1)/level->binus;    // (each bin to the line it ends in)
+         for (int64_t b=from/level->binus; b<last; b++) {
+            int binline=b % PYRAMIDLINES;
+            int64_t first, end;
+            if (level->epoch[binline]!=b) continue;    // not got this time (any more)
+            if (l==0 && !pyramid_logged(binline, &first, &end)) continue;
+            if (filled++==0) claim_history_line(line, bin);
+            if (l==0) {
+               fold_log(binline, &history_data, line);
+            } else {
+               for (int j=0; j<xdim*ydim; j++) {
+                  float value=history_raw(&level->data, binline, j);
+                  if (value>(NOTDEFINEDFLOAT+1) && (INITZERO==0 || value!=0)) history_set(&history_data, line, j, value);
                }
             }
          }
+         if (filled) {
+            historyevents.dense[line]=1;        // (no event list for it, so the raster scans it)
+            break;
+         }
+      }
+   }
+   historyrewrites++;                          // the plot needs drawing again from the refilled history
+}
 
-		if (SIMULATION==RETINA2) 	{ // FG for Seville Retina 19th Apr 2013
-
-	          if (freezedisplay==0) {  // so long as the display is still active then listen to new input          
-//                printf("packet received length: %d\n", numAdditionalBytes/4);
-                for (uint e =0; e < numAdditionalBytes/4; e++)
-                {
-                    uint bottom_rkey = scanptr->data[e] & 0xFFFFFFFF;
-                    short x_chip=(bottom_rkey >> 24) & 0xFF;
-                    short y_chip=(bottom_rkey >> 16) & 0xFF;
-                    short coreID=(bottom_rkey >> 11) & 0x1F;
-		            short neuronID=bottom_rkey & 0x7FF; 
-
-                    short  neuron_id = 0;
-                    short virtual_neuronID = 0;
-		            if (BOARD==5)
-		            {
-
-		                //virtual_neuronID = (SPINN5_new[x_chip][y_chip] * 16 + coreID) * N_PER_PROC + neuronID + ID_OFFSET;
-		                //neuron_id = virtual_neuronID % (XDIMENSIONS*YDIMENSIONS);
-		                //int chip_num = SPINN5_new[x_chip][y_chip];
-		                //int virtual_chip = VIRTUAL_CHIP[chip_num];
-		                //neuron_id = OFFSET_NEURON_ID[virtual_chip][coreID - 1] + neuronID;
-                        printf("%d-%d-%d-%d\n",x_chip,y_chip,coreID,neuronID);
-		                int chip_num = SPINN5_new[x_chip][y_chip];
-		                if (chip_num < 0)
-		                    printf("Invalide chip number, please check the board configuration.\n");
-		                else{
-		                    int virtual_chip = POPULATION_CHIP[chip_num];
-		                    if ( virtual_chip < 0)
-		                        printf("Invalide packets for this population, only one population recored in real-time.\n");
-		                    else{
-		                        neuron_id = POPULATION_CORE[virtual_chip][coreID - 1] + neuronID;
-
-		                    
-	                            ushort x_coord_neuron=neuron_id % XDIMENSIONS;                // X coordinate is lower 4 bits [0:3]
-	                            ushort y_coord_neuron=neuron_id / YDIMENSIONS;                // Y coordinate is bits [11:4] ??
-                                //printf("neuronID=%d, x=%d,y=%d,XDIMENSIONS=%d,YDIMENSIONS=%d\n", neuron_id, x_coord_neuron, y_coord_neuron, XDIMENSIONS,YDIMENSIONS);
-	                            uint pixelid = neuron_id;                           // indexID
-
-		                        immediate_data[pixelid]+=1;//*MAXFRAMERATE;             // store 1st pixel ID
-	                            history_data[updateline][pixelid]=x_coord_neuron;  // replace any data here already
-	                        }
-	                   }
-		            }
-		            //immediate_data[pixelid]=x_coord_neuron;             // store 1st pixel ID
-	                //history_data[updateline][pixelid]=x_coord_neuron;  // replace any data here already
-	                //immediate_data[pixelid+1]=y_coord_neuron;           // store 2nd pixel ID
-	                //history_data[updateline][pixelid+1]=y_coord_neuron;// replace any data here already
-				}
-	          }
-		}
-
-
-        if (SIMULATION==COCHLEA) 	{ //  QL for silicon cochlea 27th Aug 2013, CP incorporated 4th Sept 2013.
-	       if (freezedisplay==0) {  // so long as the display is still active then listen to new input          
-              short neuronID=scanptr->data[0]%0x0800;
-              short coreID=(scanptr->data[0]>>11)%0x20;
-              short x_chip=(scanptr->data[0]>>24);
-              short y_chip=(scanptr->data[0]>>16)%0x0100;
-              short NUM_Cell=4;
-              short NUM_Channel=64;               
-              short x_coord=(coreID-1)*NUM_Cell+neuronID%NUM_Cell;
-              short y_coord=neuronID/NUM_Cell;
-                
-              uint pixelid = (x_coord*NUM_Channel) + y_coord;
-              immediate_data[pixelid]+=1;
-              history_data[updateline][pixelid]=immediate_data[pixelid];
-             }
-        }
-
-
-         if (SIMULATION==RATEPLOTLEGACY) {
-            uint chippopulationid=(scanptr->srce_port&0x1F)-1;            // Francesco maps Virtual CPU ID to population 1:1 (at present)
-            xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
-            ysrc=scanptr->srce_addr%256; // and the chip Y coord
-            //printf("Xsrc:%d, YSrc:%d\n",xsrc,ysrc);
-            xcoord = (xsrc*EACHCHIPX)+(chippopulationid/EACHCHIPY);        // each chip has 16 population values, 0=bottom left
-            ycoord = ((ysrc*EACHCHIPY)+(chippopulationid%EACHCHIPY));// 3 = top left, 12=BtmR, 15=TopR
-            //printf("chippop:%d,  xcoord:%d, ycoord:%d\n",chippopulationid,xcoord,ycoord);
-            //uint populationid=(ycoord*YDIMENSIONS)+xcoord;
-            uint populationid=(EACHCHIPX*EACHCHIPY)*((ysrc*(XDIMENSIONS/EACHCHIPX))+xsrc) + chippopulationid;
-            // (EACHCHIPX*EACHCHIPY)*((ysrc*(XDIMENSIONS/EACHCHIPX))+xsrc) + populationid
-            //printf("PopulationID: %d. Original: %d\n",populationid,chippopulationid);
-            uint commandcode=scanptr->cmd_rc;
-            uint intervalinms=scanptr->arg2+1;                // how often we are getting population firing counts for this population
-            uint neuronsperpopulation=scanptr->arg3;            // how many neurons are in this population ID
-
-            if (freezedisplay==0 && commandcode==257) {            // if we are not paused, going to populate rata data
-               biascurrent[populationid]=(float)scanptr->arg1/256.0;      // 8.8 fixed format data for the bias current used for this population
-               //if (populationid!=500) printf("BiasCurr: %f.  Interval: %dms,  NeuronsPerPopulation: %d.\n",biascurrent[populationid], intervalinms, neuronsperpopulation);
-               for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-                  uint spikesperinterval=scanptr->data[i];    // Spikes per interval for this population
-                  immediate_data[populationid]=(spikesperinterval*1000.0)/(float)(intervalinms*neuronsperpopulation);    // for this population stores average spike rate - in spikes per neuron/second
-                  history_data[updateline][populationid]=immediate_data[populationid];            // replace any data here already
-                  // printf("Data Raw:%d, PopID: %d,  Value: %d. Average %d spikes/neuron/s in this population of %d neurons each %d ms.\n",scanptr->data[i], populationid, spikesperinterval, immediate_data[populationid],neuronsperpopulation,intervalinms );
-               }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
-               somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
-            }  // receive rate data
-            if (freezedisplay==0 && commandcode==256) {            // if we are not paused, going to populate raster spike data
-               for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-                  uint neuronID=scanptr->data[i]&0xFF;        // Which neuron has fired in this population (last 8 bits are significant)
-                  if (neuronID<MAXRASTERISEDNEURONS) {
-                     if (neuronID<minneuridrx) minneuridrx=neuronID;
-                     if (neuronID>maxneuridrx) maxneuridrx=neuronID;
-                     history_data_set2[updateline][neuronID]++;    // increment the spike count for this neuron at this time
-                     if (history_data_set2[updateline][neuronID]==0) history_data_set2[updateline][neuronID]++;    // increment the spike count for this neuron at this time TODO - this is a comparison of a float and an integer
-                     if (outputfileformat==2) {                // write to output file only if required and in NeuroTools format (2)
-                        if (writingtofile==0) {
-                           writingtofile=1;        // 3 states.  1=busy writing, 2=paused, 0=not paused, not busy can write.
-                           fprintf(fileoutput,"%lld.0\t%d.0\n",(long long int)sincefirstpacket,neuronID);      // neurotools format (ms and NeurID)
-                           writingtofile=0;        // note write finished
-                        }
-                     }
-                  }
-                  //if (!(neuronID%100)) printf("Updateline:%d, NeuID: %d, Tally: %f.\n",updateline, neuronID, history_data_set2[updateline][neuronID]);
-               }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
-               somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
-            }  // receive rate data
+// the longest window (s) the plot may be zoomed out to: as far back as the coarsest resolution goes
+float maxdisplaywindow (void)
+{
+   float longest = (PYRAMIDLEVELS>0) ? (float)(pyramid[PYRAMIDLEVELS-1].binus*PYRAMIDLINES)/1000000.0 : 0;
+   return (longest>100) ? longest : 100;
+}
+
+// store a value in the history, noting it as an event for the raster
+static inline __attribute__((always_inline)) void history_store (int line, uint id, float value)
+{
+   if (id>=dc.numberofpoints) return;    // (off the plot)
+   history_set(&history_data, line, id, value);
+   note_event(&historyevents, line, id);
+   if (PYRAMIDLEVELS>0) {                      // log it for the pyramid (the coarser bins are filled from the log)
+      pyramidevent_t *logged=&pyramidlog[pyramidlogged & pyramidmask];
+      logged->id=id;
+      logged->value=value;
+      pyramidlogged++;
+   }
+}
+
+void alloc_event_history (eventhistory_t *eh, int points)
+{
+   unsigned int ringsize=1;
+   while (ringsize<(unsigned int)RASTEREVENTS) ringsize<<=1;
+   eh->events = (rasterevent_t*) malloc(ringsize*sizeof(rasterevent_t));
+   eh->mask = ringsize-1;
+   eh->written = 0;
+   eh->first = (int64_t*) calloc(HISTORYSIZE, sizeof(int64_t));    // all lines empty
+   eh->end = (int64_t*) calloc(HISTORYSIZE, sizeof(int64_t));
+   eh->dense = (char*) calloc(HISTORYSIZE, sizeof(char));
+   eh->slot = (int64_t*) malloc(points*sizeof(int64_t));
+   for (int i=0; i<points; i++) eh->slot[i]=-1;
+   eh->openline = -1;
+}
+
+void free_event_history (eventhistory_t *eh)
+{
+   free(eh->events);
+   free(eh->first);
+   free(eh->end);
+   free(eh->dense);
+   free(eh->slot);
+}
+
+// sharded spike counts: with more than one decode thread, the spike count visualisations (RETINA, RETINA2, COCHLEA) count
+//   each thread's spikes into its own copy of the counts rather than taking decodelock for every packet. A thread's counts
+//   are merged into immediate_data and the history (under decodelock) when its packets move on to another history line,
+//   when a frame is wanted, and before it idles. So hot pixels' cache lines aren't passed between the decoders.
+typedef struct {
+   unsigned int *counts;          // spikes at each point since the last merge
+   uint *touched;                 // the points with counts, ntouched of them (so a merge visits only those)
+   int ntouched;
+   int line;                      // history line they're for
+   int64_t epoch;                 // and its time bin
+   int64_t time;                  // when (us) the last packet counted arrived
+   int64_t spikes;                // spike events counted
+   int64_t unmapped;              // and (RETINA2) keys that didn't map to a pixel
+} __attribute__((aligned(HISTORYALIGN))) spikeshard_t;    // (so no two threads' share a cache line)
+
+spikeshard_t *spikeshards=NULL;                 // DECODETHREADS of them, if the decoder counts spikes and there's >1 thread
+__thread spikeshard_t *decodeshard=NULL;        // the one the calling decode thread is counting into, if any
+void (*merge_shard) (spikeshard_t *shard) = NULL;    // for the decoder in use, set by select_decoder() if it counts spikes
+
+void alloc_spike_shards (int threads, int points)
+{
+   void *block;
+   if (posix_memalign(&block, HISTORYALIGN, threads*sizeof(spikeshard_t))!=0) {
+      fprintf(stderr, "Can't allocate the decode threads' spike counts.\n");
+      exit(1);
+   }
+   spikeshards=(spikeshard_t*)block;
+   for (int i=0; i<threads; i++) {
+      if (posix_memalign(&block, HISTORYALIGN, points*sizeof(unsigned int))!=0) {
+         fprintf(stderr, "Can't allocate the decode threads' spike counts.\n");
+         exit(1);
+      }
+      spikeshards[i].counts=(unsigned int*)block;
+      memset(spikeshards[i].counts, 0, points*sizeof(unsigned int));
+      spikeshards[i].touched=(uint*)malloc(points*sizeof(uint));
+      spikeshards[i].ntouched=0;
+      spikeshards[i].line=-1;
+      spikeshards[i].epoch=HISTORYNEVER;
+      spikeshards[i].time=0;
+      spikeshards[i].spikes=0;
+      spikeshards[i].unmapped=0;
+   }
+}
+
+// the shard decode thread 'thread' can count its next packet into, or NULL if it has to be decoded under decodelock as
+//   usual: while spikes or packets are being saved (they're written in order), or before the first packet has been seen.
+static inline spikeshard_t* shard_for (int thread)
+{
+   if (spikeshards==NULL || outputfileformat!=0 || firstreceivetimez==0 || spinnakerboardipset==0 || spinnakerboardport==0) return NULL;
+   return &spikeshards[thread];
+}
+
+static inline void shard_spike (spikeshard_t *shard, uint id)
+{
+   if (id>=dc.numberofpoints) return;    // (off the plot)
+   if (shard->counts[id]++==0) shard->touched[shard->ntouched++]=id;
+}
+
+// add a shard's counts to the plot data through the decoder's spikes(), and empty it. Called holding decodelock. Counts
+//   for a line that's since been taken by a later time bin, or from before a pause, are dropped.
+template <class DECODER> void merge_spike_shard (spikeshard_t *shard)
+{
+   if (shard->ntouched>0) {
+      if (!decodefrozen() && shard->line>=0 && historyepoch[shard->line]<=shard->epoch) {
+         claim_history_line(shard->line, shard->epoch);
+         if (PYRAMIDLEVELS>0) claim_pyramid_bin(0, shard->time-starttimez);
+         decodenow=shard->time;
+         for (int i=0; i<shard->ntouched; i++) {
+            uint id=shard->touched[i];
+            DECODER::spikes(shard->line, id, shard->counts[id]);
+            shard->counts[id]=0;
          }
+         somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
+      } else {
+         for (int i=0; i<shard->ntouched; i++) shard->counts[shard->touched[i]]=0;
+      }
+      shard->ntouched=0;
+   }
+   spikesdecoded+=shard->spikes;
+   shard->spikes=0;
+   retinaunmapped+=shard->unmapped;
+   shard->unmapped=0;
+}
 
-         if (SIMULATION==MAR12RASTER) {
-            uint commandcode=scanptr->cmd_rc;
-            if (freezedisplay==0 && commandcode==80) {            // if we are not paused, going to populate rate data
-               for (int i=0; i<numAdditionalBytes/4; i+=2) {      // for all extra data (assuming regular array of paired words, word1=key, word2=data)
-                  xsrc=(scanptr->data[i])>>24;
-                  ysrc=((scanptr->data[i])>>16)&0xFF;
-                  uint chippopulationid=((scanptr->data[i])>>11)&0xF;        // Francesco maps Virtual CPU ID to population 1:1 (at present)
-                  printf("CoreID: %d. CorePopID: ",chippopulationid);
-                  if (BITSOFPOPID>0) {
-                     chippopulationid=chippopulationid<<BITSOFPOPID;            // add space for any per core population IDs (proto pops per core)
-                     chippopulationid+=((scanptr->data[i])>>4)&0x3;            // add in proto popid
-                  }
-                  uint populationid=(EACHCHIPX*EACHCHIPY)*((xsrc*YCHIPS)+ysrc) + chippopulationid;
-                  immediate_data[populationid]=(float)scanptr->data[i+1];        // for this population stores average spike rate - in spikes per neuron/second
-                  history_data[updateline][populationid]=immediate_data[populationid];            // replace any data here already
-               }
-            }
+// spike data (one neuron ID per word) for the raster window of the rate plots
+static inline void decode_raster_spikes (struct sdp_msg *scanptr, int words, int updateline, int64_t sincefirstpacket)
+{
+   spikesdecoded+=words;
+   for (int i=0; i<words; i++) {      // for all extra data (assuming regular array of 4 byte words)
+      uint neuronID=scanptr->data[i]&0xFF;        // Which neuron has fired in this population (last 8 bits are significant)
+      if (neuronID<MAXRASTERISEDNEURONS) {
+         if (neuronID<minneuridrx) minneuridrx=neuronID;
+         if (neuronID>maxneuridrx) maxneuridrx=neuronID;
+         float count=history_value(&history_data_set2, updateline, neuronID);
+         history_set(&history_data_set2, updateline, neuronID, (count>(NOTDEFINEDFLOAT+1)) ? count+1 : 1);    // increment the spike count for this neuron at this time
+         note_event(&historyevents2, updateline, neuronID);
+         record_spike(sincefirstpacket, neuronID);    // to the output file if we are saving spikes
+      }
+   }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
+   somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
+}
+
+struct nulldecoder {          // unknown SIMULATION: packets are timed and recorded, but not plotted
+   static inline void decode (struct sdp_msg *, struct spinnpacket *, int, int, int64_t) { }
+};
+
+struct retinadecoder {
+   static inline void decode (struct sdp_msg *, struct spinnpacket *scanptrspinn, int numbytes_input, int updateline, int64_t sincefirstpacket)
+   {
+      if (decodefrozen() || scanptrspinn->cmd_rc!=dc.stiminpacket) return;    // only if we are not paused & we got the proper command
+      int words=(numbytes_input-18)/4;
+      spikeshard_t *shard=decodeshard;
+      if (shard!=NULL) {                    // counted in this thread's shard, merged in through spikes() below
+         shard->spikes+=words;
+         for (int i=0; i<words; i++) shard_spike(shard, scanptrspinn->data[i]&0xFF);
+         return;
+      }
+      spikesdecoded+=words;
+      for (int i=0; i<words; i++) {      // for all extra data (assuming regular array of 4 byte words)
+         uint spikerID=scanptrspinn->data[i]&0xFF;    // Get the firing neuron ID (mask off last 8 bits for neuronID ignoring chip/coreID)
+         spikes(updateline, spikerID, 1);
+         record_spike(sincefirstpacket, spikerID);    // to the output file if we are saving spikes
+      }        //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
+      somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
+   }
+   static inline void spikes (int updateline, uint spikerID, unsigned int count)
+   {
+      if (spikerID>=dc.numberofpoints) return;    // (off the plot)
+      float total=immediate_add(spikerID, count);            // Set the bit to say it's arrived
+      if (spikerID<minneuridrx) minneuridrx=spikerID;
+      if (spikerID>maxneuridrx) maxneuridrx=spikerID;
+      history_store(updateline, spikerID, total);  // add to count in this interval
+   }
+};
+
+struct sevilleretinadecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen() || scanptr->cmd_rc!=0x4943) return;    // if we are not paused, going to I.C. the seville retina
+      uint columnnum=scanptr->arg1;
+      uint numofrows=scanptr->arg2;
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      uint pixelid=columnnum*numofrows;            // 1st pixel ID
+      for (int i=0; i<words; i++, pixelid+=2) {      // for all extra data (assuming regular array of signed shorts)
+         short datain1=(scanptr->data[i])&0xFFFF;    // 1st of the pair
+         short datain2=(scanptr->data[i]>>16)&0xFFFF;    // 2nd of the pair
+         immediate_set(pixelid, datain1);        // store 1st pixel ID
+         history_store(updateline, pixelid, datain1);            // replace any data here already
+         immediate_set(pixelid+1, datain2);        // store 2nd pixel ID
+         history_store(updateline, pixelid+1, datain2);            // replace any data here already
+      }
+   }
+};
+
+struct retina2decoder {       // FG for Seville Retina 19th Apr 2013
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen()) return;  // so long as the display is still active then listen to new input
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      spikeshard_t *shard=decodeshard;
+      if (shard!=NULL) shard->spikes+=words;
+      else spikesdecoded+=words;
+      for (int e=0; e<words; e++) {
+         uint bottom_rkey = scanptr->data[e];
+         uint x_chip=bottom_rkey >> 24;
+         uint y_chip=(bottom_rkey >> 16) & 0xFF;
+         int corebase=-1;                                  // pixel of neuron 0 on this core
+         if (retinalut!=NULL && x_chip<(uint)retinalutchipsx && y_chip<(uint)retinalutchipsy)
+            corebase = retinalut[(((x_chip*retinalutchipsy) + y_chip)<<5) | ((bottom_rkey >> 11) & 0x1F)];
+         uint pixelid = corebase + (bottom_rkey & 0x7FF);     // indexID
+         if (corebase<0 || pixelid>=dc.numberofpoints) {
+            if (shard!=NULL) shard->unmapped++;            // not a chip/core of the recorded population (or off the plot)
+            else retinaunmapped++;
+            continue;
          }
+         if (shard!=NULL) shard_spike(shard, pixelid);
+         else spikes(updateline, pixelid, 1);
+      }
+   }
+   static inline void spikes (int updateline, uint pixelid, unsigned int count)
+   {
+      immediate_add(pixelid, count);//*MAXFRAMERATE;             // store 1st pixel ID
+      history_store(updateline, pixelid, pixelid % XDIMENSIONS);  // replace any data here already
+   }
+};
 
-         if (SIMULATION==SPIKERVC) {
-            uint commandcode=scanptr->cmd_rc;
-            for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of paired words, word1=key, word2=data)
-               xsrc=(scanptr->data[i])>>24;            // chip x coordinate
-               ysrc=((scanptr->data[i])>>16)&0xFF;        // chip y coordinate
-               uint chipcore=((scanptr->data[i])>>11)&0xF;    // core of chip (note: 4 bits)
-               uint neurid=scanptr->data[i]&0x8FF;        // neuron ID within this core
-               printf("CoreID:%d, neurid:%d",chipcore,neurid); // do some printing for debug
-               // note the neurid in this example is the only relevant index - there's no relevance of chip ID or core
-               // if this is relevant then make the array indexes dependant on this data
-               immediate_data[neurid]=1;            // make the data valid to say (at least) one spike received in the immediate data
-               history_data[updateline][neurid]=immediate_data[neurid];        // make the data valid to say (at least) one spike received in this historical index data
-            }
+struct cochleadecoder {       //  QL for silicon cochlea 27th Aug 2013, CP incorporated 4th Sept 2013.
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int, int updateline, int64_t)
+   {
+      if (decodefrozen()) return;  // so long as the display is still active then listen to new input
+      short neuronID=scanptr->data[0]%0x0800;
+      short coreID=(scanptr->data[0]>>11)%0x20;
+      short NUM_Cell=4;
+      short NUM_Channel=64;
+      short x_coord=(coreID-1)*NUM_Cell+neuronID%NUM_Cell;
+      short y_coord=neuronID/NUM_Cell;
+      uint pixelid = (x_coord*NUM_Channel) + y_coord;
+      spikeshard_t *shard=decodeshard;
+      if (shard!=NULL) {
+         shard->spikes++;
+         shard_spike(shard, pixelid);
+      } else {
+         spikesdecoded++;
+         spikes(updateline, pixelid, 1);
+      }
+   }
+   static inline void spikes (int updateline, uint pixelid, unsigned int count)
+   {
+      history_store(updateline, pixelid, immediate_add(pixelid, count));    // (coreID 0 or past 16 is off the plot, and dropped by both)
+   }
+};
+
+struct rateplotlegacydecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t sincefirstpacket)
+   {
+      if (decodefrozen()) return;
+      uint commandcode=scanptr->cmd_rc;
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      if (commandcode==257) {            // going to populate rate data
+         uint chippopulationid=(scanptr->srce_port&0x1F)-1;            // Francesco maps Virtual CPU ID to population 1:1 (at present)
+         unsigned char xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
+         unsigned char ysrc=scanptr->srce_addr%256; // and the chip Y coord
+         uint populationid=dc.chipblock*((ysrc*dc.chipsacross)+xsrc) + chippopulationid;
+         uint intervalinms=scanptr->arg2+1;                // how often we are getting population firing counts for this population
+         uint neuronsperpopulation=scanptr->arg3;            // how many neurons are in this population ID
+         float ratescale=1000.0/(float)(intervalinms*neuronsperpopulation);
+         if (populationid>=dc.numberofpoints) return;    // ignore anything that will go offscreen
+         biascurrent[populationid]=(float)scanptr->arg1/256.0;      // 8.8 fixed format data for the bias current used for this population
+         for (int i=0; i<words; i++) {      // for all extra data (assuming regular array of 4 byte words)
+            immediate_set(populationid, scanptr->data[i]*ratescale);    // for this population stores average spike rate - in spikes per neuron/second
+            history_store(updateline, populationid, immediate_data[populationid]);            // replace any data here already
          }
+         somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
+      } else if (commandcode==256) {            // going to populate raster spike data
+         decode_raster_spikes(scanptr, words, updateline, sincefirstpacket);
+      }
+   }
+};
 
-         if (SIMULATION==RATEPLOT) {
-            uint commandcode=scanptr->cmd_rc;
-            if (freezedisplay==0 && (commandcode==64 || commandcode==65 || commandcode==66)) {            // if we are not paused, going to populate rate data
-               for (int i=0; i<numAdditionalBytes/4; i+=2) {      // for all extra data (assuming regular array of paired words, word1=key, word2=data)
-                  // read header info, x,y,core,pop.
-                  xsrc=(scanptr->data[i])>>24;
-                  ysrc=((scanptr->data[i])>>16)&0xFF;
-                  uint chippopulationid=((scanptr->data[i])>>11)&0xF;        // Francesco maps Virtual CPU ID to population 1:1 (at present)
-                  //printf("CoreID: %d. CorePopID: ",chippopulationid);
-                  if (BITSOFPOPID>0) {
-                     chippopulationid=chippopulationid<<BITSOFPOPID;            // add space for any per core population IDs (proto pops per core)
-                     chippopulationid+=((scanptr->data[i])>>4)&0x3;            // add in proto popid
-                  }
-                  uint populationid=(EACHCHIPX*EACHCHIPY)*((xsrc*YCHIPS)+ysrc) + chippopulationid;
-                  //printf("%d:PopID. xsrc:%d, ysrc:%d  linearchipid=%d\n",populationid, xsrc, ysrc, ((xsrc*YCHIPS)+ysrc));
-
-                  if (populationid>(YDIMENSIONS*XDIMENSIONS)) commandcode = 11;    // ignore anything that will go offscreen
-
-                  //printf("%d:PopID. SubID:%d.  (orig:%x)\n",populationid, ((scanptr->data[i])>>4)&0x3, chippopulationid,(scanptr->data[i]));
-                  if (commandcode==64) {
-                     immediate_data[populationid]=(float)scanptr->data[i+1];        // for this population stores average spike rate - in spikes per neuron/second
-                     history_data[updateline][populationid]=immediate_data[populationid];            // replace any data here already
-                     //immediate_data[populationid]=scanptr->data[i+1];        // for this population stores average spike rate - in spikes per neuron/second
-                     //history_data[updateline][populationid]=immediate_data[populationid];            // replace any data here already
-                     //printf("Rate  ");
-                  } else if (commandcode==65) {
-                     biascurrent[populationid]=(float)scanptr->data[i+1]/256.0;      // 8.8 fixed format data for the bias current used for this population
-                     //printf("Bias  ");
-                  } else if (commandcode==66) {    // means we are plotting voltage
-                     float tempstore=(short)scanptr->data[i+1];
-                     tempstore/=256.0;
-                     //tempstore+=100.0;
-                     immediate_data[0]=tempstore;        // only 1 value to plot - the potential!
-                     //printf("Received value:%d becomes:%f, is Int:%u or Float:%f.\n",(short)scanptr->data[i+1],(float)((short)scanptr->data[i+1])/256.0,immediate_data[0],tempstore);
-                     history_data[updateline][0]=immediate_data[0];            // replace any data here already
-                  }
-               }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
-               somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
-            }  // receive rate data
-
-            if (freezedisplay==0 && commandcode==256) {            // if we are not paused, going to populate raster spike data
-               //printf("Spike  ");
-               for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-                  uint neuronID=scanptr->data[i]&0xFF;        // Which neuron has fired in this population (last 8 bits are significant)
-                  if (neuronID<MAXRASTERISEDNEURONS) {
-                     if (neuronID<minneuridrx) minneuridrx=neuronID;
-                     if (neuronID>maxneuridrx) maxneuridrx=neuronID;
-                     history_data_set2[updateline][neuronID]++;    // increment the spike count for this neuron at this time
-                     if (history_data_set2[updateline][neuronID]==0) history_data_set2[updateline][neuronID]++;    // increment the spike count for this neuron at this time TODO - this is a comparison of a float and an integer
-                     if (outputfileformat==2) {                // write to output file only if required and in NeuroTools format (2)
-                        if (writingtofile==0) {
-                           writingtofile=1;        // 3 states.  1=busy writing, 2=paused, 0=not paused, not busy can write.
-                           fprintf(fileoutput,"%lld.0\t%d.0\n",(long long int)sincefirstpacket,neuronID);      // neurotools format (ms and NeurID)
-                           writingtofile=0;        // note write finished
-                        }
-                     }
-                  }
-                  //if (!(neuronID%100)) printf("Updateline:%d, NeuID: %d, Tally: %f.\n",updateline, neuronID, history_data_set2[updateline][neuronID]);
-               }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
-               somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
-            }  // receive rate data
+struct mar12rasterdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen() || scanptr->cmd_rc!=80) return;            // if we are not paused, going to populate rate data
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      for (int i=0; i<words; i+=2) {      // for all extra data (assuming regular array of paired words, word1=key, word2=data)
+         uint xsrc=(scanptr->data[i])>>24;
+         uint ysrc=((scanptr->data[i])>>16)&0xFF;
+         uint chippopulationid=((scanptr->data[i])>>11)&0xF;        // Francesco maps Virtual CPU ID to population 1:1 (at present)
+         if (BITSOFPOPID>0) {
+            chippopulationid=chippopulationid<<BITSOFPOPID;            // add space for any per core population IDs (proto pops per core)
+            chippopulationid+=((scanptr->data[i])>>4)&0x3;            // add in proto popid
          }
+         uint populationid=dc.chipblock*((xsrc*YCHIPS)+ysrc) + chippopulationid;
+         if (populationid>=dc.numberofpoints) continue;    // ignore anything that will go offscreen
+         immediate_set(populationid, (float)scanptr->data[i+1]);        // for this population stores average spike rate - in spikes per neuron/second
+         history_store(updateline, populationid, immediate_data[populationid]);            // replace any data here already
+      }
+   }
+};
 
-         if (SIMULATION==HEATMAP) {
-            xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
-            ysrc=scanptr->srce_addr%256; // and the chip Y coord
-            for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-               uint arrayindex=(EACHCHIPX*EACHCHIPY)*((xsrc*(XDIMENSIONS/EACHCHIPX))+ysrc) + i;
-               if (freezedisplay==0) {
-                  if (arrayindex<0 || arrayindex>XDIMENSIONS*YDIMENSIONS) {
-                     printf("Error line 772: Array index out of bounds: %u. (x=%u, y=%u)\n",arrayindex,xsrc,ysrc);        // CPDEBUG
-                  } else {
-                     immediate_data[arrayindex]=(float)scanptr->data[i]/(float)pow(2.0,FIXEDPOINT);
-                     if (updateline<0 || updateline>HISTORYSIZE) {
-                        printf("Error line 776: Updateline is out of bounds: %d.\n",updateline);        // CPDEBUG
-                     } else {
-                        history_data[updateline][arrayindex]=immediate_data[arrayindex];        // replace any data already here
-                     }
-                  }
-                  somethingtoplot=1;                // indicate we will need to refresh the screen
+struct spikervcdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      spikesdecoded+=words;
+      for (int i=0; i<words; i++) {      // for all extra data
+         uint neurid=scanptr->data[i]&0x8FF;        // neuron ID within this core
+         // note the neurid in this example is the only relevant index - there's no relevance of chip ID or core
+         // if this is relevant then make the array indexes dependant on this data
+         if (neurid>=dc.numberofpoints) continue;    // (off the plot)
+         immediate_set(neurid, 1);            // make the data valid to say (at least) one spike received in the immediate data
+         history_store(updateline, neurid, 1);        // make the data valid to say (at least) one spike received in this historical index data
+      }
+   }
+};
 
-               }
-               //recombine to single vector - if display paused don't update what's there
-               // send to log file for plotting (overwriting what's already here)
+struct rateplotdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t sincefirstpacket)
+   {
+      if (decodefrozen()) return;
+      uint commandcode=scanptr->cmd_rc;
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      if (commandcode==64 || commandcode==65 || commandcode==66) {            // going to populate rate data
+         for (int i=0; i<words; i+=2) {      // for all extra data (assuming regular array of paired words, word1=key, word2=data)
+            // read header info, x,y,core,pop.
+            uint xsrc=(scanptr->data[i])>>24;
+            uint ysrc=((scanptr->data[i])>>16)&0xFF;
+            uint chippopulationid=((scanptr->data[i])>>11)&0xF;        // Francesco maps Virtual CPU ID to population 1:1 (at present)
+            if (BITSOFPOPID>0) {
+               chippopulationid=chippopulationid<<BITSOFPOPID;            // add space for any per core population IDs (proto pops per core)
+               chippopulationid+=((scanptr->data[i])>>4)&0x3;            // add in proto popid
             }
-         }
+            uint populationid=dc.chipblock*((xsrc*YCHIPS)+ysrc) + chippopulationid;
+            if (populationid>=dc.numberofpoints) break;    // ignore anything that will go offscreen (and the rest of this packet with it)
+
+            if (commandcode==64) {
+               immediate_set(populationid, (float)scanptr->data[i+1]);        // for this population stores average spike rate - in spikes per neuron/second
+               history_store(updateline, populationid, immediate_data[populationid]);            // replace any data here already
+            } else if (commandcode==65) {
+               biascurrent[populationid]=(float)scanptr->data[i+1]/256.0;      // 8.8 fixed format data for the bias current used for this population
+            } else {    // 66 means we are plotting voltage
+               float tempstore=(short)scanptr->data[i+1];
+               tempstore/=256.0;
+               immediate_set(0, tempstore);        // only 1 value to plot - the potential!
+               history_store(updateline, 0, tempstore);            // replace any data here already
+            }
+         }    //recombine to single vector - if display paused don't update what's there, sends to log file for plotting (overwriting what's already here)
+         somethingtoplot=1;                    // indicate we should refresh the screen as we likely have new data
+      } else if (commandcode==256) {            // going to populate raster spike data
+         decode_raster_spikes(scanptr, words, updateline, sincefirstpacket);
+      }
+   }
+};
 
-         if (SIMULATION==LINKCHECK) {
-            xsrc=(scanptr->srce_addr/256); // takes the chip ID and works out the base X coord
-            ysrc=(scanptr->srce_addr%256); // and the chip base Y coord
-            int indexer=(ysrc*(EACHCHIPX*EACHCHIPY)); // give the y offset
-            indexer+=(xsrc*(EACHCHIPX*EACHCHIPY)*(YDIMENSIONS/EACHCHIPY));
+struct heatmapdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen()) return;        // if display paused don't update what's there
+      unsigned char xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
+      unsigned char ysrc=scanptr->srce_addr%256; // and the chip Y coord
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      uint arrayindex=dc.chipblock*((xsrc*dc.chipsacross)+ysrc);
+      if (arrayindex+words>dc.numberofpoints) {
+         heatmapoverflows++;                      // (counted, not printed: a misconfigured board would flood the console)
+         if (arrayindex>=dc.numberofpoints) return;
+         words=dc.numberofpoints-arrayindex;        // plot what does fit
+      }
+      for (int i=0; i<words; i++, arrayindex++) {      // for all extra data (assuming regular array of 4 byte words)
+         immediate_set(arrayindex, (float)scanptr->data[i]*dc.fixedpointscale);
+         history_store(updateline, arrayindex, immediate_data[arrayindex]);        // replace any data already here
+      }
+      somethingtoplot=1;                // indicate we will need to refresh the screen
+   }
+};
 
-            for (int i=0; i<(EACHCHIPX*EACHCHIPY); i++) {
-               immediate_data[indexer+i]=100;
-               if (i==5) immediate_data[indexer+i]=20;        // set centre blue
-               if (i==2 || i==8 || i==3 || i==7 || i>10) immediate_data[indexer+i]=0;    // set top left and btm right black
-            }
+struct linkcheckdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int, int updateline, int64_t)
+   {
+      unsigned char xsrc=(scanptr->srce_addr/256); // takes the chip ID and works out the base X coord
+      unsigned char ysrc=(scanptr->srce_addr%256); // and the chip base Y coord
+      int indexer=(ysrc*dc.chipblock) + (xsrc*dc.chipblock*dc.chipsdown); // give the x and y offset (immediate_set drops any past the plot)
+
+      for (int i=0; i<dc.chipblock; i++) {
+         float value=100;
+         if (i==5) value=20;        // set centre blue
+         if (i==2 || i==8 || i==3 || i==7 || i>10) value=0;    // set top left and btm right black
+         immediate_set(indexer+i, value);
+      }
 
-            if (xsrc>7) printf("X out of bounds. Src: 0x%x, %d\n",scanptr->srce_addr,xsrc);
-            if (ysrc>7) printf("Y out of bounds. Src: 0x%x, %d\n",scanptr->srce_addr,ysrc);
-            if (freezedisplay==0) {
-               for(int i=0; i<6; i++) {
-                  //int arrayindex=(EACHCHIPX*EACHCHIPY)*((xsrc*(XDIMENSIONS/EACHCHIPX))+ysrc);    // base index
-                  if (scanptr->arg1&(0x1<<i)) {    // if array entry is set (have received on this port)
-                     int arrayindex=indexer;
-                     if (i==0) arrayindex+=1;         // RX from west
-                     //if (i==1) arrayindex+=1;         // RX from sw (zero position)
-                     if (i==2) arrayindex+=4;         // RX from south
-                     if (i==3) arrayindex+=9;         // RX from east
-                     if (i==4) arrayindex+=10;         // RX from ne
-                     if (i==5) arrayindex+=6;         // RX from north
-                     immediate_data[arrayindex]=60;          // update immediate data
-                     history_data[updateline][arrayindex]=immediate_data[arrayindex];// update historical data
-                     somethingtoplot=1;            // indicate we will need to refresh the screen
-                  }
-               }
+      if (xsrc>7) printf("X out of bounds. Src: 0x%x, %d\n",scanptr->srce_addr,xsrc);
+      if (ysrc>7) printf("Y out of bounds. Src: 0x%x, %d\n",scanptr->srce_addr,ysrc);
+      if (!decodefrozen()) {
+         static const int linkoffset[6] = {1, 0, 4, 9, 10, 6};    // RX from west, sw (zero position), south, east, ne, north
+         for(int i=0; i<6; i++) {
+            if (scanptr->arg1&(0x1<<i)) {    // if array entry is set (have received on this port)
+               int arrayindex=indexer+linkoffset[i];
+               immediate_set(arrayindex, 60);          // update immediate data
+               history_store(updateline, arrayindex, 60);// update historical data
+               somethingtoplot=1;            // indicate we will need to refresh the screen
             }
          }
+      }
+   }
+};
 
-         if (SIMULATION==CPUUTIL) {
-            xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
-            ysrc=scanptr->srce_addr%256; // and the chip Y coord
-            for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-               uint arrayindex=(EACHCHIPX*EACHCHIPY)*((xsrc*(XDIMENSIONS/EACHCHIPX))+ysrc) + i;
-               if (freezedisplay==0) {
-                  immediate_data[arrayindex]=(float)scanptr->data[i];                 // utilisation data
-                  history_data[updateline][arrayindex]=immediate_data[arrayindex];                // replace any data already here
-                  somethingtoplot=1;                                // indicate we will need to refresh the screen
-               }
-               //recombine to single vector - if display paused don't update what's there
-               // send to log file for plotting (overwriting what's already here)
+struct cpuutildecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen()) return;        // if display paused don't update what's there
+      unsigned char xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
+      unsigned char ysrc=scanptr->srce_addr%256; // and the chip Y coord
+      int words=(numbytes_input-SDPHEADERLEN)/4;
+      uint arrayindex=dc.chipblock*((xsrc*dc.chipsacross)+ysrc);
+      for (int i=0; i<words; i++, arrayindex++) {      // for all extra data (assuming regular array of 4 byte words)
+         history_store(updateline, arrayindex, immediate_set(arrayindex, (float)scanptr->data[i]));    // utilisation data, replacing any already here
+      }
+      somethingtoplot=1;                                // indicate we will need to refresh the screen
+   }
+};
+
+struct chiptempdecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int, int updateline, int64_t)
+   {
+      if (decodefrozen()) return;        // if display paused don't update what's there
+      unsigned char xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
+      unsigned char ysrc=scanptr->srce_addr%256; // and the chip Y coord
+      uint arrayindex=dc.chipblock*((xsrc*dc.chipsacross)+ysrc);    // no per core element so no +i
+      // average of the 3 sensors, scaled to something approximating 0->100 for the extremities spotted (so far - may need to tinker!)
+      float temperature=((((float)scanptr->arg1-6300) /15.0) + (((float)scanptr->arg2-9300) / 18.0) + ((55000-(float)scanptr->arg3)/450.0) - 80.0) / 1.5;
+      immediate_set(arrayindex, temperature);
+      history_store(updateline, arrayindex, temperature);            // replace any data already here
+      somethingtoplot=1;                            // indicate we will need to refresh the screen
+   }
+};
+
+struct integratordecoder {
+   static inline void decode (struct sdp_msg *scanptr, struct spinnpacket *, int numbytes_input, int updateline, int64_t)
+   {
+      if (decodefrozen() || numbytes_input<SDPHEADERLEN+4) return;    // only interested in first data item
+      unsigned char xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
+      unsigned char ysrc=scanptr->srce_addr%256; // and the chip Y coord
+      uint arrayindex=dc.chipblock*((xsrc*dc.chipsacross)+ysrc);    // no per core element so no +i
+      if (arrayindex>=dc.numberofpoints) return;    // (off the plot)
+      float input=1.0+(float)((int)scanptr->data[0])/256.0;
+      input*=(0.001/0.03);
+      int previousindex=updateline-1;
+      if (previousindex<0) previousindex=HISTORYSIZE-1;
+      float previous=history_value(&history_data, previousindex, arrayindex);
+      if (previous>(NOTDEFINEDFLOAT+1))
+         input+=previous*dc.integratordecay;
+      immediate_set(arrayindex, input);                                   // wobbler data
+      history_store(updateline, arrayindex, input);    // replace any data already here
+      somethingtoplot=1;                            // indicate we will need to refresh the screen
+   }
+};
+
+// the decoding of a single SDP/SpiNNaker datagram taken off the socket, common to all visualisations.
+//   nowtime (us) is when the batch holding it was received.
+template <class DECODER> void decode_sdp_packet (unsigned char *packetbuffer, int numbytes_input, struct sockaddr_in *si_other, int64_t nowtime)
+{
+   int64_t sincefirstpacket;
+
+   struct sdp_msg *scanptr = (sdp_msg*) packetbuffer;                // pointer to our packet in the buffer from the Ethernet
+   struct spinnpacket *scanptrspinn = (spinnpacket*) packetbuffer;    // pointer to our packet in the buffer from the Ethernet
+
+   if(scanptrspinn->cmd_rc==htonl(SPINN_HELLO)) return;       // discarding any hello packet by dropping out without processing
+
+   int boardlocked = (spinnakerboardipset==0 || spinnakerboardport==0);
+   if (boardlocked) pthread_mutex_lock(&boardlock);    // (the decoders of every panel learn the one board)
+   if (spinnakerboardipset==0) {                // if no ip: set ip,port && init
+      // if we don't already know the SpiNNaker board IP then we learn that this is our board to listen to
+      spinnakerboardip=si_other->sin_addr;
+      spinnakerboardport=htons(si_other->sin_port);
+      spinnakerboardipset++;
+      init_sdp_sender();
+      printf("Pkt Received from %s on port: %d\n", inet_ntoa(si_other->sin_addr),htons(si_other->sin_port));
+   }        // record the IP address of our SpiNNaker board.
+
+   if (spinnakerboardport==0) {                // if no port: set port && init
+      // if we don't already know the SpiNNaker port, then we get this dynamically from an incoming message.
+      spinnakerboardport=htons(si_other->sin_port);
+      init_sdp_sender();
+      printf("Pkt Received from %s on port: %d\n", inet_ntoa(si_other->sin_addr),htons(si_other->sin_port));
+   }        // record the port number we are being spoken to upon, and open the SDP connection externally.
+   if (boardlocked) pthread_mutex_unlock(&boardlock);
+
+   // ip && port are now set, so process this SpiNNaker packet
+
+   /*
+           //For debugging if you like that sort of thing... (usually commented)
+           if (scanptrspinn->cmd_rc!=htonl(SPINN_HELLO)) {
+             printf ("received SDP packet of %d bytes\n", numbytes_input);
+             printf ("Header of %d Bytes, Data of %d Bytes\n",SDPHEADERLEN,numAdditionalBytes);
+             printf("ip_time_out: %d. Padded by: %d\n",scanptr->ip_time_out,scanptr->pad);
+             printf("flags: %d. Tagged by: %d\n",scanptr->flags,scanptr->tag);
+             printf("dest_port: %d. srce_port: %d\n",scanptr->dest_port,scanptr->srce_port);
+             printf("dest_addr: %d. srce_addr: %d\n",scanptr->dest_addr,scanptr->srce_addr);
+             printf("cmd_rc: %d.\n",scanptr->cmd_rc);
+             printf("arg1: %d.\n",scanptr->arg1);
+             printf("arg2: %d.\n",scanptr->arg2);
+             printf("arg3: %d.\n",scanptr->arg3);
+             printf("data[0]: %x.\n",scanptr->data[0]);
+             printf("data[1]: %x.\n",scanptr->data[1]);
+             printf("\n");
+           }
+   */
+
+   if (firstreceivetimez==0) __sync_bool_compare_and_swap(&firstreceivetimez, 0, nowtime);    // if 1st packet then note it's arrival (whichever panel's)
+   sincefirstpacket = (nowtime-firstreceivetimez)/1000;        // how long in ms since visualisation got 1st valid packet.
+
+   float timeperindex = displayWindow / (float) plotWidth;    // time in seconds per history index in use (or pixel displayed)
+   //printf("Here, with timeperindex:%f, and y_scaling_factor:%f. Display Window = %f fps.\n",timeperindex,y_scaling_factor,displayWindow);
+   int64_t currentline=((nowtime-starttimez)/(int64_t)(timeperindex*1000000));    // history lines since the start
+   int updateline=currentline % (HISTORYSIZE);    // which index is being updated (on the right hand side)
+
+   if (updateline<0 || updateline>HISTORYSIZE) {
+      printf("Error line 500: Updateline out of bounds: %d. Time per Index: %f. \n  Times - Now:%lld  Start:%lld \n",updateline, timeperindex, (long long int)nowtime, (long long int)starttimez); // CPDEBUG
+      return;                                     // nowhere safe to put this packet's data
+   } else {
+      if (!decodefrozen()) {
+         spikeshard_t *shard=decodeshard;
+         if (shard!=NULL) {                        // the line's claimed when the shard's counts are merged into it
+            if (currentline!=shard->epoch) {       // (and the history moved on, under the lock as the other shards do it too)
+               pthread_mutex_lock(&decodelock);
+               merge_shard(shard);
+               historynow=currentline;
+               pthread_mutex_unlock(&decodelock);
+               shard->line=updateline;
+               shard->epoch=currentline;
             }
+            shard->time=nowtime;
+         } else {
+            historynow=currentline;                // (lines from before a change of time per index read as empty until refilled)
+            claim_history_line(updateline, currentline);    // lines that had no activity are never touched
+            if (PYRAMIDLEVELS>0) claim_pyramid_bin(0, nowtime-starttimez);
          }
+      }
+   }
 
-         if (SIMULATION==CHIPTEMP) {
-            xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
-            ysrc=scanptr->srce_addr%256; // and the chip Y coord
-            uint arrayindex=(EACHCHIPX*EACHCHIPY)*((xsrc*(XDIMENSIONS/EACHCHIPX))+ysrc);    // no per core element so no +i
-            if (freezedisplay==0) {
-               //immediate_data[arrayindex]=(float)scanptr->cmd_rc/(float)pow(2.0,FIXEDPOINT);     // temperature data using algorithm in report.c (not great)
-               // immediate_data[arrayindex]=((float)scanptr->arg1-6300) /15.0;     // temperature 1 sensor data
-               // immediate_data[arrayindex]=((float)scanptr->arg2-9300) / 18.0;     // temperature 2 sensor data
-               // immediate_data[arrayindex]=(55000-(float)scanptr->arg3)/450.0;     // temperature 3 sensor data
-               immediate_data[arrayindex]=((((float)scanptr->arg1-6300) /15.0) + (((float)scanptr->arg2-9300) / 18.0) + ((55000-(float)scanptr->arg3)/450.0) - 80.0) / 1.5;
-               // scale to something approximating 0->100  for the extremities spotted (so far - may need to tinker!)
-               history_data[updateline][arrayindex]=immediate_data[arrayindex];            // replace any data already here
-               somethingtoplot=1;                            // indicate we will need to refresh the screen
+   if (decodeshard==NULL) decodenow=nowtime;       // (a shard's counts are decayed from when they're merged)
+   DECODER::decode(scanptr, scanptrspinn, numbytes_input, updateline, sincefirstpacket);    // and the visualisation specific bit
 
-            }
-            //recombine to single vector - if display paused don't update what's there
-            // send to log file for plotting (overwriting what's already here)
+   if (outputfileformat==1 && replayrebuilding==0) {                // write to output file only if required and in normal SPINNAKER packet format (1) - basically the UDP payload
+      if (writingtofile==0) {    // can only write to the file if its not paused and can write
+         pthread_mutex_lock(&spinnlock);
+         if (writingtofile==0 && fileoutput!=NULL) record_packet(packetbuffer, numbytes_input, nowtime-firstreceivetimez);    // (unless it closed while we waited)
+         pthread_mutex_unlock(&spinnlock);
+      }
+   }
+}
+
+
+// work out the constants the decoders need and choose the one for this SIMULATION. Call after paramload.
+void select_decoder(void)
+{
+   dc.fixedpointscale = 1.0/pow(2.0,FIXEDPOINT);
+   dc.chipblock = EACHCHIPX*EACHCHIPY;
+   dc.chipsacross = XDIMENSIONS/EACHCHIPX;
+   dc.chipsdown = YDIMENSIONS/EACHCHIPY;
+   dc.numberofpoints = XDIMENSIONS*YDIMENSIONS;
+   dc.integratordecay = exp(-0.001/0.03);
+   dc.stiminpacket = htonl(STIM_IN_SPINN_PACKET);
+   dc.decaying = (DECAYPROPORTION>0.0);
+   dc.decayperus = dc.decaying ? log(DECAYPROPORTION)*(double)MAXFRAMERATE/1000000.0 : 0;
+
+   switch (SIMULATION) {
+      case HEATMAP:         process_sdp_packet = decode_sdp_packet<heatmapdecoder>; break;
+      case RATEPLOT:        process_sdp_packet = decode_sdp_packet<rateplotdecoder>; break;
+      case RETINA:          process_sdp_packet = decode_sdp_packet<retinadecoder>; merge_shard = merge_spike_shard<retinadecoder>; break;
+      case INTEGRATORFG:    process_sdp_packet = decode_sdp_packet<integratordecoder>; break;
+      case RATEPLOTLEGACY:  process_sdp_packet = decode_sdp_packet<rateplotlegacydecoder>; break;
+      case MAR12RASTER:     process_sdp_packet = decode_sdp_packet<mar12rasterdecoder>; break;
+      case SEVILLERETINA:   process_sdp_packet = decode_sdp_packet<sevilleretinadecoder>; break;
+      case LINKCHECK:       process_sdp_packet = decode_sdp_packet<linkcheckdecoder>; break;
+      case SPIKERVC:        process_sdp_packet = decode_sdp_packet<spikervcdecoder>; break;
+      case CHIPTEMP:        process_sdp_packet = decode_sdp_packet<chiptempdecoder>; break;
+      case CPUUTIL:         process_sdp_packet = decode_sdp_packet<cpuutildecoder>; break;
+      case RETINA2:         process_sdp_packet = decode_sdp_packet<retina2decoder>; merge_shard = merge_spike_shard<retina2decoder>; break;
+      case COCHLEA:         process_sdp_packet = decode_sdp_packet<cochleadecoder>; merge_shard = merge_spike_shard<cochleadecoder>; break;
+      default:              process_sdp_packet = decode_sdp_packet<nulldecoder>; break;
+   }
+}
+
+// -----------------------------------------------------------------------------------------------------
+// how the panels share out the packets and the window. A panel takes the keys (or for the visualisations whose data
+//   aren't keys, the packets) whose key & KEYMASK is its KEYBASE: see panel_share().
+typedef struct {
+   int simulation;                // (so its packets can be picked out without switching to it)
+   uint keybase, keymask;
+   int x, y, width, height;       // where it is in the window (from the bottom left)
+} panel_t;
+
+panel_t panels[MAXPANELS];
+int numpanels=1;                  // panels the configuration asked for (1: just the one visualisation)
+int focusedpanel=0;               // the panel the mouse was last over, that keys & menus act on
+int panelcolumns=1, panelrows=1;  // how they're tiled
+int panelx=0, panely=0;           // where the panel being drawn is in the window
+char drawingpanels=0;             // set while display() draws one panel of several
+int panelwindowheight=0;          // height of the window they're tiled in
+
+// a panel's top edge from the top of the window (as GLUT gives mouse positions)
+static inline int panel_top (int p)
+{
+   return panelwindowheight-(panels[p].y+panels[p].height);
+}
+
+// work on panel p's state from here on (in the calling thread)
+static inline void switch_panel (int p)
+{
+   thispanel=&panelstates[p];
+}
+
+// note what panel p's packets are picked out by, once it has been configured and set up (the only one takes them all)
+void keep_panel (int p)
+{
+   panels[p].simulation=SIMULATION;
+   panels[p].keybase=(numpanels>1) ? KEYBASE & KEYMASK : 0;
+   panels[p].keymask=(numpanels>1) ? KEYMASK : 0;
+}
+
+// spike events the decoders have seen, for all the panels
+int64_t all_spikes_decoded (void)
+{
+   panelstate_t *was=thispanel;
+   int64_t total=0;
+   for (int p=0; p<numpanels; p++) {
+      switch_panel(p);
+      total+=spikesdecoded;
+   }
+   thispanel=was;
+   return total;
+}
+
+// how a packet is shared out for a visualisation whose data words are routing keys: the offset of the first, and how
+//   many words go with each key (a spike's key, or a key & its data). 0 for one whose data aren't keys, so that a
+//   panel takes the packet whole if it takes packet_key().
+int packet_keys (int simulation, unsigned char *packetbuffer, int *first)
+{
+   struct sdp_msg *scanptr = (sdp_msg*) packetbuffer;
+   *first=SDPHEADERLEN;
+   switch (simulation) {
+      case RETINA:      *first=18; return 1;    // (SpiNNaker packets)
+      case RETINA2:
+      case SPIKERVC:    return 1;
+      case RATEPLOT:    return (scanptr->cmd_rc>=64 && scanptr->cmd_rc<=66) ? 2 : 0;    // (its raster data are neuron numbers)
+      case MAR12RASTER: return 2;
+   }
+   return 0;
+}
+
+// the key a whole packet is picked for a panel by: COCHLEA's one spike's, otherwise the key of the chip and core that
+//   sent it (x<<24 | y<<16 | p<<11)
+uint packet_key (int simulation, unsigned char *packetbuffer)
+{
+   struct sdp_msg *scanptr = (sdp_msg*) packetbuffer;
+   if (simulation==COCHLEA) return scanptr->data[0];
+   return ((uint)(scanptr->srce_addr>>8)<<24) | ((uint)(scanptr->srce_addr&0xFF)<<16) | ((uint)(scanptr->srce_port&0x1F)<<11);
+}
+
+static inline int panel_takes (int p, uint key)
+{
+   return (key & panels[p].keymask)==panels[p].keybase;
+}
+
+// a routing key's chip (x<<24 | y<<16) moved to where its board sits in the machine. 0 if that's off the edge.
+static inline int offset_key_chip (uint *key, packetsource_t *source)
+{
+   uint x=(*key>>24)+source->chipx, y=((*key>>16)&0xFF)+source->chipy;
+   if (x>255 || y>255) return 0;
+   *key=(x<<24) | (y<<16) | (*key&0xFFFF);
+   return 1;
+}
+
+// what of a packet the panels have taken so far, going through them in order
+typedef struct {
+   char whole;                            // a panel took all of it
+   int words;                             // how many of its words the panels before have taken
+   unsigned char taken[MAXBLOCKSIZE];     // and which
+} packetshares_t;
+
+// panel p's share of a packet, after the panels before it have had theirs (start with 'shares' zeroed, for panel 0).
+//   Keys go to the first panel that takes them, so one packet can feed several panels: the share is a copy in 'share'
+//   of the header and the words with the keys that are p's, or the packet itself if they all are. NULL if none of it is.
+//   If the board is offset (BOARDS), the keys (or the sending chip) are moved to where it is in the machine first, as
+//   the panel's visualisation reads them; any that that puts off the edge are dropped.
+unsigned char *panel_share (int p, unsigned char *packetbuffer, int *length, unsigned char *share, packetshares_t *shares, packetsource_t *source)
+{
+   if (shares->whole) return NULL;
+   int offset = (source!=NULL && (source->chipx|source->chipy)!=0);
+   int first, stride=packet_keys(panels[p].simulation, packetbuffer, &first);
+   if (stride==0) {
+      if (shares->words>0) return NULL;
+      if (offset) {                            // (the chip that sent it, or COCHLEA's spike's key)
+         struct sdp_msg *scanptr = (sdp_msg*) share;
+         memcpy(share, packetbuffer, *length);
+         uint chip=(uint)scanptr->srce_addr<<16;
+         if (!offset_key_chip((panels[p].simulation==COCHLEA) ? &scanptr->data[0] : &chip, source)) {
+            __sync_fetch_and_add(&source->offmachine, 1);
+            shares->whole=1;
+            return NULL;
          }
+         scanptr->srce_addr=chip>>16;
+         packetbuffer=share;
+      }
+      if (!panel_takes(p, packet_key(panels[p].simulation, packetbuffer))) return NULL;
+      shares->whole=1;
+      return packetbuffer;
+   }
+   int words=(*length-first)/4;
+   if (words>MAXBLOCKSIZE) words=MAXBLOCKSIZE;
+   words-=words%stride;
+   uint *data=(uint*)(packetbuffer+first);
+   uint *sharedata=(uint*)(share+first);
+   int shared=0;
+   for (int i=0; i<words; i+=stride) {
+      if (shares->taken[i]) continue;
+      uint key=data[i];
+      if (offset && !offset_key_chip(&key, source)) {
+         __sync_fetch_and_add(&source->offmachine, 1);
+         for (int j=0; j<stride; j++) shares->taken[i+j]=1;    // (so no other panel has it either)
+         shares->words+=stride;
+         continue;
+      }
+      if (!panel_takes(p, key)) continue;
+      for (int j=0; j<stride; j++) shares->taken[i+j]=1;
+      sharedata[shared++]=key;
+      for (int j=1; j<stride; j++) sharedata[shared++]=data[i+j];
+   }
+   if (shared==0) return NULL;
+   shares->words+=shared;
+   if (shared==words && shares->words==shared && !offset) {    // (all of it, as it came)
+      shares->whole=1;
+      return packetbuffer;
+   }
+   memcpy(share, packetbuffer, first);
+   *length=first+(shared*4);
+   return share;
+}
 
-         if (SIMULATION==INTEGRATORFG) {
-            xsrc=scanptr->srce_addr/256; // takes the chip ID and works out the chip X coord
-            ysrc=scanptr->srce_addr%256; // and the chip Y coord
-            uint arrayindex=(EACHCHIPX*EACHCHIPY)*((xsrc*(XDIMENSIONS/EACHCHIPX))+ysrc);    // no per core element so no +i
-            for (int i=0; i<numAdditionalBytes/4; i++) {      // for all extra data (assuming regular array of 4 byte words)
-               if (freezedisplay==0) {
-                  if (i==0) {                // only interested in first data item
-                     //float input=1.0+(float)((int)scanptr->data[i])/(float)pow(2.0,FIXEDPOINT);
-                     float input=1.0+(float)((int)scanptr->data[i])/256.0;
-                     input*=(0.001/0.03);
-                     int previousindex=updateline-1;
-                     if (previousindex<0) previousindex=HISTORYSIZE;
-                     float pastdata=0.0;
-                     if (history_data[previousindex][arrayindex]>(NOTDEFINEDFLOAT+1))
-                        pastdata=history_data[previousindex][arrayindex];
-                     input+=pastdata*exp(-0.001/0.03);
-                     immediate_data[arrayindex]=input;                                   // wobbler data
-                     history_data[updateline][arrayindex]=immediate_data[arrayindex];    // replace any data already here
-                     somethingtoplot=1;                            // indicate we will need to refresh the screen
-                  }
-               }
+// panel p's share of a packet on its own (the panels before it having theirs first)
+unsigned char *panel_share_alone (int p, unsigned char *packetbuffer, int *length, unsigned char *share, packetsource_t *source)
+{
+   packetshares_t shares;
+   memset(&shares, 0, sizeof(shares));
+   for (int q=0; q<p; q++) {
+      int sharelength=*length;
+      panel_share(q, packetbuffer, &sharelength, share, &shares, source);
+   }
+   return panel_share(p, packetbuffer, length, share, &shares, source);
+}
+
+// decode (all or some of) a packet from the ring for the panel the thread has switched to
+static inline void decode_panel_packet (unsigned char *packetbuffer, int length, ringslot_t *slot)
+{
+   int locking = (DECODETHREADS>1 || replaying!=0);    // replay seeks rebuild the plot data from their own thread
+   int saving = (DECODETHREADS>1 && numpanels>1 && outputfileformat!=0);    // (the panels save to the one file)
+   if (saving) pthread_mutex_lock(&savelock);
+   if (locking) pthread_mutex_lock(&decodelock);        // (the panel's: other panels' packets go on being decoded)
+   process_sdp_packet(packetbuffer, length, &slot->from, slot->receivetime);
+   if (decoders_asked()) publish_immediate();    // (between packets, so a frame never has part of one)
+   if (locking) pthread_mutex_unlock(&decodelock);
+   if (saving) pthread_mutex_unlock(&savelock);
+}
+
+// decode stage: takes packets out of its ring in order and processes them
+void* decode_thread (void *ptr)
+{
+   packetring_t *ring = (packetring_t*) ptr;
+   unsigned char sharebuffer[RECVSLOTSIZE];        // a panel's share of a packet, when there are several
+
+   while (1) {
+      if (ring->tail==ring->head) {                // nothing to do. Flush what we've written then sleep till the receiver has more
+         if (outputfileformat==1) fflush (fileoutput);    // (spike records are flushed by the recorder thread)
+         fflush (stdout);                        // flush IO buffers now - and why not? (immortal B. Norman esq)
+         pthread_mutex_lock(&ring->waitlock);
+         ring->consumerwaiting=1;
+         __sync_synchronize();                    // receiver must see we're waiting before we look at head again
+         if (numpanels>1) {                       // (so the renderer sees the last of the data without waiting for more)
+            for (int p=0; p<numpanels; p++) {
+               switch_panel(p);
+               if (!decoders_asked()) continue;
+               if (DECODETHREADS>1 || replaying!=0) pthread_mutex_lock(&decodelock);
+               publish_immediate();
+               if (DECODETHREADS>1 || replaying!=0) pthread_mutex_unlock(&decodelock);
             }
-            //recombine to single vector - if display paused don't update what's there
-            // send to log file for plotting (overwriting what's already here)
+         } else if (decoders_asked() || (decodeshard!=NULL && decodeshard->ntouched>0)) {
+            if (DECODETHREADS>1 || replaying!=0) pthread_mutex_lock(&decodelock);
+            if (decodeshard!=NULL) merge_shard(decodeshard);
+            publish_immediate();
+            if (DECODETHREADS>1 || replaying!=0) pthread_mutex_unlock(&decodelock);
          }
+         if (ring->tail==ring->head) {
+            struct timeval nowtv;
+            struct timespec waituntil;
+            gettimeofday(&nowtv,NULL);
+            waituntil.tv_sec = nowtv.tv_sec;
+            waituntil.tv_nsec = (nowtv.tv_usec*1000)+100000000;    // belt and braces, never sleep more than 100ms
+            if (waituntil.tv_nsec>=1000000000) { waituntil.tv_sec++; waituntil.tv_nsec-=1000000000; }
+            pthread_cond_timedwait(&ring->waitcond, &ring->waitlock, &waituntil);
+         }
+         ring->consumerwaiting=0;
+         pthread_mutex_unlock(&ring->waitlock);
+         continue;
+      }
 
+      __sync_synchronize();                        // slot contents are valid once we've seen head move
+      ringslot_t *slot = &ring->slots[ring->tail & (ring->size-1)];
+      packetsource_t *source = (slot->source<0) ? NULL : &packetsources[slot->source];
+      unsigned char *packet = slot->payload;
+      int length = slot->length;
+      if (numpanels==1 && source!=NULL && (source->chipx|source->chipy)!=0) {    // (where BOARDS says this board is)
+         packetshares_t shares;
+         memset(&shares, 0, sizeof(shares));
+         packet=panel_share(0, packet, &length, sharebuffer, &shares, source);
+      }
+      spikeshard_t *shard = shard_for(ring-packetrings);
+      if (shard!=decodeshard) {                    // changing over, so what's been counted so far goes in first
+         if (decodeshard!=NULL) {
+            pthread_mutex_lock(&decodelock);
+            merge_shard(decodeshard);
+            pthread_mutex_unlock(&decodelock);
+         }
+         decodeshard=shard;
+      }
+      if (source==NULL || packet==NULL) {
+         // from a board that BOARDS doesn't name, so not for us (or it's all off the edge of the machine)
+      } else if (shard!=NULL) {
+         process_sdp_packet(packet, length, &slot->from, slot->receivetime);    // (takes decodelock itself to merge)
+         if (decoders_asked()) {
+            pthread_mutex_lock(&decodelock);
+            merge_shard(shard);
+            publish_immediate();
+            pthread_mutex_unlock(&decodelock);
+         }
+      } else if (numpanels==1) {
+         decode_panel_packet(packet, length, slot);
+      } else {
+         packetshares_t shares;                    // (each panel gets its share of the packet in turn)
+         memset(&shares, 0, sizeof(shares));
+         for (int p=0; p<numpanels && !shares.whole; p++) {
+            length=slot->length;
+            unsigned char *share=panel_share(p, slot->payload, &length, sharebuffer, &shares, source);
+            if (share==NULL) continue;
+            switch_panel(p);
+            decode_panel_packet(share, length, slot);
+         }
+      }
+      ring->decoded++;
+      __sync_synchronize();                        // finished with the slot before we hand it back
+      ring->tail++;
+   }
+}
 
-         if (outputfileformat==1) {                // write to output file only if required and in normal SPINNAKER packet format (1) - basically the UDP payload
-            short test_length=numbytes_input;
-            int64_t test_timeoffset=(nowtime-firstreceivetimez);
-            if (writingtofile==0) {    // can only write to the file if its not paused and can write
-               writingtofile=1;        // 3 states.  1=busy writing, 2=paused, 0=not paused, not busy can write.
-               fwrite(&test_length, sizeof(test_length), 1, fileoutput);
-               fwrite(&test_timeoffset, sizeof(test_timeoffset), 1, fileoutput);
-               fwrite(&buffer_input, test_length, 1, fileoutput);
-               writingtofile=0;        // note write finished
-            }
+// The receiver, recorder, replay and sender below work on packets, not on any one panel, so the panel state names
+// aren't in use here: what little of a panel's state they need they name explicitly (the first panel's, or thispanel's).
+#undef SIMULATION
+#undef TITLE
+#undef STARTMODE
+#undef STARTCOLOUR
+#undef displaymode
+#undef colourused
+#undef BLACKBACKGROUND
+#undef INITZERO
+#undef XDIMENSIONS
+#undef YDIMENSIONS
+#undef EACHCHIPX
+#undef EACHCHIPY
+#undef XCHIPS
+#undef YCHIPS
+#undef BOARD
+#undef TIMEWINDOW
+#undef displayWindow
+#undef HISTORYSIZE
+#undef MAXRASTERISEDNEURONS
+#undef HISTORYTYPE
+#undef RASTEREVENTS
+#undef PYRAMIDLEVELS
+#undef PYRAMIDBIN
+#undef PYRAMIDLINES
+#undef PYRAMIDEVENTS
+#undef DISPLAYKEY
+#undef KEYWIDTH
+#undef DISPLAYXLABELS
+#undef DISPLAYYLABELS
+#undef keyWidth
+#undef windowBorder
+#undef windowHeight
+#undef windowWidth
+#undef HIWATER
+#undef LOWATER
+#undef lowwatermark
+#undef highwatermark
+#undef DYNAMICSCALE
+#undef PERCENTAGESCALE
+#undef LABELBYCHIP
+#undef DISPLAYMINIPLOT
+#undef XFLIP
+#undef YFLIP
+#undef VECTORFLIP
+#undef ROTATEFLIP
+#undef xflip
+#undef yflip
+#undef vectorflip
+#undef rotateflip
+#undef FIXEDPOINT
+#undef BITSOFPOPID
+#undef ALTERSTEPSIZE
+#undef DECAYPROPORTION
+#undef POPULATION_CORES
+#undef POPULATION
+#undef KEYBASE
+#undef KEYMASK
+#undef history_data
+#undef history_data_set2
+#undef historyepoch
+#undef historynow
+#undef historytimeperindex
+#undef refillwanted
+#undef refillline
+#undef refilltimeperindex
+#undef pyramid
+#undef pyramidlog
+#undef pyramidmask
+#undef pyramidlogged
+#undef historyevents
+#undef historyevents2
+#undef rasterrow
+#undef immediate_data
+#undef displaydata
+#undef datacolours
+#undef datafills
+#undef heatmaptexture
+#undef heatmaptexturewidth
+#undef heatmaptextureheight
+#undef scrollplots
+#undef historyrewrites
+#undef heatmapimage
+#undef tilepixel
+#undef maingrid
+#undef minigrid
+#undef tilecolours
+#undef tiledata
+#undef tiledataflips
+#undef maplocaltoglobal
+#undef mapglobaltolocal
+#undef plotvaluesinblocks
+#undef xdim
+#undef ydim
+#undef plotWidth
+#undef printlabels
+#undef fullscreen
+#undef oldwindowBorder
+#undef gridlines
+#undef livebox
+#undef alternorth
+#undef altereast
+#undef altersouth
+#undef alterwest
+#undef biasediting
+#undef rasterpopulation
+#undef biascurrent
+#undef N_PER_PROC
+#undef ID_OFFSET
+#undef minneuridrx
+#undef maxneuridrx
+#undef retinalut
+#undef dc
+#undef immediatetime
+#undef immediatesnap
+#undef snaptime
+#undef snapmiddle
+#undef snapwriter
+#undef snapreader
+#undef snapwanted
+#undef immediateclearwanted
+#undef process_sdp_packet
+#undef decodelock
+#undef spikesdecoded
+#undef retinaunmapped
+#undef heatmapoverflows
+#undef decodenow
+
+// spike recorder: empties the spike queue into the output file a large block at a time, away from the decoders
+void* spike_recorder_thread (void *ptr)
+{
+   static char block[RECORDBLOCK];
+   struct timespec ts;
+   ts.tv_sec = 0;
+   ts.tv_nsec = 10000000;                   // idle for 10ms when there's nothing to write
+
+   while (1) {
+      if (spikequeue.tail==spikequeue.head) {
+         nanosleep(&ts,NULL);
+         continue;
+      }
+      pthread_mutex_lock(&recorderlock);
+      int used=0, records=0;
+      while (spikequeue.tail!=spikequeue.head && used<RECORDBLOCK-64) {
+         __sync_synchronize();                  // see the record the decoder published
+         spikerecord_t *record = &spikequeue.records[spikequeue.tail & (spikequeue.size-1)];
+         if (outputfileformat==3) {             // binary: int64 ms, uint32 neuron ID, little endian
+            memcpy(block+used, &record->timems, sizeof(int64_t));
+            memcpy(block+used+sizeof(int64_t), &record->neuronid, sizeof(uint));
+            used += sizeof(int64_t)+sizeof(uint);
+         } else {
+            used += sprintf(block+used, "%lld.0\t%u.0\n", (long long int)record->timems, record->neuronid);      // neurotools format (ms and NeurID)
          }
+         records++;
+         __sync_synchronize();
+         spikequeue.tail++;                    // hand the slot back
+      }
+      if (fileoutput!=NULL && outputfileformat>=2) {
+         fwrite(block, used, 1, fileoutput);
+         if (spikequeue.tail==spikequeue.head) fflush(fileoutput);    // caught up, so get it onto the disk
+         spikequeue.written += records;
+      } else {
+         spikequeue.dropped += records;        // file was closed under us
+      }
+      pthread_mutex_unlock(&recorderlock);
+   }
+}
 
-         if (outputfileformat!=0) fflush (fileoutput);        // will have written something in this section to the output file - flush to the file now
-         fflush (stdout);                        // flush IO buffers now - and why not? (immortal B. Norman esq)
+// the board a datagram came from (its packetsources index), learning boards as they're heard unless BOARDS named them
+//   all. -1 if it's not one of them. Only the receive thread calls this.
+int packet_source (struct sockaddr_in *from)
+{
+   static int lastsource=0;                  // (a board tends to send a run of packets)
+   if (lastsource<numsources && packetsources[lastsource].ip.s_addr==from->sin_addr.s_addr) return lastsource;
+   for (int s=0; s<numsources; s++) {
+      if (packetsources[s].ip.s_addr==from->sin_addr.s_addr) return lastsource=s;
+   }
+   if (boardslisted>0 || numsources==MAXSOURCES) return -1;
+   packetsources[numsources].ip=from->sin_addr;
+   if (numsources>0) printf("Board %d: packets from %s on port: %d\n", numsources, inet_ntoa(from->sin_addr), htons(from->sin_port));    // (the first says hello as it's decoded)
+   __sync_synchronize();                     // the board is there before anyone can see it counted
+   lastsource=numsources++;
+   return lastsource;
+}
+
+// the ring (decoder) a packet goes to, by a hash of where it's from and its first key: the same for the same packet
+//   whenever it's received or replayed. (There's only more than one decoder for spike counts, which add up the same
+//   whichever decoder gets there first, so a board feeding us from one core can still be shared between them.)
+static inline int ring_for (struct sockaddr_in *from, unsigned char *packetbuffer, int length)
+{
+   struct sdp_msg *scanptr = (sdp_msg*) packetbuffer;
+   uint hash = from->sin_addr.s_addr ^ ((uint)from->sin_port<<16);
+   if (length>=(int)(SDPHEADERLEN+sizeof(uint))) hash ^= (((uint)scanptr->srce_addr<<8) | scanptr->srce_port) ^ scanptr->data[0];
+   hash *= 2654435761u;
+   return (int)((hash>>16) % (uint)DECODETHREADS);
+}
+
+// one batch of datagrams off a listener's socket straight into the decoder's ring (or with several decoders, shared out
+//   between their rings by ring_for). flags are recvmmsg's: with MSG_WAITFORONE it blocks for the first, with
+//   MSG_DONTWAIT (epoll said it's readable) it doesn't. If a ring is full nothing is read: the packets wait in the socket
+//   buffer while the decoders catch up, and are only lost if that overflows too (which the kernel counts).
+void receive_batch (int listener, int flags)
+{
+   int64_t nowtime;
+   struct timeval stopwatchus;
+   struct timespec ts;
+
+   // only take as many as the fullest ring has room for (with >1 decoder they could all be from one source, for one ring)
+   unsigned int wanted = RECVBATCH;
+   for (int i=0; i<DECODETHREADS; i++) {
+      packetring_t *ring = &packetrings[i];
+      unsigned int freeslots = ring->size-(ring->head-ring->tail);
+      if (freeslots==0) ring->full++;
+      if (freeslots<wanted) wanted=freeslots;
+   }
+   if (wanted==0) {
+      recvwaits++;
+      ts.tv_sec = 0;
+      ts.tv_nsec = 100000;                       // 0.1ms nap while the decoders make room
+      nanosleep(&ts,NULL);
+      return;
+   }
+
+   for (unsigned int m=0; m<wanted; m++) {     // one decoder: straight into its ring. More: into the arena to be shared out
+      ringslot_t *slot = (DECODETHREADS==1) ? &packetrings[0].slots[(packetrings[0].head+m) & (packetrings[0].size-1)] : &recvarena[m];
+      recviovecs[m].iov_base = slot->payload;
+      recvmsgs[m].msg_hdr.msg_name = &slot->from;
+      recvmsgs[m].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+   }
 
-      }       // discarding any hello packet by dropping out without processing
+   // block for the first datagram, then take whatever else is already queued (up to the batch size) in the same syscall
+   int numpackets = recvmmsg(listenfds[listener], recvmsgs, wanted, flags, NULL);
+
+   if (numpackets == -1) {
+      if (errno==EINTR || errno==EAGAIN) return;    // interrupted by a signal (or nothing there after all), so just go round again
+      printf("Error line 441: : %s\n",strerror(errno));
+      perror((char*)"error recvmmsg");
+      exit(-1);                    // will only get here if there's an error getting the input frames off the Ethernet
+   }
+
+   recvsyscalls++;                                            // keep tally of how well we are batching
+   recvpackets+=numpackets;
+   listenerpackets[listener]+=numpackets;
+   if (numpackets>recvbatchmax) recvbatchmax=numpackets;
+
+   gettimeofday(&stopwatchus,NULL);                // grab current time, once for the whole batch
+   nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
+   for (int m=0; m<numpackets; m++) {
+      ringslot_t *slot;
+      int r = 0;
+      if (DECODETHREADS==1) {
+         slot = &packetrings[0].slots[(packetrings[0].head+m) & (packetrings[0].size-1)];
+      } else {                                   // each source's packets to its own ring, in the order they came
+         ringslot_t *landed = &recvarena[m];
+         r = ring_for(&landed->from, landed->payload, recvmsgs[m].msg_len);
+         slot = &packetrings[r].slots[(packetrings[r].head+packetrings[r].filling) & (packetrings[r].size-1)];
+         slot->from = landed->from;
+         memcpy(slot->payload, landed->payload, recvmsgs[m].msg_len);
+      }
+      packetrings[r].filling++;
+      slot->length = recvmsgs[m].msg_len;
+      slot->receivetime = nowtime;
+      slot->listener = listener;
+      slot->source = packet_source(&slot->from);
+      if (slot->source<0) unlistedpackets++;
+      else packetsources[slot->source].packets++;
+   }
+   __sync_synchronize();                        // slots are filled before the decoders can see them
+   for (int i=0; i<DECODETHREADS; i++) {
+      packetring_t *ring = &packetrings[i];
+      if (ring->filling==0) continue;
+      unsigned int depth = ring->head-ring->tail;
+      ring->head += ring->filling;
+      ring->pushed += ring->filling;
+      if (depth+ring->filling > ring->highwater) ring->highwater = depth+ring->filling;
+      ring->filling = 0;
+      __sync_synchronize();
+      if (ring->consumerwaiting) {                // wake the decoder if it's gone to sleep
+         pthread_mutex_lock(&ring->waitlock);
+         pthread_cond_signal(&ring->waitcond);
+         pthread_mutex_unlock(&ring->waitlock);
+      }
+   }
+}
+
+// receive stage: pulls batches of datagrams off the socket(s) straight into the decoders' rings, and does nothing else
+void* input_thread_SDP (void *ptr)
+{
+   struct epoll_event events[MAXLISTENERS];
+
+   //printf("Listening for SDP frames.");
+
+   while (1) {                             // for ever ever, ever ever.
+      if (numlisteners==1) {
+         receive_batch(0, MSG_WAITFORONE);    // just the one port, so no need to ask which is readable
+         continue;
+      }
+      int ready = epoll_wait(epollfd, events, MAXLISTENERS, -1);
+      if (ready == -1) {
+         if (errno==EINTR) continue;
+         perror((char*)"error epoll_wait");
+         exit(-1);
+      }
+      for (int i=0; i<ready; i++) receive_batch(events[i].data.u32, MSG_DONTWAIT);    // (a batch each, so a busy board can't starve the rest)
    }
 }
 
 void readmappings(char* filenamea, char* filenameb) {
 //  const char filenamea[] = "maplocaltoglobal.csv";
 //  const char filenameb[] = "mapglobaltolocal.csv";
+   panelstate_t *panel=&panelstates[0];    // (the maps are the first panel's)
 
    FILE *filea = fopen(filenamea, "r");
    if ( filea ) {
       size_t i, j, k;
       char buffer[BUFSIZ], *ptr;
       for ( i = 0; fgets(buffer, sizeof buffer, filea); ++i )
-         for ( j = 0, ptr = buffer; j < (sizeof(*maplocaltoglobal)/sizeof(*(*maplocaltoglobal))); ++j, ++ptr ) {
-            if (i<XDIMENSIONS*YDIMENSIONS) {
-               maplocaltoglobal[i][j] = (int)strtol(ptr, &ptr, 10);
+         for ( j = 0, ptr = buffer; j < (sizeof(*panel->maplocaltoglobal)/sizeof(*(*panel->maplocaltoglobal))); ++j, ++ptr ) {
+            if (i<panel->XDIMENSIONS*panel->YDIMENSIONS) {
+               panel->maplocaltoglobal[i][j] = (int)strtol(ptr, &ptr, 10);
                maplocaltoglobalsize=i;
             }
          }
@@ -974,9 +2707,9 @@ void readmappings(char* filenamea, char* filenameb) {
       size_t i, j, k;
       char buffer[BUFSIZ], *ptr;
       for ( i = 0; fgets(buffer, sizeof buffer, fileb); ++i )
-         for ( j = 0, ptr = buffer; j < (sizeof(*mapglobaltolocal)/sizeof(*(*mapglobaltolocal))); ++j, ++ptr ) {
-            if (i<XDIMENSIONS*YDIMENSIONS) {
-               mapglobaltolocal[i][j] = (int)strtol(ptr, &ptr, 10);
+         for ( j = 0, ptr = buffer; j < (sizeof(*panel->mapglobaltolocal)/sizeof(*(*panel->mapglobaltolocal))); ++j, ++ptr ) {
+            if (i<panel->XDIMENSIONS*panel->YDIMENSIONS) {
+               panel->mapglobaltolocal[i][j] = (int)strtol(ptr, &ptr, 10);
                mapglobaltolocalsize=i;
             }
          }
@@ -986,129 +2719,601 @@ void readmappings(char* filenamea, char* filenameb) {
    size_t i, j, k;
    for ( j = 0; j <= mapglobaltolocalsize; ++j ) {
       printf("mapglobaltolocal[%lu]: ", (long unsigned)j);
-      for ( k = 0; k < (sizeof(*mapglobaltolocal)/sizeof(*(*mapglobaltolocal))); ++k ) printf("%4d ", mapglobaltolocal[j][k]);
+      for ( k = 0; k < (sizeof(*panel->mapglobaltolocal)/sizeof(*(*panel->mapglobaltolocal))); ++k ) printf("%4d ", panel->mapglobaltolocal[j][k]);
       putchar('\n');
    }
    for ( j = 0; j <= maplocaltoglobalsize; ++j ) {
       printf("maplocaltoglobal[%lu]: ", (long unsigned)j);
-      for ( k = 0; k < (sizeof(*maplocaltoglobal)/sizeof(*(*maplocaltoglobal))); ++k ) printf("%4d ", maplocaltoglobal[j][k]);
+      for ( k = 0; k < (sizeof(*panel->maplocaltoglobal)/sizeof(*(*panel->maplocaltoglobal))); ++k ) printf("%4d ", panel->maplocaltoglobal[j][k]);
       putchar('\n');
    }
-   mappingfilesread=1;
+   mappingfilesread=1;
+}
+
+// .spinn v2 writing. The chunk being filled is kept in memory and written with a single fwrite when full.
+void spinn2_write_chunk(void)
+{
+   spinn2chunk_t *chunk = (spinn2chunk_t*) recordchunk;
+   if (chunk->packets==0) return;
+   fwrite(recordchunk, SPINN2CHUNKSIZE, 1, fileoutput);
+   if (recordheader.numchunks==recordindexsize) {
+      recordindexsize = recordindexsize?recordindexsize*2:64;
+      recordindex = (spinn2chunk_t*) realloc(recordindex, recordindexsize*sizeof(spinn2chunk_t));
+   }
+   recordindex[recordheader.numchunks++] = *chunk;
+   recordheader.packets += chunk->packets;
+   recordheader.lasttime = chunk->lasttime;
+   memset(recordchunk, 0, SPINN2CHUNKSIZE);      // next chunk starts empty (and unused space is zeros)
+}
+
+// append one packet to the recording
+void record_packet(unsigned char *packetbuffer, short length, int64_t timeoffset)
+{
+   spinn2chunk_t *chunk = (spinn2chunk_t*) recordchunk;
+   int recordsize = sizeof(short)+sizeof(int64_t)+length;
+   int64_t latest = (chunk->packets>0) ? chunk->lasttime : recordheader.lasttime;
+   if (timeoffset<latest) timeoffset=latest;    // (several decoders can hand them over a little out of order: the recording stays in time order)
+   if (sizeof(spinn2chunk_t)+chunk->bytesused+recordsize > SPINN2CHUNKSIZE) spinn2_write_chunk();    // no room, so this chunk's done
+   unsigned char *record = recordchunk+sizeof(spinn2chunk_t)+chunk->bytesused;
+   memcpy(record, &length, sizeof(short));
+   memcpy(record+sizeof(short), &timeoffset, sizeof(int64_t));
+   memcpy(record+sizeof(short)+sizeof(int64_t), packetbuffer, length);
+   if (chunk->packets==0) chunk->firsttime=timeoffset;
+   chunk->lasttime=timeoffset;
+   chunk->packets++;
+   chunk->bytesused+=recordsize;
+}
+
+// new recording: header (completed on close) then chunks
+void spinn2_open(void)
+{
+   panelstate_t *panel=&panelstates[0];    // (a recording is described by the first panel)
+   struct timeval stopwatchus;
+   gettimeofday(&stopwatchus,NULL);
+   memset(&recordheader, 0, sizeof(recordheader));
+   strcpy(recordheader.magic, SPINN2MAGIC);
+   recordheader.recordingstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   recordheader.version = 2;
+   recordheader.headersize = SPINN2HEADERSIZE;
+   recordheader.chunksize = SPINN2CHUNKSIZE;
+   recordheader.simulation = panel->SIMULATION;
+   recordheader.xdimensions = panel->XDIMENSIONS;
+   recordheader.ydimensions = panel->YDIMENSIONS;
+   recordheader.eachchipx = panel->EACHCHIPX;
+   recordheader.eachchipy = panel->EACHCHIPY;
+   snprintf(recordheader.configfile, sizeof(recordheader.configfile), "%s", configfilename);
+   snprintf(recordheader.title, sizeof(recordheader.title), "%s", panel->TITLE);
+
+   unsigned char headerblock[SPINN2HEADERSIZE];
+   memset(headerblock, 0, SPINN2HEADERSIZE);
+   memcpy(headerblock, &recordheader, sizeof(recordheader));
+   fwrite(headerblock, SPINN2HEADERSIZE, 1, fileoutput);
+
+   if (recordchunk==NULL) recordchunk = (unsigned char*) malloc(SPINN2CHUNKSIZE);
+   memset(recordchunk, 0, SPINN2CHUNKSIZE);
+}
+
+// last chunk, the index, and the completed header
+void spinn2_close(void)
+{
+   spinn2_write_chunk();
+   recordheader.indexoffset = ftello(fileoutput);
+   if (recordheader.numchunks>0) fwrite(recordindex, sizeof(spinn2chunk_t), recordheader.numchunks, fileoutput);
+   fseeko(fileoutput, 0, SEEK_SET);
+   fwrite(&recordheader, sizeof(recordheader), 1, fileoutput);
+   printf("Recorded %lld packets in %d chunks over %3.1fs.\n", (long long int)recordheader.packets, recordheader.numchunks, (float)recordheader.lasttime/1000000.0);
+}
+
+// line a replay timeline start up with the history lines (wall clock us), so a recording always bins into them the same way
+int64_t replay_align (int64_t timelinestart)
+{
+   int64_t usperline = (int64_t)((panelstates[0].displayWindow/(float)panelstates[0].plotWidth)*1000000);
+   if (usperline<=0) return timelinestart;
+   int64_t phase = (timelinestart-starttimez)%usperline;
+   if (phase<0) phase+=usperline;
+   return timelinestart-phase;
+}
+
+// recording time (us) showing at the right hand side of the plot
+int64_t replay_position (void)
+{
+   int64_t nowtime=freezetime;
+   if (freezedisplay==0) {
+      struct timeval stopwatchus;
+      gettimeofday(&stopwatchus,NULL);                // grab current time
+      nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   }
+   if (replayunthrottled) return replaysentto;
+   if (replaystarttime==-1) return 0;
+   int64_t position=(int64_t)((double)(nowtime-replaystarttime)*playbackmultiplier);
+   if (position>replayheader.lasttime && (replaylegacy==0 || replaylegacyscanned>=replayfilesize)) position=replayheader.lasttime;
+   if (position<0) position=0;
+   return position;
+}
+
+// replay source: hand a recorded packet to the decoders through the same rings the receiver fills, stamped with its
+//   time on the replay timeline. Nothing is dropped, if a decoder's ring is full we wait for it.
+void replay_push (unsigned char *payload, short length, int64_t receivetime)
+{
+   struct sockaddr_in from;                     // the packets look like they came from where they were sent to
+   memset(&from, 0, sizeof(from));
+   from.sin_family = AF_INET;
+   from.sin_addr = spinnakerboardip;
+   from.sin_port = htons(spinnakerboardport);
+   struct timespec ts;
+   ts.tv_sec = 0;
+   ts.tv_nsec = 100000;                       // 0.1ms naps while the decoder catches up
+
+   if (length<0 || length>RECVSLOTSIZE) return;
+   packetring_t *ring = &packetrings[(DECODETHREADS==1) ? 0 : ring_for(&from, payload, length)];    // (as the receiver shares them out)
+   while (ring->head-ring->tail >= ring->size) {
+      if (ring->consumerwaiting) {
+         pthread_mutex_lock(&ring->waitlock);
+         pthread_cond_signal(&ring->waitcond);
+         pthread_mutex_unlock(&ring->waitlock);
+      }
+      nanosleep(&ts,NULL);
+   }
+
+   ringslot_t *slot = &ring->slots[ring->head & (ring->size-1)];
+   memcpy(slot->payload, payload, length);
+   slot->length = length;
+   slot->receivetime = receivetime;
+   slot->from = from;
+   slot->listener = 0;
+   slot->source = 0;                            // (a recording already has any board offsets in it)
+   __sync_synchronize();                        // slot is filled before the decoder can see it
+   unsigned int depth = ring->head+1-ring->tail;
+   ring->head++;
+   ring->pushed++;
+   if (depth > ring->highwater) ring->highwater = depth;
+   __sync_synchronize();
+   if (ring->consumerwaiting) {                // wake the decoder if it's gone to sleep
+      pthread_mutex_lock(&ring->waitlock);
+      pthread_cond_signal(&ring->waitcond);
+      pthread_mutex_unlock(&ring->waitlock);
+   }
+}
+
+// pass one recorded packet to the decoders at the right time: timeoffset (us from the start of the recording) scaled by playbackmultiplier.
+//   Returns 0 without sending if the user pauses or seeks while we're waiting for its time to come.
+int replay_packet (unsigned char *payload, short length, int64_t timeoffset)
+{
+   struct timeval stopwatchus;
+   struct timespec ts;                        // used for calculating how long to wait for next frame
+   int64_t targettime=(int64_t)((double)timeoffset/(double)playbackmultiplier);
+
+   gettimeofday(&stopwatchus,NULL);                // grab current time
+   int64_t nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
+
+   replaysentto=timeoffset;
+   if (replayunthrottled) {                        // as fast as it'll go: no waiting, and stamped with when it went, like a live packet
+      replay_push(payload, length, nowtime);
+      return 1;
+   }
+
+   if (replaystarttime==-1) replaystarttime=replay_align(nowtime-targettime);    // if 1st packet then note it's arrival (typically timeoffset==0 for 1st packet)
+
+   int64_t howlongtowait = (replaystarttime+targettime)-nowtime;        // how long in us until we need to send the next packet
+
+   while (howlongtowait>0) {                    // if we are ahead of schedule sleep for a bit, in short naps so the timeline controls respond
+      if (replayseekto>=0 || freezedisplay!=0) return 0;
+      if (howlongtowait>10000) howlongtowait=10000;
+      ts.tv_sec = 0;
+      ts.tv_nsec = howlongtowait*1000;            // us * 1000 = nano secs
+      nanosleep (&ts, NULL);
+      gettimeofday(&stopwatchus,NULL);
+      nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+      howlongtowait = (replaystarttime+targettime)-nowtime;
+   }
+
+   if (howlongtowait<-1000000 && replaybehind++==0)
+      printf("\n\n\n***** Warning having trouble keeping up - times may be inaccurate *****\n"); // if we fall more than 1sec behind where we should be
+
+   replay_push(payload, length, replaystarttime+targettime);    // stamped with when it's due, not when it got there
+   return 1;
+}
+
+// pointer to bytes offset..offset+length of the recording being replayed, NULL if they're not all in the file.
+//   If they're outside the current window the old one is unmapped (so resident memory stays at one window
+//   however big the recording is) and a new one mapped from the page the bytes start in.
+unsigned char* replay_map (off_t offset, size_t length)
+{
+   if (offset<0 || offset+(off_t)length>replayfilesize) return NULL;
+   if (replaywindow==NULL || offset<replaywindowstart || offset+(off_t)length>replaywindowstart+(off_t)replaywindowlength) {
+      if (replaywindow!=NULL) munmap(replaywindow, replaywindowlength);
+      replaywindow=NULL;
+      replaywindowstart = offset & ~((off_t)sysconf(_SC_PAGESIZE)-1);
+      replaywindowlength = max((size_t)REPLAYWINDOW, (size_t)(offset-replaywindowstart)+length);
+      if (replaywindowstart+(off_t)replaywindowlength>replayfilesize) replaywindowlength = replayfilesize-replaywindowstart;
+      void *mapped = mmap(NULL, replaywindowlength, PROT_READ, MAP_SHARED, replayfd, replaywindowstart);
+      if (mapped==MAP_FAILED) {
+         perror("can't map the recording");
+         return NULL;
+      }
+      replaywindow = (unsigned char*) mapped;
+      madvise(replaywindow, replaywindowlength, MADV_SEQUENTIAL);    // read ahead, we go through it in order
+   }
+   return replaywindow+(offset-replaywindowstart);
+}
+
+// add a chunk to the replay index, its records start at file offset recordsat
+void replay_add_chunk (spinn2chunk_t *chunk, off_t recordsat)
+{
+   if (replayheader.numchunks>=replayindexallocated) {
+      replayindexallocated = max(64, replayindexallocated*2);
+      replayindex = (spinn2chunk_t*) realloc(replayindex, replayindexallocated*sizeof(spinn2chunk_t));
+      replaychunkoffset = (off_t*) realloc(replaychunkoffset, replayindexallocated*sizeof(off_t));
+   }
+   replayindex[replayheader.numchunks] = *chunk;
+   replaychunkoffset[replayheader.numchunks] = recordsat;
+   replayheader.numchunks++;
+}
+
+// .spinn v2: read the header and chunk index (rebuilding the index from the chunk headers if the recording wasn't closed)
+int spinn2_read_index (void)
+{
+   unsigned char *mapped = replay_map(0, sizeof(replayheader));
+   if (mapped==NULL) return 0;
+   memcpy(&replayheader, mapped, sizeof(replayheader));
+   if (replayheader.version!=2) return 0;
+   int numchunks=replayheader.numchunks;
+   replayheader.numchunks=0;
+   if (replayheader.indexoffset!=0) {
+      for (int chunk=0; chunk<numchunks; chunk++) {
+         spinn2chunk_t chunkheader;
+         mapped = replay_map(replayheader.indexoffset+((off_t)chunk*sizeof(spinn2chunk_t)), sizeof(spinn2chunk_t));
+         if (mapped==NULL) return 0;
+         memcpy(&chunkheader, mapped, sizeof(spinn2chunk_t));
+         replay_add_chunk(&chunkheader, (off_t)replayheader.headersize+((off_t)chunk*replayheader.chunksize)+sizeof(spinn2chunk_t));
+      }
+   } else {
+      printf("Recording wasn't closed properly, recovering the index from the chunks...\n");
+      replayheader.packets=0;
+      off_t chunkat=replayheader.headersize;
+      while ((mapped = replay_map(chunkat, sizeof(spinn2chunk_t)))!=NULL) {
+         spinn2chunk_t chunkheader;
+         memcpy(&chunkheader, mapped, sizeof(spinn2chunk_t));
+         if (chunkheader.packets==0) break;
+         replay_add_chunk(&chunkheader, chunkat+sizeof(spinn2chunk_t));
+         replayheader.packets += chunkheader.packets;
+         replayheader.lasttime = chunkheader.lasttime;
+         chunkat += replayheader.chunksize;
+      }
+   }
+   return 1;
+}
+
+// legacy .spinn: index the next SPINN2CHUNKSIZE or so of records as a chunk, 0 at the end of the file
+int replay_index_legacy (void)
+{
+   spinn2chunk_t chunk;
+   off_t offset=replaylegacyscanned;
+   unsigned char *record=NULL;
+   memset(&chunk, 0, sizeof(chunk));
+
+   while (chunk.bytesused<SPINN2CHUNKSIZE && (record = replay_map(offset, sizeof(short)+sizeof(int64_t)))!=NULL) {
+      short length;
+      int64_t timeoffset;
+      memcpy(&length, record, sizeof(short));
+      memcpy(&timeoffset, record+sizeof(short), sizeof(int64_t));
+      if (length<=0 || offset+(off_t)(sizeof(short)+sizeof(int64_t)+length)>replayfilesize) {
+         record=NULL;                                  // a truncated last record
+         break;
+      }
+      if (chunk.packets==0) chunk.firsttime=timeoffset;
+      chunk.lasttime=timeoffset;
+      chunk.packets++;
+      chunk.bytesused+=sizeof(short)+sizeof(int64_t)+length;
+      offset+=sizeof(short)+sizeof(int64_t)+length;
+   }
+
+   if (chunk.packets>0) {
+      replay_add_chunk(&chunk, replaylegacyscanned);
+      replayheader.packets+=chunk.packets;
+      if (chunk.lasttime>replayheader.lasttime) replayheader.lasttime=chunk.lasttime;
+   }
+   replaylegacyscanned = (record==NULL) ? replayfilesize : offset;
+   return chunk.packets>0;
+}
+
+// make sure chunk is in the index (reading further into a legacy file if need be), 0 if the recording ends before it
+int replay_have_chunk (int chunk)
+{
+   while (chunk>=replayheader.numchunks)
+      if (replaylegacy==0 || replay_index_legacy()==0) return 0;
+   return 1;
+}
+
+// the first chunk that could hold recording time timeoffset (us), found from the chunk time index
+int replay_find_chunk (int64_t timeoffset)
+{
+   while (replaylegacy!=0 && (replayheader.numchunks==0 || replayindex[replayheader.numchunks-1].lasttime<timeoffset) && replay_index_legacy());
+   int lo=0, hi=replayheader.numchunks;
+   while (lo<hi) {
+      int mid=(lo+hi)/2;
+      if (replayindex[mid].lasttime<timeoffset) lo=mid+1;
+      else hi=mid;
+   }
+   return lo;
+}
+
+// wait for packets we've already queued to be decoded, so they don't land on a rebuilt plot
+void replay_wait_for_decoders (void)
+{
+   struct timespec ts;
+   ts.tv_sec = 0;
+   ts.tv_nsec = 1000000;
+   while (1) {
+      int busy=0;
+      for (int i=0; i<DECODETHREADS; i++) if (packetrings[i].tail!=packetrings[i].head) busy=1;
+      if (busy==0) return;
+      nanosleep(&ts,NULL);
+   }
+}
+
+// after a seek: put recording time target at the right hand side of the plot, and refill the history on show
+//   by decoding the recording up to there directly (as if each packet had arrived at its time on the new timeline)
+void replay_rebuild (int64_t target)
+{
+   struct timeval stopwatchus;
+   struct sockaddr_in replayfrom;                // the packets look like they came from where they were sent to
+   static unsigned char sharebuffer[RECVSLOTSIZE];    // (with several panels, each one's share of a packet)
+   memset(&replayfrom, 0, sizeof(replayfrom));
+   replayfrom.sin_family = AF_INET;
+   replayfrom.sin_addr = spinnakerboardip;
+   replayfrom.sin_port = htons(spinnakerboardport);
+
+   replay_wait_for_decoders();
+   gettimeofday(&stopwatchus,NULL);
+   int64_t nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   replayrebuilding=1;
+   replaystarttime = replay_align(nowtime-(int64_t)((double)target/(double)playbackmultiplier));
+
+   for (int panel=0; panel<numpanels; panel++) {    // (each panel rebuilt for its own window, from its own packets)
+      switch_panel(panel);
+      pthread_mutex_lock(&thispanel->decodelock);
+      int64_t shown = (int64_t)(thispanel->displayWindow*1000000.0);    // wall clock us across the plot
+      if (shown>nowtime-starttimez) shown=nowtime-starttimez;  // (there's no history from before we started)
+      int64_t from = target-(int64_t)((double)shown*playbackmultiplier);
+      if (from<0) from=0;
+      int64_t lastframe = target-(int64_t)((1000000.0/MAXFRAMERATE)*playbackmultiplier);    // immediate data only gets the last frame's worth
+
+      thispanel->historyrewrites++;               // the plot needs drawing again from the rebuilt history
+      forget_history();                           // so everything from the left of the plot is cleared as it's rebuilt
+
+      int clearedimmediate=0;
+      for (int chunk=replay_find_chunk(from); replay_have_chunk(chunk) && replayindex[chunk].firsttime<target; chunk++) {
+         off_t offset=replaychunkoffset[chunk];
+         for (int i=0; i<replayindex[chunk].packets; i++) {
+            short length;
+            int64_t timeoffset;
+            unsigned char *record = replay_map(offset, sizeof(short)+sizeof(int64_t));
+            if (record==NULL) break;
+            memcpy(&length, record, sizeof(short));
+            memcpy(&timeoffset, record+sizeof(short), sizeof(int64_t));
+            if ((record = replay_map(offset, sizeof(short)+sizeof(int64_t)+length))==NULL) break;
+            offset += sizeof(short)+sizeof(int64_t)+length;
+            if (timeoffset<from || timeoffset>=target) continue;
+            unsigned char *packet=record+sizeof(short)+sizeof(int64_t);
+            int packetlength=length;
+            if (numpanels>1 && (length>RECVSLOTSIZE || (packet=panel_share_alone(panel, packet, &packetlength, sharebuffer, NULL))==NULL)) continue;
+            if (timeoffset>=lastframe && clearedimmediate++==0) for (int j=0; j<(thispanel->xdim*thispanel->ydim); j++) thispanel->immediate_data[j]=thispanel->INITZERO?0.0:NOTDEFINEDFLOAT;
+            thispanel->process_sdp_packet(packet, packetlength, &replayfrom, replaystarttime+(int64_t)((double)timeoffset/(double)playbackmultiplier));
+         }
+      }
+      if (clearedimmediate==0) for (int j=0; j<(thispanel->xdim*thispanel->ydim); j++) thispanel->immediate_data[j]=thispanel->INITZERO?0.0:NOTDEFINEDFLOAT;
+      thispanel->snapwanted=1;
+      publish_immediate();                        // show the rebuilt data even if no more comes
+      pthread_mutex_unlock(&thispanel->decodelock);
+   }
+   switch_panel(0);
+
+   if (freezedisplay!=0) freezetime=nowtime;    // a paused plot shows the new time too
+   replayrebuilding=0;
+   somethingtoplot=1;
+}
+
+// CPU time (us) the decode threads have used so far
+int64_t decode_cpu_time (void)
+{
+   int64_t total=0;
+   for (int i=0; decodethreads!=NULL && i<DECODETHREADS; i++) {
+      clockid_t cpuclock;
+      struct timespec used;
+      if (pthread_getcpuclockid(decodethreads[i], &cpuclock)==0 && clock_gettime(cpuclock, &used)==0)
+         total += ((int64_t)used.tv_sec*(int64_t)1000000) + (used.tv_nsec/1000);
+   }
+   return total;
+}
+
+// throughput of a replay, from when it started (at the given wall clock, decoded packet, spike, decode CPU and frame counts)
+void print_replay_stats (int64_t startedat, int64_t decodedat, int64_t spikesat, int64_t cpuat, int64_t framesat)
+{
+   struct timeval stopwatchus;
+   gettimeofday(&stopwatchus,NULL);
+   int64_t took = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec)-startedat;
+   int64_t decoded=-decodedat;
+   for (int i=0; i<DECODETHREADS; i++) decoded+=packetrings[i].decoded;
+   int64_t spikes=all_spikes_decoded()-spikesat;
+   int64_t cpu=decode_cpu_time()-cpuat;
+   if (took<=0) took=1;
+   printf("Replay throughput: %lld packets in %3.3fs, %3.0f packets/s, %3.0f spikes/s (%s).\n",
+          (long long int)decoded, (float)took/1000000.0, (double)decoded*1000000.0/(double)took, (double)spikes*1000000.0/(double)took,
+          replayunthrottled ? "unthrottled" : "paced by the recording");
+   printf("   Decode stage: %3.3fs of CPU over %d thread(s), %3.2fus/packet. Render: %lld frames, %3.1f fps.\n",
+          (float)cpu/1000000.0, DECODETHREADS, decoded>0 ? (float)cpu/(float)decoded : 0.0,
+          (long long int)(framesdrawn-framesat), (double)(framesdrawn-framesat)*1000000.0/(double)took);
 }
 
+// replay thread: sends the recording to ourselves in time, and follows the timeline controls (pause, seeks, loop)
 void* load_stimulus_data_from_file (void *ptr)
 {
-   int64_t sincefirstpacket,nowtime,filestarttime=-1;
-   int64_t howlongrunning, howlongtowait;                // for timings
-   struct timeval stopwatchus, deltateeus;                // declare timing variables
-   struct timespec ts;                        // used for calculating how long to wait for next frame
-   int numbytes;
-   char sdp_header_len=26;
-   //unsigned char test_buffer[1500]; // max size
-
-   //int a1 = new int[SIZE];
-   short fromfilelenproto;            // allocate new heap memory for a buffer for reading up to 100k packets in
-   int64_t fromfileoffsetproto;        // allocate new heap memory for a buffer for reading up to 100k packets in
-   sdp_msg fromfileproto;            // allocate new heap memory for a buffer for reading up to 100k packets in
-
-   uint numberofpackets=0;
-   uint filesimtime;                    // time in ms offset from 1st packet at beginning of file
-   int64_t startimer=-1,endtimer=-1;
-
-   printf("\nChecking File Length...%d\n",numberofpackets-1);
-
-   while (fread(&fromfilelenproto, sizeof (fromfilelenproto), 1, fileinput)) {
-      //printf("Length: %d\n",fromfilelen[numberofpackets]);
-      fread(&fromfileoffsetproto, sizeof(fromfileoffsetproto), 1, fileinput);
-      if (startimer==-1) startimer=fromfileoffsetproto;
-      if (endtimer<fromfileoffsetproto) endtimer=fromfileoffsetproto;
-      //printf("TimeOffset: %d\n",fromfileoffset[numberofpackets]);
-      fread(&fromfileproto, fromfilelenproto, 1, fileinput);
-      //printf("Balls to it: %c\n",test_buffer[0]);
-      numberofpackets++;
-   }
-
-   fseek(fileinput,0 ,SEEK_SET);                    // reset position
-   printf("Detected: %d packets in input file over %3.1fs. Allocating memory and loading...\n",numberofpackets-1,(float)(endtimer-startimer)/1000000.0);
-
-   int buffsize=100000;                        // max number of packets to load each time
-   if (numberofpackets<buffsize) buffsize=numberofpackets;        // size for the number of packets we have
-
-   short *fromfilelen = new short[buffsize];            // allocate new heap memory for a buffer for reading packets into
-   int64_t *fromfileoffset = new int64_t[buffsize];        // allocate new heap memory for a buffer for reading packets into
-   sdp_msg *fromfile = new sdp_msg[buffsize];            // allocate new heap memory for a buffer for reading packets into
-   printf("Memory Chunk Allocated:..*%d. Now transmitting...\n",buffsize);
-
-   int stilltosend=numberofpackets-1;                // keep a tally of how many to go!
-   int keepyuppyproblemo=0;                    // work out if we are keeping up, if we fall 1+ sec behind on playback print an inaccuracy warning.
-   while (stilltosend>0) {
-      int chunktosend=min(100000,stilltosend);
-      for(int i=0; i<chunktosend; i++) {
-         fread(&fromfilelen[i], sizeof (fromfilelen[i]), 1, fileinput);
-         fread(&fromfileoffset[i], sizeof(fromfileoffset[i]), 1, fileinput);
-         fread(&fromfile[i], fromfilelen[i], 1, fileinput);
-         //printf("%d of %d) Balls to it, size: %d\n",i, chunktosend, fromfilelen[i]);
-      }
-
-      //printf("Loaded next chunk of: %d packets from the file. Starting transmission...\n",chunktosend);
-
-      for (int i=0; i<chunktosend; i++) {
-         short extradata=fromfilelen[i];
-         int64_t targettime=(int64_t)((float)fromfileoffset[i]/(float)playbackmultiplier);
-
-         //sdp_msg *scanptr3 = &fromfile[i];
-         //printf("PacketID: %d, Size %u, and TimeOffset (us):%lu.\n",i,extradata,targettime);
-         //  printf("ip_time_out: %d. Padded by: %d\n",scanptr3->ip_time_out,scanptr3->pad);
-         //printf("flags: %u. Tagged by: %u\n",scanptr3->flags,scanptr3->tag);
-         //printf("dest_port: %u. srce_port: %u\n",scanptr3->dest_port,scanptr3->srce_port);
-         //printf("dest_addr: %u. srce_addr: %u\n",scanptr3->dest_addr,scanptr3->srce_addr);
-         //printf("cmd_rc: %x.\n",scanptr3->cmd_rc);
-         //printf("arg1: %u.\n",scanptr3->arg1);
-         //printf("arg2: %u.\n",scanptr3->arg2);
-         //printf("arg3: %u.\n",scanptr3->arg3);
-
-         gettimeofday(&stopwatchus,NULL);                // grab current time
-         nowtime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
-
-         if (filestarttime==-1) filestarttime=nowtime-targettime;    // if 1st packet then note it's arrival (typically timeoffset==0 for 1st packet)
-
-         howlongtowait = (filestarttime+targettime)-nowtime;        // how long in us until we need to send the next packet
-         //printf("Now: %lu,   Target: %lu.  Therefore sleeping for %d us and %d ns\n",nowtime,targettime+filestarttime,howlongtowait,howlongtowait*1000);
-
-         if (howlongtowait>0) {
-            ts.tv_sec = howlongtowait/1000000;                // # seconds
-            ts.tv_nsec = (howlongtowait%1000000)*1000;            // us * 1000 = nano secs
-            nanosleep (&ts, NULL);            // if we are ahead of schedule sleep for a bit
+   struct stat filestat;
+   replayfd = fileno(fileinput);
+   fstat(replayfd, &filestat);
+   replayfilesize = filestat.st_size;
+
+   unsigned char *magic = replay_map(0, strlen(SPINN2MAGIC)+1);
+   if (magic!=NULL && strcmp((char*)magic, SPINN2MAGIC)==0 && spinn2_read_index()) {
+      // .spinn v2 - everything we need to know is in the header and index
+      printf("\nRecording of SIMULATION %d (\"%s\", %s): %lld packets in %d chunks over %3.1fs.\n",
+             replayheader.simulation, replayheader.title, replayheader.configfile, (long long int)replayheader.packets,
+             replayheader.numchunks, (float)replayheader.lasttime/1000000.0);
+      if (replayheader.simulation!=panelstates[0].SIMULATION) printf("** Warning: recorded from SIMULATION %d, but we are visualising SIMULATION %d.\n", replayheader.simulation, panelstates[0].SIMULATION);
+   } else {
+      // legacy .spinn: [short len][int64 offset][payload] records from the start of the file, indexed as we get to them
+      memset(&replayheader, 0, sizeof(replayheader));
+      replaylegacy=1;
+      printf("\nLegacy recording, now transmitting...\n");
+   }
+
+   struct timeval stopwatchus;
+   gettimeofday(&stopwatchus,NULL);
+   int64_t statsstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // for the throughput summary at the end
+   int64_t statsdecoded=0, statsspikes=all_spikes_decoded(), statscpu=decode_cpu_time(), statsframes=framesdrawn;
+   for (int i=0; i<DECODETHREADS; i++) statsdecoded+=packetrings[i].decoded;
+
+   int chunk=-1, left=0;                  // chunk we're sending from, and how many of its packets are still to go
+   off_t offset=0;                        // where the next of them is in the file
+   int64_t sendfrom=0;                    // after a seek, earlier packets in its chunk aren't sent
+   int64_t pausedat=0;                    // recording time when the display was paused
+   char paused=0, finished=0;
+   struct timespec ts;
+   ts.tv_sec = 0;
+   ts.tv_nsec = 10000000;                 // check the controls every 10ms when there's nothing to send
+
+   while (1) {
+      if (replayseekto<0 && freezedisplay!=0 && paused==0) {    // paused: hold our place in the recording
+         pausedat=replay_position();
+         paused=1;
+      }
+      if (replayseekto<0 && freezedisplay==0 && paused!=0) replayseekto=pausedat;    // resumed: carry on from there
+
+      if (replayseekto>=0) {
+         int64_t target=replayseekto;
+         replayseekto=-1;
+         chunk=replay_find_chunk(target);
+         if (target>replayheader.lasttime) target=replayheader.lasttime;
+         if (target<0) target=0;
+         replay_rebuild(target);
+         paused=(freezedisplay!=0);
+         pausedat=target;
+         finished=0;
+         left=0;
+         if (replay_have_chunk(chunk)) {
+            offset=replaychunkoffset[chunk];
+            left=replayindex[chunk].packets;
          }
+         sendfrom=target;
+         continue;
+      }
 
-         if (howlongtowait<-1000000 && keepyuppyproblemo++==0)
-            printf("\n\n\n***** Warning having trouble keeping up - times may be inaccurate *****\n"); // if we fall more than 1sec behind where we should be
+      if (freezedisplay!=0 || finished!=0) {
+         nanosleep(&ts,NULL);
+         continue;
+      }
 
-         if (spinnakerboardipset!=0) {                // if we don't know where to send don't send!
-            if (numbytes = sendto(sockfd, &fromfile[i], extradata, 0, p->ai_addr, p->ai_addrlen) == -1)    {
-               perror("oh dear - we didn't send our data!\n");
-               exit(1);
-            }
-         }          // write to the Ethernet (127.0.0.1 and relevant port number)
+      if (left==0) {                                  // on to the next chunk
+         if (replay_have_chunk(chunk+1)) {
+            chunk++;
+            offset=replaychunkoffset[chunk];
+            left=replayindex[chunk].packets;
+         } else if (replayloopstart>=0 && replayloopend>replayloopstart) {
+            replayseekto=replayloopstart;
+         } else {
+            replay_wait_for_decoders();                // let the last of them be plotted before we freeze
+            printf("\nAll %lld packets in the file were sent (%3.1fs). Finished.\n", (long long int)replayheader.packets, (float)replayheader.lasttime/1000000.0);
+            print_replay_stats(statsstart, statsdecoded, statsspikes, statscpu, statsframes);
+            printf("\n");
+            freezedisplay=1;
+            gettimeofday(&stopwatchus,NULL);                    // grab current time
+            freezetime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
+            needtorebuildmenu=1;
+            pausedat=replay_position();
+            paused=1;
+            finished=1;
+         }
+         continue;
+      }
+
+      short length;
+      int64_t timeoffset;
+      unsigned char *record = replay_map(offset, sizeof(short)+sizeof(int64_t));
+      if (record!=NULL) {
+         memcpy(&length, record, sizeof(short));
+         memcpy(&timeoffset, record+sizeof(short), sizeof(int64_t));
+         record = replay_map(offset, sizeof(short)+sizeof(int64_t)+length);
+      }
+      if (record==NULL) {                             // the index doesn't match the file, skip the rest of this chunk
+         left=0;
+         continue;
       }
-      stilltosend-=chunktosend;    // reduce the number of packets still to send
+      if (replayloopstart>=0 && replayloopend>replayloopstart && timeoffset>=replayloopend) {
+         replayseekto=replayloopstart;                // round the loop again
+         continue;
+      }
+      if (timeoffset>=sendfrom && replay_packet(record+sizeof(short)+sizeof(int64_t), length, timeoffset)==0) continue;    // paused or seeking, this one is still to go
+      offset += sizeof(short)+sizeof(int64_t)+length;
+      left--;
    }
+   return NULL;
+}
+
 
-   fclose (fileinput);  // we've now send all the data,
-   fileinput=NULL;
+// timeline controls: go to recording time target (us), pausing there if asked (e.g. stepping a frame at a time)
+void replay_seek (int64_t target, char pause)
+{
+   if (replaying==0) return;
+   if (pause!=0 && freezedisplay==0) {
+      freezedisplay=1;
+      struct timeval stopwatchus;
+      gettimeofday(&stopwatchus,NULL);                    // grab current time
+      freezetime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
+      needtorebuildmenu=1;
+   }
+   replayseekto = (target<0) ? 0 : target;
+   somethingtoplot=1;
+}
 
-   delete[] fromfilelen;
-   delete[] fromfileoffset;
-   delete[] fromfile;    // free up buffer space used
+// a display frame's worth of recording time (us), the step for frame by frame
+int64_t replay_frame (void)
+{
+   return (int64_t)((1000000.0/MAXFRAMERATE)*playbackmultiplier);
+}
 
-   printf("\nAll packets in the file were sent. Finished.\n\n");
-   freezedisplay=1;
-   gettimeofday(&stopwatchus,NULL);                    // grab current time
-   freezetime = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // get time now in us
+// a plot width's worth of recording time (us), the step for paging through
+int64_t replay_page (void)
+{
+   return (int64_t)(thispanel->displayWindow*1000000.0*playbackmultiplier);
+}
 
+// loop from here (to the end of the recording until the end of the loop is marked)
+void replay_mark_loop_start (void)
+{
+   replayloopstart=replay_position();
+   if (replayloopend<=replayloopstart) replayloopend=-1;
+   printf("Loop from %3.1fs.\n", (float)replayloopstart/1000000.0);
+   needtorebuildmenu=1;
 }
 
+// loop back from here, or if we're already looping stop
+void replay_mark_loop_end (void)
+{
+   if (replayloopend>=0) {
+      replayloopstart=-1;
+      replayloopend=-1;
+      printf("Loop cleared.\n");
+   } else {
+      if (replayloopstart<0) replayloopstart=0;
+      int64_t position=replay_position();
+      if (position>replayloopstart) {
+         replayloopend=position;
+         printf("Looping %3.1fs to %3.1fs.\n", (float)replayloopstart/1000000.0, (float)replayloopend/1000000.0);
+      }
+   }
+   needtorebuildmenu=1;
+}
 
 void init_sdp_sender()
 {
@@ -1179,7 +3384,7 @@ void sdp_sender(unsigned short dest_add, unsigned char dest_port, unsigned int c
 
    sdplength=26+(4*extrawords);        // only send extra data if it's supplied
 
-   if (spinnakerboardipset!=0) {                // if we don't know where to send don't send!
+   if (spinnakerboardipset!=0 && replaying==0) {                // if we don't know where to send don't send! (nor to a recording)
       if ((numbytes = sendto(sockfd, pointworkingpacket, sdplength, 0, p->ai_addr, p->ai_addrlen)) == -1)    {
          perror("oh dear - we didn't send our data!\n");
          exit(1);
@@ -1194,6 +3399,135 @@ void sdp_sender(unsigned short dest_add, unsigned char dest_port, unsigned int c
 }
 
 
+// and from here on the panel state names are those of the calling thread's panel again
+#define SIMULATION              (thispanel->SIMULATION)
+#define TITLE                   (thispanel->TITLE)
+#define STARTMODE               (thispanel->STARTMODE)
+#define STARTCOLOUR             (thispanel->STARTCOLOUR)
+#define displaymode             (thispanel->displaymode)
+#define colourused              (thispanel->colourused)
+#define BLACKBACKGROUND         (thispanel->BLACKBACKGROUND)
+#define INITZERO                (thispanel->INITZERO)
+#define XDIMENSIONS             (thispanel->XDIMENSIONS)
+#define YDIMENSIONS             (thispanel->YDIMENSIONS)
+#define EACHCHIPX               (thispanel->EACHCHIPX)
+#define EACHCHIPY               (thispanel->EACHCHIPY)
+#define XCHIPS                  (thispanel->XCHIPS)
+#define YCHIPS                  (thispanel->YCHIPS)
+#define BOARD                   (thispanel->BOARD)
+#define TIMEWINDOW              (thispanel->TIMEWINDOW)
+#define displayWindow           (thispanel->displayWindow)
+#define HISTORYSIZE             (thispanel->HISTORYSIZE)
+#define MAXRASTERISEDNEURONS    (thispanel->MAXRASTERISEDNEURONS)
+#define HISTORYTYPE             (thispanel->HISTORYTYPE)
+#define RASTEREVENTS            (thispanel->RASTEREVENTS)
+#define PYRAMIDLEVELS           (thispanel->PYRAMIDLEVELS)
+#define PYRAMIDBIN              (thispanel->PYRAMIDBIN)
+#define PYRAMIDLINES            (thispanel->PYRAMIDLINES)
+#define PYRAMIDEVENTS           (thispanel->PYRAMIDEVENTS)
+#define DISPLAYKEY              (thispanel->DISPLAYKEY)
+#define KEYWIDTH                (thispanel->KEYWIDTH)
+#define DISPLAYXLABELS          (thispanel->DISPLAYXLABELS)
+#define DISPLAYYLABELS          (thispanel->DISPLAYYLABELS)
+#define keyWidth                (thispanel->keyWidth)
+#define windowBorder            (thispanel->windowBorder)
+#define windowHeight            (thispanel->windowHeight)
+#define windowWidth             (thispanel->windowWidth)
+#define HIWATER                 (thispanel->HIWATER)
+#define LOWATER                 (thispanel->LOWATER)
+#define lowwatermark            (thispanel->lowwatermark)
+#define highwatermark           (thispanel->highwatermark)
+#define DYNAMICSCALE            (thispanel->DYNAMICSCALE)
+#define PERCENTAGESCALE         (thispanel->PERCENTAGESCALE)
+#define LABELBYCHIP             (thispanel->LABELBYCHIP)
+#define DISPLAYMINIPLOT         (thispanel->DISPLAYMINIPLOT)
+#define XFLIP                   (thispanel->XFLIP)
+#define YFLIP                   (thispanel->YFLIP)
+#define VECTORFLIP              (thispanel->VECTORFLIP)
+#define ROTATEFLIP              (thispanel->ROTATEFLIP)
+#define xflip                   (thispanel->xflip)
+#define yflip                   (thispanel->yflip)
+#define vectorflip              (thispanel->vectorflip)
+#define rotateflip              (thispanel->rotateflip)
+#define FIXEDPOINT              (thispanel->FIXEDPOINT)
+#define BITSOFPOPID             (thispanel->BITSOFPOPID)
+#define ALTERSTEPSIZE           (thispanel->ALTERSTEPSIZE)
+#define DECAYPROPORTION         (thispanel->DECAYPROPORTION)
+#define POPULATION_CORES        (thispanel->POPULATION_CORES)
+#define POPULATION              (thispanel->POPULATION)
+#define KEYBASE                 (thispanel->KEYBASE)
+#define KEYMASK                 (thispanel->KEYMASK)
+#define history_data            (thispanel->history_data)
+#define history_data_set2       (thispanel->history_data_set2)
+#define historyepoch            (thispanel->historyepoch)
+#define historynow              (thispanel->historynow)
+#define historytimeperindex     (thispanel->historytimeperindex)
+#define refillwanted            (thispanel->refillwanted)
+#define refillline              (thispanel->refillline)
+#define refilltimeperindex      (thispanel->refilltimeperindex)
+#define pyramid                 (thispanel->pyramid)
+#define pyramidlog              (thispanel->pyramidlog)
+#define pyramidmask             (thispanel->pyramidmask)
+#define pyramidlogged           (thispanel->pyramidlogged)
+#define historyevents           (thispanel->historyevents)
+#define historyevents2          (thispanel->historyevents2)
+#define rasterrow               (thispanel->rasterrow)
+#define immediate_data          (thispanel->immediate_data)
+#define displaydata             (thispanel->displaydata)
+#define datacolours             (thispanel->datacolours)
+#define datafills               (thispanel->datafills)
+#define heatmaptexture          (thispanel->heatmaptexture)
+#define heatmaptexturewidth     (thispanel->heatmaptexturewidth)
+#define heatmaptextureheight    (thispanel->heatmaptextureheight)
+#define scrollplots             (thispanel->scrollplots)
+#define historyrewrites         (thispanel->historyrewrites)
+#define heatmapimage            (thispanel->heatmapimage)
+#define tilepixel               (thispanel->tilepixel)
+#define maingrid                (thispanel->maingrid)
+#define minigrid                (thispanel->minigrid)
+#define tilecolours             (thispanel->tilecolours)
+#define tiledata                (thispanel->tiledata)
+#define tiledataflips           (thispanel->tiledataflips)
+#define maplocaltoglobal        (thispanel->maplocaltoglobal)
+#define mapglobaltolocal        (thispanel->mapglobaltolocal)
+#define plotvaluesinblocks      (thispanel->plotvaluesinblocks)
+#define xdim                    (thispanel->xdim)
+#define ydim                    (thispanel->ydim)
+#define plotWidth               (thispanel->plotWidth)
+#define printlabels             (thispanel->printlabels)
+#define fullscreen              (thispanel->fullscreen)
+#define oldwindowBorder         (thispanel->oldwindowBorder)
+#define gridlines               (thispanel->gridlines)
+#define livebox                 (thispanel->livebox)
+#define alternorth              (thispanel->alternorth)
+#define altereast               (thispanel->altereast)
+#define altersouth              (thispanel->altersouth)
+#define alterwest               (thispanel->alterwest)
+#define biasediting             (thispanel->biasediting)
+#define rasterpopulation        (thispanel->rasterpopulation)
+#define biascurrent             (thispanel->biascurrent)
+#define N_PER_PROC              (thispanel->N_PER_PROC)
+#define ID_OFFSET               (thispanel->ID_OFFSET)
+#define minneuridrx             (thispanel->minneuridrx)
+#define maxneuridrx             (thispanel->maxneuridrx)
+#define retinalut               (thispanel->retinalut)
+#define dc                      (thispanel->dc)
+#define immediatetime           (thispanel->immediatetime)
+#define immediatesnap           (thispanel->immediatesnap)
+#define snaptime                (thispanel->snaptime)
+#define snapmiddle              (thispanel->snapmiddle)
+#define snapwriter              (thispanel->snapwriter)
+#define snapreader              (thispanel->snapreader)
+#define snapwanted              (thispanel->snapwanted)
+#define immediateclearwanted    (thispanel->immediateclearwanted)
+#define process_sdp_packet      (thispanel->process_sdp_packet)
+#define decodelock              (thispanel->decodelock)
+#define spikesdecoded           (thispanel->spikesdecoded)
+#define retinaunmapped          (thispanel->retinaunmapped)
+#define heatmapoverflows        (thispanel->heatmapoverflows)
+#define decodenow               (thispanel->decodenow)
+
+
 void error(char *msg)
 {
    perror(msg);
@@ -1204,7 +3538,14 @@ void error(char *msg)
 void cleardown (void)
 {
    //for (int i=0;i<(xdim*ydim);i++) immediate_data[i]=NOTDEFINEDFLOAT;   // superfluous
-   for (int i=0; i<(xdim*ydim); i++) immediate_data[i]=INITZERO?0.0:NOTDEFINEDFLOAT;
+   if (decodethreads==NULL) {                  // (not started yet)
+      clear_immediate(immediate_data);
+      for (int i=0; i<3; i++) clear_immediate(immediatesnap[i]);
+   } else {
+      immediateclearwanted=1;                  // the decoders own it, so they clear it before they next publish
+      wake_decoders();
+      clear_immediate(immediatesnap[snapreader]);    // and what we're showing now
+   }
    highwatermark = HIWATER;                    // reset for auto-scaling of plot colours, can dynamically alter this value (255.0 = top of the shop)
    lowwatermark = LOWATER;                        // reset for auto-scaling of plot colours, can dynamically alter this value (255.0 = top of the shop)
    xflip=XFLIP;
@@ -1336,7 +3677,8 @@ int coordinate_manipulate(int ii)
 }
 
 
-float colour_calculator(float inputty, float hiwater, float lowater)
+// where inputty sits between the low and high water marks, 0.0 (low) to 1.0 (high)
+float colour_fill(float inputty, float hiwater, float lowater)
 {
    float scalingfactor = 0;
    float fillcolour = 1.0;
@@ -1358,74 +3700,449 @@ float colour_calculator(float inputty, float hiwater, float lowater)
 
    //if (highwatermark>0.0001) fillcolour = 1.0-(inputty/hiwater);  //stop a divide by zero!
    //if (fillcolour !=0) printf("Fillcolour: %f, inputty: %d\n", fillcolour, inputty);
-   if (colourused==1) {
-   }
+   return fillcolour;
+}
+
+// the RGB (0.0-1.0 each) for a fill level in a colour map. Returns 0 for an unknown colour map (rgb untouched)
+int colour_rgb(int colourmap, float fillcolour, float *rgb)
+{
+#define COLOURSTEPS 6    // 6 different RGB colours, Black, Blue, Cyan, Green, Yellow, Red
+   static const float multigamut[COLOURSTEPS][3] = { {0.0,0.0,0.0},{0.0,0.0,1.0},{0.0,1.0,1.0},{0.0,1.0,0.0},{1.0,1.0,0.0},{1.0,0.0,0.0} };
+#define COLOURSTEPSB 5    //  black, purpleymagenta, red, yellow, white (RGB)
+   static const float thermalgamut[COLOURSTEPSB][3] = { {0.0,0.0,0.0},{1.0,0.0,1.0},{1.0,0.0,0.0},{1.0,1.0,0.0},{1.0,1.0,1.0} };
+   const float (*gamut)[3] = multigamut;
+   int steps = COLOURSTEPS;
 
-   switch(colourused)
+   switch(colourmap)
    {
-   case 1:
+   case THERMAL:
+      gamut = thermalgamut;
+      steps = COLOURSTEPSB;
+      // fall through - and on as for MULTI
+   case MULTI:
    {
-#define COLOURSTEPS 6    // 6 different RGB colours, Black, Blue, Cyan, Green, Yellow, Red
-      int gamut[COLOURSTEPS][3] = { {0.0,0.0,0.0},{0.0,0.0,1.0},{0.0,1.0,1.0},{0.0,1.0,0.0},{1.0,1.0,0.0},{1.0,0.0,0.0} };
-
-      int colourindex = (float)fillcolour*(float)(COLOURSTEPS-1);
-      float colouroffset = (float)(colourindex+1)-(fillcolour*(float)(COLOURSTEPS-1));     // how far away from higher index (range between 0 and 1).
-      float R=((1.0-colouroffset)*(float)gamut[colourindex+1][0]) + (colouroffset*(float)gamut[colourindex][0]);
-      float G=((1.0-colouroffset)*(float)gamut[colourindex+1][1]) + (colouroffset*(float)gamut[colourindex][1]);
-      float B=((1.0-colouroffset)*(float)gamut[colourindex+1][2]) + (colouroffset*(float)gamut[colourindex][2]);
-//        printf("Dataz[i]: %f, Hi: %f, Lo: %f, Fillcolour: %f, Index %d\n    Offset %f,  Low %f, Up %f, Tot %f.\n",
-//               inputty,hiwater,lowater,fillcolour,colourindex,
-//                  colouroffset, (1.0-colouroffset)*(float)gamut[colourindex+1][1],(colouroffset*(float)gamut[colourindex][1]),R);
-//        printf("Offset %f, LowGr %f, UpGr %f, Tot %f.\n",
-//                  colouroffset, (1.0-colouroffset)*(float)gamut[colourindex+1][1],(colouroffset*(float)gamut[colourindex][1]),G);
-//        printf("R %f,   G %f,   B %f.   Offset: %f\n",R,G,B,colouroffset);
       //spilt into n sections. specify colours for each section. how far away from top of section is it
       //multiply R,G,B difference by this proportion
-
-      glColor4f(R,G,B,1.0);              // colours option
+      int colourindex = (float)fillcolour*(float)(steps-1);
+      if (colourindex>steps-2) colourindex=steps-2;    // top of the scale is the top of the last section
+      float colouroffset = (float)(colourindex+1)-(fillcolour*(float)(steps-1));     // how far away from higher index (range between 0 and 1).
+      for (int c=0; c<3; c++) rgb[c]=((1.0-colouroffset)*gamut[colourindex+1][c]) + (colouroffset*gamut[colourindex][c]);
       break;
    }
-   case 2:
-      glColor4f(fillcolour,fillcolour,fillcolour,1.0);    // greyscales option
+   case GREYS:
+      rgb[0]=fillcolour; rgb[1]=fillcolour; rgb[2]=fillcolour;    // greyscales option
       break;
-   case 3:
-      glColor4f(fillcolour,0.0,0.0,1.0);              // redscales only
+   case REDS:
+      rgb[0]=fillcolour; rgb[1]=0.0; rgb[2]=0.0;                  // redscales only
       break;
-   case 4:
-      glColor4f(0.0,fillcolour,0.0,1.0);              // greenscales option
+   case GREENS:
+      rgb[0]=0.0; rgb[1]=fillcolour; rgb[2]=0.0;                  // greenscales option
       break;
-   case 5:
-      glColor4f(0.0,0.0,fillcolour,1.0);              // bluescales option
+   case BLUES:
+      rgb[0]=0.0; rgb[1]=0.0; rgb[2]=fillcolour;                  // bluescales option
       break;
-   case 6:
-   {
-#define COLOURSTEPSB 5    //  black, purpleymagenta, red, yellow, white (RGB)
-      int gamut[COLOURSTEPSB][3] = { {0.0,0.0,0.0},{1.0,0.0,1.0},{1.0,0.0,0.0},{1.0,1.0,0.0},{1.0,1.0,1.0} };
+   case RED:
+      rgb[0]=fillcolour<0.01?0.0:1.0; rgb[1]=0.0; rgb[2]=0.0;     // everything is red option except v close to 0 (to get rid of flickery colour in line mode) etc.
+      break;
+   case BLUE:
+      rgb[0]=0.0; rgb[1]=0.0; rgb[2]=fillcolour<0.01?0.0:1.0;     // everything is white option except v close to 0 (to get rid of flickery colour in line mode etc.
+      break;
+   default:
+      return 0;
+   }
+   return 1;
+}
 
-      int colourindex = (float)fillcolour*(float)(COLOURSTEPSB-1);
-      float colouroffset = (float)(colourindex+1)-(fillcolour*(float)(COLOURSTEPSB-1));     // how far away from higher index (range between 0 and 1).
-      float R=((1.0-colouroffset)*(float)gamut[colourindex+1][0]) + (colouroffset*(float)gamut[colourindex][0]);
-      float G=((1.0-colouroffset)*(float)gamut[colourindex+1][1]) + (colouroffset*(float)gamut[colourindex][1]);
-      float B=((1.0-colouroffset)*(float)gamut[colourindex+1][2]) + (colouroffset*(float)gamut[colourindex][2]);
+// sets the 'ink' plotting colour for inputty in the colour map in use, and returns where it sits between the water marks (0.0-1.0)
+float colour_calculator(float inputty, float hiwater, float lowater)
+{
+   float rgb[3];
+   float fillcolour = colour_fill(inputty, hiwater, lowater);
 
-      glColor4f(R,G,B,1.0);              // colours option
-      break;
+   if (colour_rgb(colourused, fillcolour, rgb)) glColor4f(rgb[0],rgb[1],rgb[2],1.0);
+   return fillcolour;
+}
+
+// fill in the colour lookup tables, once at startup
+void build_colour_luts(void)
+{
+   memset(colourlut, 0, sizeof(colourlut));
+   for (int colourmap=1; colourmap<=COLOURMAPS; colourmap++) {
+      for (int step=0; step<COLOURLUTSIZE; step++) {
+         float rgb[3] = {0.0, 0.0, 0.0};
+         GLubyte rgba[4];
+         colour_rgb(colourmap, (float)step/(float)(COLOURLUTSIZE-1), rgb);
+         for (int c=0; c<3; c++) rgba[c] = (GLubyte)((rgb[c]*255.0)+0.5);
+         rgba[3] = 255;
+         memcpy(&colourlut[colourmap][step], rgba, 4);
+      }
    }
-   case 7:
-      glColor4f(fillcolour<0.01?0.0:1.0,0.0,0.0,1.0);          // everything is red option except v close to 0 (to get rid of flickery colour in line mode) etc.
-      break;
-   case 8:
-      glColor4f(0.0,0.0,fillcolour<0.01?0.0:1.0,1.0);          // everything is white option except v close to 0 (to get rid of flickery colour in line mode etc.
-      break;
+   GLubyte alphaonly[4] = {0, 0, 0, 255};
+   memcpy(&colouralpha, alphaonly, 4);
+}
+
+// colour mapping kernels: a whole frame of values to packed RGBA through a colour lookup table, in one pass. Same sums as
+//   colour_fill (clamp to the water marks, scale to 0-1, all 1 if the marks are together), alpha cleared where there's no
+//   data, and each value's fill level stored too. The scale is relative, so PERCENTAGESCALE needs nothing different here.
+void colour_map_scalar(const float *values, int count, float hiwater, float lowater, const unsigned int *lut, unsigned int *rgba, float *fills)
+{
+   float diff = hiwater-lowater;
+   float scale = (diff<=0.0001) ? 0.0 : 1/diff;
+   float base = (diff<=0.0001) ? 1.0 : 0.0;            // if in error, or close to a divide by zero
+   for (int i=0; i<count; i++) {
+      float value = min(max(values[i], lowater), hiwater);
+      float fillcolour = min(max(((value-lowater)*scale)+base, (float)0.0), (float)1.0);
+      fills[i] = fillcolour;
+      rgba[i] = lut[(int)((fillcolour*(float)(COLOURLUTSIZE-1))+(float)0.5)] & ((values[i]>(NOTDEFINEDFLOAT+1)) ? 0xFFFFFFFF : ~colouralpha);
+   }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+void colour_map_sse2(const float *values, int count, float hiwater, float lowater, const unsigned int *lut, unsigned int *rgba, float *fills)
+{
+   float diff = hiwater-lowater;
+   __m128 low = _mm_set1_ps(lowater), high = _mm_set1_ps(hiwater);
+   __m128 scale = _mm_set1_ps((diff<=0.0001) ? 0.0 : 1/diff), base = _mm_set1_ps((diff<=0.0001) ? 1.0 : 0.0);
+   __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0), steps = _mm_set1_ps(COLOURLUTSIZE-1), half = _mm_set1_ps(0.5);
+   __m128 undefined = _mm_set1_ps(NOTDEFINEDFLOAT+1);
+   __m128i alpha = _mm_set1_epi32(colouralpha);
+   int i=0;
+   for (; i+4<=count; i+=4) {
+      __m128 value = _mm_loadu_ps(values+i);
+      __m128i nodata = _mm_castps_si128(_mm_cmpngt_ps(value, undefined));
+      value = _mm_min_ps(_mm_max_ps(value, low), high);
+      __m128 fillcolour = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(value, low), scale), base), zero), one);
+      _mm_storeu_ps(fills+i, fillcolour);
+      int step[4];
+      _mm_storeu_si128((__m128i*)step, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(fillcolour, steps), half)));
+      __m128i colour = _mm_set_epi32(lut[step[3]], lut[step[2]], lut[step[1]], lut[step[0]]);    // no gather before AVX2
+      _mm_storeu_si128((__m128i*)(rgba+i), _mm_andnot_si128(_mm_and_si128(nodata, alpha), colour));
+   }
+   colour_map_scalar(values+i, count-i, hiwater, lowater, lut, rgba+i, fills+i);    // any left over
+}
 
+__attribute__((target("avx2")))
+void colour_map_avx2(const float *values, int count, float hiwater, float lowater, const unsigned int *lut, unsigned int *rgba, float *fills)
+{
+   float diff = hiwater-lowater;
+   __m256 low = _mm256_set1_ps(lowater), high = _mm256_set1_ps(hiwater);
+   __m256 scale = _mm256_set1_ps((diff<=0.0001) ? 0.0 : 1/diff), base = _mm256_set1_ps((diff<=0.0001) ? 1.0 : 0.0);
+   __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0), steps = _mm256_set1_ps(COLOURLUTSIZE-1), half = _mm256_set1_ps(0.5);
+   __m256 undefined = _mm256_set1_ps(NOTDEFINEDFLOAT+1);
+   __m256i alpha = _mm256_set1_epi32(colouralpha);
+   int i=0;
+   for (; i+8<=count; i+=8) {
+      __m256 value = _mm256_loadu_ps(values+i);
+      __m256i nodata = _mm256_castps_si256(_mm256_cmp_ps(value, undefined, _CMP_NGT_UQ));
+      value = _mm256_min_ps(_mm256_max_ps(value, low), high);
+      __m256 fillcolour = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(value, low), scale), base), zero), one);
+      _mm256_storeu_ps(fills+i, fillcolour);
+      __m256i step = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(fillcolour, steps), half));
+      __m256i colour = _mm256_i32gather_epi32((const int*)lut, step, 4);
+      _mm256_storeu_si256((__m256i*)(rgba+i), _mm256_andnot_si256(_mm256_and_si256(nodata, alpha), colour));
    }
+   colour_map_scalar(values+i, count-i, hiwater, lowater, lut, rgba+i, fills+i);    // any left over
+}
+#endif
 
+// the colour mapping kernel in use, the best this CPU can run (select_colour_kernel)
+void (*colour_map_values) (const float *values, int count, float hiwater, float lowater, const unsigned int *lut, unsigned int *rgba, float *fills) = colour_map_scalar;
+const char *colourkernelname = "scalar";
+
+void select_colour_kernel(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      colour_map_values = colour_map_avx2;
+      colourkernelname = "AVX2";
+   } else if (__builtin_cpu_supports("sse2")) {
+      colour_map_values = colour_map_sse2;
+      colourkernelname = "SSE2";
+   }
+#endif
+}
 
+// colour this frame's data: every point to RGBA in the colour map in use
+void colour_frame(void)
+{
+   int colourmap = (colourused>=1 && colourused<=COLOURMAPS) ? colourused : 0;
+   colour_map_values(displaydata, xdim*ydim, highwatermark, lowwatermark, colourlut[colourmap], datacolours, datafills);
+}
 
-   return fillcolour;
+// work out the corners of the tiles of a grid, if it's not laid out like this already. A histogram has its tiles in a row
+//   (the bar heights are set as they are coloured), otherwise they go where convert_index_to_coord says.
+void layout_tile_grid(tilegrid_t *grid, float left, float bottom, float xsize, float ysize, int histogram)
+{
+   if (grid->layout[0]==left && grid->layout[1]==bottom && grid->layout[2]==xsize && grid->layout[3]==ysize
+         && grid->layout[4]==histogram && grid->layout[5]==xdim*ydim) return;
+   for (int i=0; i<xdim*ydim; i++) {
+      int xcord=i, ycord=0;
+      if (!histogram) convert_index_to_coord(i, &xcord, &ycord);
+      GLfloat *corner = &grid->corners[i*8];
+      corner[0]=left+(xcord*xsize);      corner[1]=bottom+(ycord*ysize);        // btm left
+      corner[2]=left+((xcord+1)*xsize);  corner[3]=bottom+(ycord*ysize);        // btm right
+      corner[4]=left+((xcord+1)*xsize);  corner[5]=bottom+((ycord+1)*ysize);    // top right
+      corner[6]=left+(xcord*xsize);      corner[7]=bottom+((ycord+1)*ysize);    // top left
+   }
+   grid->layout[0]=left; grid->layout[1]=bottom; grid->layout[2]=xsize; grid->layout[3]=ysize;
+   grid->layout[4]=histogram; grid->layout[5]=xdim*ydim;
+}
+
+// which data point each tile shows, worked out again only when the orientation is changed
+void map_tile_data(void)
+{
+   int flips = (xflip<<3) | (yflip<<2) | (vectorflip<<1) | rotateflip;
+   if (flips==tiledataflips) return;
+   for (int i=0; i<xdim*ydim; i++) rasterrow[i]=-1;
+   for (int i=0; i<xdim*ydim; i++) {
+      tiledata[i]=coordinate_manipulate(i);
+      rasterrow[tiledata[i]]=i;
+   }
+   tiledataflips=flips;
+}
+
+// RASTER: a point at x for each data point written in history line 'line', drawn from the line's events if they're
+//   intact or else by looking through the whole line. Returns how many points it drew.
+int draw_raster_line (eventhistory_t *eh, historyring_t *data, int line, int x, int rows, float rowheight)
+{
+   int drawn=0;
+   if (!history_current(line)) return 0;       // (an old line: nothing in this one)
+   int64_t first=eh->first[line], end=eh->end[line];
+   if (eh->dense[line] || eh->written-first>(int64_t)eh->mask+1) {
+      for (int j=0; j<rows; j++) {
+         if (history_value(data, line, coordinate_manipulate(j))>(NOTDEFINEDFLOAT+1)) {
+            glVertex2f(x, (int)((float)(j+0.5)*rowheight)+windowBorder);
+            drawn++;
+         }
+      }
+      return drawn;
+   }
+   for (int64_t e=first; e<end; e++) {
+      uint id=eh->events[e & eh->mask].id;
+      int row = (id<(uint)(xdim*ydim)) ? rasterrow[id] : (int)id;    // (only the Discovery demo's raster has more)
+      if (row<0 || row>=rows) continue;
+      glVertex2f(x, (int)((float)(row+0.5)*rowheight)+windowBorder);
+      drawn++;
+   }
+   return drawn;
+}
+
+// colour every tile from this frame's colours (colour_frame). If bars is given (a histogram grid) the top of each bar
+//   is set too, barheight being the height of a full scale bar.
+void colour_tiles(tilegrid_t *bars, float barheight)
+{
+   for (int i=0; i<xdim*ydim; i++) {
+      int point = tiledata[i];
+      unsigned int corner = datacolours[point];    // alpha 0 (not drawn) where there's no data
+      for (int c=0; c<4; c++) ((unsigned int*)tilecolours)[(i*4)+c] = corner;
+      if (bars!=NULL) bars->corners[(i*8)+5] = bars->corners[(i*8)+7] = bars->corners[(i*8)+1]+(datafills[point]*barheight);
+   }
+}
+
+// all the tiles of a grid in one go, in the colours colour_tiles worked out
+void draw_tile_grid(tilegrid_t *grid)
+{
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glEnableClientState(GL_COLOR_ARRAY);
+   glVertexPointer(2, GL_FLOAT, 0, grid->corners);
+   glColorPointer(4, GL_UNSIGNED_BYTE, 0, tilecolours);
+   glEnable(GL_ALPHA_TEST);                // tiles without data are left out
+   glAlphaFunc(GL_GREATER, 0.5);
+   glDrawArrays(GL_QUADS, 0, 4*xdim*ydim);
+   glDisable(GL_ALPHA_TEST);
+   glDisableClientState(GL_COLOR_ARRAY);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glColor4f(0.0,0.0,0.0,1.0);             // current colour is undefined after drawing from a colour array
+}
+
+// INTERPOLATED: put every point's colour into the heatmap image, upload it and draw it as one texture stretched from the centre
+//   of the bottom left tile to the centre of the top right one. Linear filtering blends the colours in between.
+void draw_interpolated_heatmap(float xsize, float ysize)
+{
+   if (heatmaptexture==0) {                // first time: a texture big enough (powers of 2 work on any GL) and where each point goes in it
+      for (heatmaptexturewidth=1; heatmaptexturewidth<xdim; heatmaptexturewidth<<=1);
+      for (heatmaptextureheight=1; heatmaptextureheight<ydim; heatmaptextureheight<<=1);
+      glGenTextures(1, &heatmaptexture);
+      glBindTexture(GL_TEXTURE_2D, heatmaptexture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, heatmaptexturewidth, heatmaptextureheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      for (int i=0; i<xdim*ydim; i++) {
+         int xcord, ycord;
+         convert_index_to_coord(i, &xcord, &ycord);
+         tilepixel[i] = (ycord*xdim)+xcord;
+      }
+   }
+
+   for (int i=0; i<xdim*ydim; i++) heatmapimage[tilepixel[i]] = datacolours[tiledata[i]];
+
+   glBindTexture(GL_TEXTURE_2D, heatmaptexture);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, xdim, ydim, GL_RGBA, GL_UNSIGNED_BYTE, heatmapimage);
+   glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+   glEnable(GL_TEXTURE_2D);
+
+   float left=windowBorder+(xsize/2.0), right=windowBorder+((xdim-0.5)*xsize);                          // point centres
+   float bottom=(windowHeight-windowBorder)-((ydim-0.5)*ysize), top=(windowHeight-windowBorder)-(ysize/2.0);
+   float lefttexel=0.5/heatmaptexturewidth, righttexel=(xdim-0.5)/heatmaptexturewidth;                  // and texel centres
+   float bottomtexel=0.5/heatmaptextureheight, toptexel=(ydim-0.5)/heatmaptextureheight;
+   glBegin(GL_QUADS);
+   glTexCoord2f(lefttexel, bottomtexel);    glVertex2f(left, bottom);     // btm left
+   glTexCoord2f(righttexel, bottomtexel);   glVertex2f(right, bottom);    // btm right
+   glTexCoord2f(righttexel, toptexel);      glVertex2f(right, top);       // top right
+   glTexCoord2f(lefttexel, toptexel);       glVertex2f(left, top);        // top left
+   glEnd();
+   glDisable(GL_TEXTURE_2D);
+}
+
+
+// how many history lines back from 'line' (counting from the start) want drawing this frame: all of the plot if the
+//   ring doesn't hold lines drawn the same way, or it's too far behind
+int scroll_lines_to_draw (scrollplot_t *sp, int64_t line, float *look)
+{
+   int needwidth=plotWidth+(2*SCROLLOVERLAP)+8, needheight=windowHeight-(2*windowBorder)+8;
+   if (sp->texture==0 || sp->width<needwidth || sp->height<needheight) {
+      if (sp->texture==0) glGenTextures(1, &sp->texture);
+      for (sp->width=1; sp->width<needwidth; sp->width<<=1);
+      for (sp->height=1; sp->height<needheight; sp->height<<=1);
+      glBindTexture(GL_TEXTURE_2D, sp->texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // so the ring wraps by itself
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, sp->width, sp->height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+      sp->lastline=-1;
+   }
+   if (memcmp(look, sp->look, sizeof(sp->look))!=0) {
+      memcpy(sp->look, look, sizeof(sp->look));
+      sp->lastline=-1;
+   }
+   if (sp->lastline<0 || line<sp->lastline || line-sp->lastline>=plotWidth-(2*SCROLLOVERLAP)) return plotWidth;
+   return (int)(line-sp->lastline)+(2*SCROLLOVERLAP);
+}
+
+// LINES/EEGSTYLE when only the newest lines are drawn: how many lines back from updateline the latest value of point jj
+//   older than those is (so its trace joins up with what's in the ring), or -1 if it has none in the window
+int older_value (int jj, int updateline, int drawn, float lowest)
+{
+   for (int back=drawn+1; back<=plotWidth && back<HISTORYSIZE; back++) {
+      float value=history_value(&history_data, (updateline+HISTORYSIZE-back)%(HISTORYSIZE), jj);
+      if (value>(NOTDEFINEDFLOAT+1) && value>=lowest) return back;
+   }
+   return -1;
+}
+
+// LINES/EEGSTYLE: a trace's new point is joined to its last one, which may be further back than the lines about to be
+//   drawn (and copied into the ring). Returns how many lines to draw so that all of those joins are drawn in full.
+int lines_to_join (int updateline, int linestodraw, int rows, float lowest)
+{
+   int copied=linestodraw-SCROLLOVERLAP;               // the lines put in the ring are 0..copied back
+   int needed=linestodraw;
+   for (int j=0; j<rows && needed<plotWidth; j++) {
+      int jj=coordinate_manipulate(j);
+      int back;
+      for (back=0; back<=copied; back++) {
+         float value=history_value(&history_data, (updateline+HISTORYSIZE-back)%(HISTORYSIZE), jj);
+         if (value>(NOTDEFINEDFLOAT+1) && value>=lowest) break;
+      }
+      if (back>copied) continue;                        // no new points
+      int older=older_value(jj, updateline, copied, lowest);
+      if (older>0 && older+(2*SCROLLOVERLAP)>needed) needed=older+(2*SCROLLOVERLAP);    // (copied from SCROLLOVERLAP past it)
+   }
+   return (needed>=plotWidth-(2*SCROLLOVERLAP)) ? plotWidth : needed;
+}
+
+// copy the lines just drawn (span back from 'line') into the ring, then draw the whole plot from it over the top.
+//   Line a is at x = right-(line-a), and its pixel column goes in texture column a (mod the width).
+void draw_scrolled_plot (scrollplot_t *sp, int64_t line, int span)
+{
+   int right=windowWidth-windowBorder-keyWidth;
+   int bottom=windowBorder-2, height=windowHeight-(2*windowBorder)+5;      // (wide points and lines go a little over)
+   int64_t from = (span>=plotWidth) ? line-plotWidth-2 : line-span+SCROLLOVERLAP;
+   int mask=sp->width-1;
+
+   glBindTexture(GL_TEXTURE_2D, sp->texture);
+   for (int64_t a=from; a<=line+2; ) {                   // (+2 to get the right hand side of the newest points)
+      int column=(int)(a & mask);
+      int columns=(int)min(line+3-a, (int64_t)(sp->width-column));    // up to the end of the ring
+      glCopyTexSubImage2D(GL_TEXTURE_2D, 0, column, 0, panelx+right-(int)(line-a), panely+bottom, columns, height);    // (window coordinates)
+      a+=columns;
+   }
+   sp->lastline=line;
+
+   float left=right-plotWidth-2;
+   float lefttexel=(float)((line-plotWidth-2) & mask)/sp->width, righttexel=lefttexel+(float)(plotWidth+5)/sp->width;
+   float toptexel=(float)height/sp->height;
+   glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+   glEnable(GL_TEXTURE_2D);
+   glBegin(GL_QUADS);
+   glTexCoord2f(lefttexel, 0);            glVertex2f(left, bottom);               // btm left
+   glTexCoord2f(righttexel, 0);           glVertex2f(right+3, bottom);            // btm right
+   glTexCoord2f(righttexel, toptexel);    glVertex2f(right+3, bottom+height);     // top right
+   glTexCoord2f(lefttexel, toptexel);     glVertex2f(left, bottom+height);        // top left
+   glEnd();
+   glDisable(GL_TEXTURE_2D);
 }
 
 
+// replay timeline, a bar just above the plot: where we are in the recording (what's indexed of it for a legacy file),
+//   and any loop. Clicking on it goes there (see mousehandler).
+#define TIMELINEGAP     4
+#define TIMELINEHEIGHT  8
+
+void draw_replay_timeline (void)
+{
+   float left=windowBorder, right=windowWidth-windowBorder-keyWidth;
+   float bottom=windowHeight-windowBorder+TIMELINEGAP, top=bottom+TIMELINEHEIGHT;
+   float length=(float) max(replayheader.lasttime, (int64_t)1);
+   int64_t position=replay_position();
+
+   glColor4f(0.6,0.6,0.6,1.0);                         // the recording
+   glBegin(GL_QUADS);
+   glVertex2f(left, bottom);
+   glVertex2f(right, bottom);
+   glVertex2f(right, top);
+   glVertex2f(left, top);
+   glEnd();
+   if (replayloopstart>=0) {                            // the loop (to the end if it's not been marked yet)
+      float loopleft=left+((right-left)*(float)replayloopstart/length);
+      float loopright=(replayloopend>=0) ? left+((right-left)*(float)replayloopend/length) : right;
+      glColor4f(0.3,0.3,0.9,1.0);
+      glBegin(GL_QUADS);
+      glVertex2f(loopleft, bottom);
+      glVertex2f(loopright, bottom);
+      glVertex2f(loopright, top);
+      glVertex2f(loopleft, top);
+      glEnd();
+   }
+   float here=left+((right-left)*min((float)position/length, (float)1.0));    // and where we are
+   glColor4f(0.0,0.0,0.0,1.0);
+   glBegin(GL_QUADS);
+   glVertex2f(here-2, bottom-2);
+   glVertex2f(here+2, bottom-2);
+   glVertex2f(here+2, top+2);
+   glVertex2f(here-2, top+2);
+   glEnd();
+
+   char stringy[]="Replay %3.1fs of %3.1fs%s  (Home/End, Page Up/Down, ',' '.' step, '(' ')' loop)";
+   printgl(left, top+TIMELINEGAP, GLUT_BITMAP_HELVETICA_12, stringy, (float)position/1000000.0, (float)replayheader.lasttime/1000000.0,
+           freezedisplay!=0 ? " paused" : "");
+}
+
+// if window coordinates x,y (as given to mousehandler) are on the replay timeline, set target to the recording time there
+int replay_timeline_hit (int x, int y, int64_t *target)
+{
+   float left=windowBorder, right=windowWidth-windowBorder-keyWidth;
+   float bottom=windowHeight-windowBorder+TIMELINEGAP, top=bottom+TIMELINEHEIGHT;
+   if (replaying==0 || printlabels==0 || fullscreen!=0) return 0;
+   if (x<left || x>right || (windowHeight-y)<bottom-TIMELINEGAP || (windowHeight-y)>top+TIMELINEGAP) return 0;
+   *target = (int64_t)((double)replayheader.lasttime*(double)(x-left)/(double)(right-left));
+   return 1;
+}
+
 
 void displayb(void)                            // not currently used
 {
@@ -1443,6 +4160,10 @@ void displayb(void)                            // not currently used
 // display function, called whenever the display window needs redrawing
 void display(void)
 {
+   if (numpanels>1 && drawingpanels==0) {
+      display_panels();                   // each panel in its place (and its state)
+      return;
+   }
 
    int64_t nowtime;
    float timeperindex = displayWindow / (float) plotWidth;    // time in seconds per history index in use
@@ -1487,6 +4208,10 @@ void display(void)
 //   printgl((windowWidth/2)-278,windowHeight-50,GLUT_BITMAP_TIMES_ROMAN_24,stringy2, MAXFRAMERATE,(1000*counter)/(howlongrunning/1000));        // Print Title of Graph with fps stats
       char stringy3[]="Colour Map (1,2,3..), Mode: (t)iled, (h)istogram, (i)nterpolation, (l)ines, (r)aster, Menu: right click.";
       printgl((windowWidth/2)-250,windowHeight-80,GLUT_BITMAP_HELVETICA_12,stringy3);        // Print subtitle of Graph
+      if (replaying) {
+         draw_replay_timeline();
+         glColor4f(0.0,0.0,0.0,1.0);                         // Black Text for Labels
+      }
       // Graph Title
 
       char stringy4[]="%d";
@@ -1623,18 +4348,29 @@ void display(void)
    }   // titles and labels are only printed if border is big enough
 
 
+   int64_t taken;
+   float *published=take_immediate(&taken);    // the decoders' latest copy of their data, we only draw (and clamp) our own copy of it
+   if (dc.decaying) {
+      struct timeval stopwatchus;
+      gettimeofday(&stopwatchus,NULL);
+      int64_t framenow = (freezedisplay==1) ? freezetime : (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+      float sincetaken = (framenow>taken) ? expf(dc.decayperus*(float)(framenow-taken)) : 1.0;    // (all decayed to when it was taken)
+      for (int i=0; i<(xdim*ydim); i++) displaydata[i] = (published[i]>(NOTDEFINEDFLOAT+1)) ? published[i]*sincetaken : published[i];
+   } else {
+      memcpy(displaydata, published, xdim*ydim*sizeof(float));
+   }
    for(int i=0; i<(xdim*ydim); i++) {
       //if(immediate_data[i]>(NOTDEFINEDFLOAT+1)) immediate_data[i]=immediate_data[i];    // set data to be worked upon superfluous
       //else immediate_data[i]=NOTDEFINEDFLOAT;                                            // out of range  superfluous
       //if (immediate_data[i] == NOTDEFINEDINT) immediate_data[i]=NOTDEFINEDFLOAT;                // if not out of range
       //else immediate_data[i]=(float)immediate_data[i]/(float)pow(2.0,FIXEDPOINT);    // scale data to something sensible for colour gamut
       //printf("Data: %d, POWER: %f  = %f\n", immediate_data[i],(float)pow(2,FIXEDPOINT), immediate_data[i]);
-      if(immediate_data[i]>(NOTDEFINEDFLOAT+1)) {    // is valid
-         if (immediate_data[i]>MAXDATAFLOAT) immediate_data[i]=MAXDATAFLOAT;            // check: can't increment above saturation level 
-         if (immediate_data[i]<MINDATAFLOAT) immediate_data[i]=MINDATAFLOAT;            // check: can't decrement below saturation level 
+      if(displaydata[i]>(NOTDEFINEDFLOAT+1)) {    // is valid
+         if (displaydata[i]>MAXDATAFLOAT) displaydata[i]=MAXDATAFLOAT;            // check: can't increment above saturation level 
+         if (displaydata[i]<MINDATAFLOAT) displaydata[i]=MINDATAFLOAT;            // check: can't decrement below saturation level 
          if (DYNAMICSCALE) {
-            if (immediate_data[i]>highwatermark && spinnakerboardipset) highwatermark=immediate_data[i];    // only alter the high water mark when using dynamic scaling & data received
-            if (immediate_data[i]<lowwatermark && spinnakerboardipset) lowwatermark=immediate_data[i];    // only alter the low water mark when using dynamic scaling & data received
+            if (displaydata[i]>highwatermark && spinnakerboardipset) highwatermark=displaydata[i];    // only alter the high water mark when using dynamic scaling & data received
+            if (displaydata[i]<lowwatermark && spinnakerboardipset) lowwatermark=displaydata[i];    // only alter the low water mark when using dynamic scaling & data received
          }
       }
    }  // scale all the values to plottable range
@@ -1645,27 +4381,42 @@ void display(void)
    float ysize = ((float)(windowHeight-(2*windowBorder))/ydim);        // changed for dynamic reshaping
    float tileratio=xsize/ysize;
 
-   for(int i=0; i<(xdim*ydim); i++) {                  //
-      int ii=coordinate_manipulate(i);                // if any manipulation of how the data is to be plotted is required, do it
+   // the tiles themselves: laid out once, coloured each frame, and drawn a grid at a time
+   int minigridshown = (DISPLAYMINIPLOT && fullscreen==0);
+   int maingridshown = (displaymode==HISTOGRAM || displaymode==TILED);
+   map_tile_data();
+   if (minigridshown || maingridshown || displaymode==INTERPOLATED) colour_frame();
+   if (minigridshown || maingridshown) {
+      float plotheight = (float)(windowHeight-(2*windowBorder));
+      if (displaymode==HISTOGRAM) layout_tile_grid(&maingrid, windowBorder, windowBorder, (float)(plotWidth)/(xdim*ydim), plotheight, 1);    // Histogram means all across X axis
+      else if (maingridshown) layout_tile_grid(&maingrid, windowBorder, windowBorder, xsize, ysize, 0);
+      colour_tiles((displaymode==HISTOGRAM)?&maingrid:NULL, plotheight);    // Histogram means height of block adjusts based on value
+      if (minigridshown) {
+         float miniysize=max((float)1.0,(float)(windowBorder-(6*gap))/(float)ydim);
+         float minixsize=max((float)1.0,miniysize*tileratio);              // draw little / mini tiled version in btm left - pixel size
+         layout_tile_grid(&minigrid, 2*gap, 2*gap, minixsize, miniysize, 0);
+         draw_tile_grid(&minigrid);
+      }
+      if (maingridshown) draw_tile_grid(&maingrid);
+   }
+
+   // then anything drawn over particular tiles: the selected tile, values in blocks, histogram labels
+   int tileoverlays = (livebox!=-1) || ((SIMULATION==RATEPLOT||SIMULATION==RATEPLOTLEGACY) && INTERACTION)
+                      || (plotvaluesinblocks!=0 && maingridshown) || (displaymode==HISTOGRAM && printlabels && fullscreen==0);
+
+   for(int i=0; tileoverlays && i<(xdim*ydim); i++) {                  //
+      int ii=tiledata[i];                             // if any manipulation of how the data is to be plotted is required, it's done
 
       int xcord, ycord;
       convert_index_to_coord(i, &xcord, &ycord);      // find out the (x,y) coordinates of where to plot this data
 
-      float magnitude = colour_calculator(immediate_data[ii],highwatermark,lowwatermark);            // work out what colour we should plot - sets 'ink' plotting colour
+      float magnitude = colour_fill(displaydata[ii],highwatermark,lowwatermark);            // where this is on the colour scale
 
       // if required, plot tiled mini version in bottom left
       if (DISPLAYMINIPLOT) {
          if (fullscreen==0) {
             float ysize=max((float)1.0,(float)(windowBorder-(6*gap))/(float)ydim);
             float xsize=max((float)1.0,ysize*tileratio);                    // draw little / mini tiled version in btm left - pixel size
-            if (immediate_data[ii]>(NOTDEFINEDFLOAT+1)) {                        // only plot if data is valid
-               glBegin(GL_QUADS);                            // draw little tiled version in btm left
-               glVertex2f((2*gap)+(xcord*xsize), (2*gap)+(ycord*ysize));          //btm left
-               glVertex2f((2*gap)+((xcord+1)*xsize), (2*gap)+(ycord*ysize));     //btm right
-               glVertex2f((2*gap)+((xcord+1)*xsize), (2*gap)+((ycord+1)*ysize));      // top right
-               glVertex2f((2*gap)+(xcord*xsize), (2*gap)+((ycord+1)*ysize));     // top left
-               glEnd();                                   // this plots the basic quad box filled as per colour above
-            }
 
             if (livebox==i) {                            // draw outlines for selected box in little / mini version
                glLineWidth(1.0);
@@ -1713,18 +4464,8 @@ void display(void)
          ysize = magnitude*((float)(windowHeight-(2*windowBorder)));        // Histogram means height of block adjusts based on value
       }
 
-      magnitude = colour_calculator(immediate_data[ii],highwatermark,lowwatermark);            // work out what colour we should plot - sets 'ink' plotting colour
-
       if (displaymode==HISTOGRAM || displaymode==TILED) {                    // basic plot if not using triangular interpolation
          char stringnums[]="%3.2f";
-         if (immediate_data[ii]>(NOTDEFINEDFLOAT+1)) {
-            glBegin(GL_QUADS);
-            glVertex2f(windowBorder+(xcord*xsize), windowBorder+(ycord*ysize));  //btm left
-            glVertex2f(windowBorder+((xcord+1)*xsize), windowBorder+(ycord*ysize)); //btm right
-            glVertex2f(windowBorder+((xcord+1)*xsize), windowBorder+((ycord+1)*ysize));  // top right
-            glVertex2f(windowBorder+(xcord*xsize), windowBorder+((ycord+1)*ysize)); // top left
-            glEnd();                           // this plots the basic quad box filled as per colour above
-         }
 
          if (SIMULATION==RATEPLOT|| SIMULATION==RATEPLOTLEGACY) {
             if (INTERACTION) {
@@ -1753,11 +4494,11 @@ void display(void)
          }
 
          if(plotvaluesinblocks!=0 && xsize>8) {                                    // if we want to plot numbers / values in blocks (& blocks big enough)
-            if (immediate_data[ii]>(NOTDEFINEDFLOAT+1)) {
+            if (displaydata[ii]>(NOTDEFINEDFLOAT+1)) {
                if (magnitude>0.6) glColor4f(0.0,0.0,0.0,1.0);
                else glColor4f(1.0,1.0,1.0,1.0);            // choose if light or dark labels
-               if (displaymode==HISTOGRAM) printglstroke (windowBorder+5+((xcord+0.5)*xsize), windowBorder+((ycord+0.5)*ysize), 0.08, 90, stringnums,immediate_data[ii]);    // sideways if histogram
-               else printglstroke (windowBorder-20+((xcord+0.5)*xsize), windowBorder-6+((ycord+0.5)*ysize), 0.12, 0, stringnums,immediate_data[ii]);                // normal
+               if (displaymode==HISTOGRAM) printglstroke (windowBorder+5+((xcord+0.5)*xsize), windowBorder+((ycord+0.5)*ysize), 0.08, 90, stringnums,displaydata[ii]);    // sideways if histogram
+               else printglstroke (windowBorder-20+((xcord+0.5)*xsize), windowBorder-6+((ycord+0.5)*ysize), 0.12, 0, stringnums,displaydata[ii]);                // normal
                //printf("immediate_data[%d] = %f.\n",ii,immediate_data[ii]);
             }
          }
@@ -1815,48 +4556,8 @@ void display(void)
    }
 
 
-   // this (below) plots the triangular interpolated view. Each point smoothly blends fill between 3 vertex values 2 are real points (edges),
-   // and the third a pseudo vertex in the centre of a block (average between 4 surrounding real vertices).
-   if (displaymode==INTERPOLATED) {
-
-      for(int i=0; i<ydim-1; i++) {                      // (y coord)
-         int yc = ydim-2-i;
-         for(int j=0; j<xdim-1; j++) {                     // (x coord)
-            int lowerleftvertex=coordinate_manipulate(convert_coord_to_index(j,i));    // if any manupulation of how the data is to be plotted is required, do it
-            int upperleftvertex=coordinate_manipulate(convert_coord_to_index(j,i+1));
-            int upperrightvertex=coordinate_manipulate(convert_coord_to_index(j+1,i+1));
-            int lowerrightvertex=coordinate_manipulate(convert_coord_to_index(j+1,i));
-            //float pseudoaverageb = (immediate_data[lowerleftvertex] + immediate_data[upperleftvertex] + immediate_data[upperrightvertex] + immediate_data[lowerrightvertex] )/4.0;
-            float pseudoaverage = ( (immediate_data[lowerleftvertex]>(NOTDEFINEDFLOAT+1) ? immediate_data[lowerleftvertex] : 0)
-                                    + (immediate_data[upperleftvertex]>(NOTDEFINEDFLOAT+1) ? immediate_data[upperleftvertex] : 0)
-                                    + (immediate_data[upperrightvertex]>(NOTDEFINEDFLOAT+1) ? immediate_data[upperrightvertex] : 0)
-                                    + (immediate_data[lowerrightvertex]>(NOTDEFINEDFLOAT+1) ? immediate_data[lowerrightvertex] : 0) )/4.0;
-            // if data is invalid then take it out of the average
-            //printf("Just Added %f vs. Conditional %f:%f\n     ll:%f, ul:%f, ur:%f, lr:%f\n\n",pseudoaverageb, pseudoaverage, immediate_data[lowerleftvertex], immediate_data[upperleftvertex],immediate_data[upperrightvertex],immediate_data[lowerrightvertex]);
-            glBegin(GL_TRIANGLE_FAN);
-            colour_calculator(pseudoaverage,highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize)+(j*xsize),(windowHeight-windowBorder)-((ysize)+(yc*ysize)));            // pseudo vertex
-            //printf("Pseudo X=%f, Y=%f. \n",100.0+(xsize/2.0)+(j*xsize),100.0+(ysize/2.0)+(i*ysize));
-            colour_calculator(immediate_data[upperleftvertex],highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize/2.0)+(j*xsize),(windowHeight-windowBorder)-((ysize/2.0)+(yc*ysize)));        // upper left vertex
-            //printf("upper left vertex X=%f, Y=%f. \n",100.0+(j*xsize),100.0+(i*ysize));
-            colour_calculator(immediate_data[lowerleftvertex],highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize/2.0)+(j*xsize),(windowHeight-windowBorder)-((ysize/2.0)+((yc+1)*ysize)));    // lower left vertex
-            //printf("lower left vertex X=%f, Y=%f. \n",100.0+(j*xsize),100.0+((i+1)*ysize));
-            colour_calculator(immediate_data[lowerrightvertex],highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize/2.0)+((j+1)*xsize),(windowHeight-windowBorder)-((ysize/2.0)+((yc+1)*ysize)));    // lower right vertex
-            //printf("lower right vertex X=%f, Y=%f. \n",100.0+((j+1)*xsize),100.0+((i+1)*ysize));
-            colour_calculator(immediate_data[upperrightvertex],highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize/2.0)+((j+1)*xsize),(windowHeight-windowBorder)-((ysize/2.0)+(yc*ysize)));    // upper right vertex
-            //printf("upper right vertex X=%f, Y=%f. \n",100.0+((j+1)*xsize),100.0+(i*ysize));
-            colour_calculator(immediate_data[upperleftvertex],highwatermark,lowwatermark);
-            glVertex2f(windowBorder+(xsize/2.0)+(j*xsize),(windowHeight-windowBorder)-((ysize/2.0)+(yc*ysize)));        // upper left vertex
-            glEnd();   // this plots the triangle fan (a 4 triangle grad)
-            //}
-         }
-      }  // we build pseudo points between each 4 points (xsize-1*ysize-1) - average out the values and use this when drawing our triangles
-
-   }
+   // this (below) plots the interpolated view, smoothly blending between the colours of neighbouring points.
+   if (displaymode==INTERPOLATED) draw_interpolated_heatmap(xsize, ysize);
 
 
 
@@ -2164,27 +4865,45 @@ void display(void)
 
       //printf("Here, with timeperindex:%f, and y_scaling_factor:%f. Display Window = %f fps.\n",timeperindex,y_scaling_factor,displayWindow);
 
-      int updateline=((nowtime-starttimez)/(int64_t)(timeperindex*1000000)) % (HISTORYSIZE);    // which index is being plotted now (on the right hand side)
+      int64_t currentline=((nowtime-starttimez)/(int64_t)(timeperindex*1000000));    // history lines since the start
+      int updateline=currentline % (HISTORYSIZE);    // which index is being plotted now (on the right hand side)
 
       if (updateline<0 || updateline>HISTORYSIZE) {
          printf("Error line 2093: Updateline out of bounds: %d. Times - Now:%lld  Start:%lld \n",updateline, (long long int)nowtime, (long long int)starttimez);        // CPDEBUG
       } else {
-         int linestoclear = updateline-lasthistorylineupdated;            // work out how many lines have gone past without activity.
-         if (linestoclear<0 && (updateline+500)>lasthistorylineupdated) linestoclear=0;        // to cover any underflow when resizing plotting window smaller (wrapping difference will be <500)
-         if (linestoclear<0) linestoclear = (updateline+HISTORYSIZE)-lasthistorylineupdated;     // if has wrapped then work out the true value
-         int numberofdatapoints=xdim*ydim;
-         for (int i=0; i<linestoclear; i++) {
-            //printf("%d - %d =  %d (with WindowWidth: %d)\n",updateline, lasthistorylineupdated, linestoclear, windowWidth);
-            for (int j=0; j<numberofdatapoints; j++) history_data[(1+i+lasthistorylineupdated)%(HISTORYSIZE)][j]=INITZERO?0.0:NOTDEFINEDFLOAT;  // nullify data in the quiet period
-            if (win2) {
-               numberofdatapoints=MAXRASTERISEDNEURONS;                // bespoke for Discovery demo
-               for (int j=0; j<numberofdatapoints; j++) history_data_set2[(1+i+lasthistorylineupdated)%(HISTORYSIZE)][j]=INITZERO?0.0:NOTDEFINEDFLOAT;  // nullify data in the quiet period
-            }
+         historynow=currentline;        // lines between the last with data and now read as empty as they're stamped with older times
+         if (timeperindex!=historytimeperindex) {    // zoomed or resized, so the lines are for a different time
+            historytimeperindex=timeperindex;
+            refillline=currentline;                  // a decoder refills them (the history is theirs to write)
+            refilltimeperindex=timeperindex;
+            __sync_synchronize();
+            refillwanted=1;
+            wake_decoders();
          }
-         // Upon Plot screen. All between lastrowupdated and currenttimerow will be nothing - clear between last and to now.  If lastrowupdated = currenttimerow, nothing to nullify.
       }
 
-      int itop1 = updateline-plotWidth;        // final entry to print (needs a max)
+      float targetdotsize=(float)(windowHeight-(2*windowBorder))/((float)maxneuridrx);
+
+      //printf("DotSize: %f, maxneuird:%f. \n",targetdotsize,((float)maxneuridrx));
+
+      if (targetdotsize>4) targetdotsize=4.0;
+      if (targetdotsize<1) targetdotsize=1.0;
+
+      float workingwithdata;                            // data value being manipulated/studied
+      int numberofrasterplots=xdim*ydim;
+      if (windowToUpdate==win2) numberofrasterplots=maxneuridrx;        // bespoke for Discovery demo
+
+      // only the lines that are new since the last frame are drawn, unless the plot has changed its look
+      scrollplot_t *scroll=&scrollplots[windowToUpdate==win2];
+      int scaled=(displaymode!=RASTER);                 // (the raster doesn't depend on the water marks)
+      float look[16]={ (float)windowWidth, (float)windowHeight, (float)windowBorder, (float)keyWidth, (float)plotWidth,
+                       (float)displaymode, (float)colourused, (float)((xflip<<3) | (yflip<<2) | (vectorflip<<1) | rotateflip),
+                       (float)numberofrasterplots, targetdotsize, timeperindex, scaled ? (float)highwatermark : 0,
+                       scaled ? (float)lowwatermark : 0, (float)historyrewrites, (float)INITZERO, 0 };
+      int linestodraw=scroll_lines_to_draw(scroll, currentline, look);
+      if (scaled && linestodraw<plotWidth) linestodraw=lines_to_join(updateline, linestodraw, numberofrasterplots, displaymode==EEGSTYLE ? lowwatermark : NOTDEFINEDFLOAT);
+
+      int itop1 = updateline-linestodraw;        // final entry to print (needs a max)
       int itop2 = (HISTORYSIZE);                            // begin with assumption no need for any wraparound
       //printf("1) updateline: %i, itop1:%d, itop2:%d\n",updateline, itop1,itop2);
       if (itop1<0) {                                // if final entry has wrapped around array
@@ -2195,55 +4914,30 @@ void display(void)
       //printf("2)updateline: %i, itop1:%d, itop2:%d\n",updateline, itop1,itop2);
 
       glColor4f(0.0,0.0,1.0,1.0);                        // Will plot in blue
-
-      float targetdotsize=(float)(windowHeight-(2*windowBorder))/((float)maxneuridrx);
-
-      //printf("DotSize: %f, maxneuird:%f. \n",targetdotsize,((float)maxneuridrx));
-
-      if (targetdotsize>4) targetdotsize=4.0;
-      if (targetdotsize<1) targetdotsize=1.0;
       glPointSize(targetdotsize);
 
-      float workingwithdata;                            // data value being manipulated/studied
-      int numberofrasterplots=xdim*ydim;
-      if (windowToUpdate==win2) numberofrasterplots=maxneuridrx;        // bespoke for Discovery demo
-
       if (displaymode==RASTER) {
          uint *spikesperxcoord = new uint[plotWidth];
          for(int j=0; j<plotWidth; j++) spikesperxcoord[j]=0;
          uint maxspikerate = 200;
+         eventhistory_t *events=&historyevents;
+         historyring_t *rasterdata=&history_data;
+         if (windowToUpdate==win2) {                    // bespoke for Discovery demo
+            events=&historyevents2;
+            rasterdata=&history_data_set2;
+         }
+         y_scaling_factor=(float)(windowHeight-(2*windowBorder))/(float)(numberofrasterplots);    // how many pixels per neuron ID
+         map_tile_data();                               // (for rasterrow)
          glBegin(GL_POINTS); // TODO if targetdotsize>=4 - draw lines?
-         for(int j=0; j<numberofrasterplots; j++) {
-            int jj=coordinate_manipulate(j);            // if any manipulation of how the data is to be plotted is required, do it
-            for(int i=updateline; i>=itop1; i--) {          // For each column of elements to the right / newer than the current line
-               workingwithdata=history_data[i][jj];
-               if (windowToUpdate==win2) workingwithdata=history_data_set2[i][jj];        // bespoke for Discovery demo
-               if (workingwithdata>(NOTDEFINEDFLOAT+1)) {
-                  y_scaling_factor=(float)(windowHeight-(2*windowBorder))/(float)(numberofrasterplots);    // how many pixels per neuron ID
-                  int y=(int) ((float)(j+0.5)*(float)y_scaling_factor)+windowBorder;
-                  int x=(windowWidth-windowBorder-keyWidth)-((updateline-i)*x_scaling_factor);
-                  glVertex2f(x,y); // TODO change to lines for low counts? 1 of 2 (targetdotsize).
-                  // start at y-(targetdotsize/2) end at y+(targetdotsize/2)
-                  spikesperxcoord[x-windowBorder]++;
-                  //if (spikesperxcoord[x-windowBorder]>maxspikerate) maxspikerate=spikesperxcoord[x-windowBorder];
-                  //printf("i:%u: Data:%f.\n",i,workingwithdata);
-               }
-            }
-            for(int i=(HISTORYSIZE-1); i>itop2; i--) {          // For each column of elements to the right / newer than the current line
-               workingwithdata=history_data[i][jj];
-               if (windowToUpdate==win2) workingwithdata=history_data_set2[i][jj];        // bespoke for Discovery demo
-               if (workingwithdata>(NOTDEFINEDFLOAT+1)) {
-                  y_scaling_factor=(float)(windowHeight-(2*windowBorder))/(float)(numberofrasterplots);    // how many pixels per neuron ID
-                  int y=(int) ((float)(j+0.5)*(float)y_scaling_factor)+windowBorder;
-                  int x=(windowWidth-windowBorder-keyWidth)-((updateline+((HISTORYSIZE)-i))*x_scaling_factor);
-                  glVertex2f(x,y); // TODO change to lines for low counts? 2 of 2. (targetdotsize)
-                  // start at y-(targetdotsize/2) end at y+(targetdotsize/2)
-                  spikesperxcoord[x-windowBorder]++;
-                  //if (spikesperxcoord[x-windowBorder]>maxspikerate) maxspikerate=spikesperxcoord[x-windowBorder];
-                  //printf("i:%u: Data:%f.\n",i,workingwithdata);
-               }
-            }
-
+         for(int i=updateline; i>=itop1; i--) {          // For each column of elements to the right / newer than the current line
+            int x=(windowWidth-windowBorder-keyWidth)-((updateline-i)*x_scaling_factor);
+            int spikes=draw_raster_line(events, rasterdata, i, x, numberofrasterplots, y_scaling_factor);
+            if (x>=windowBorder && x-windowBorder<plotWidth) spikesperxcoord[x-windowBorder]+=spikes;
+         }
+         for(int i=(HISTORYSIZE-1); i>itop2; i--) {          // For each column of elements to the right / newer than the current line
+            int x=(windowWidth-windowBorder-keyWidth)-((updateline+((HISTORYSIZE)-i))*x_scaling_factor);
+            int spikes=draw_raster_line(events, rasterdata, i, x, numberofrasterplots, y_scaling_factor);
+            if (x>=windowBorder && x-windowBorder<plotWidth) spikesperxcoord[x-windowBorder]+=spikes;
          }
          glEnd();
 
@@ -2270,12 +4964,12 @@ void display(void)
          glLineWidth(2.0);
          for(int j=0; j<numberofrasterplots; j++) {
             int jj=coordinate_manipulate(j);            // if any manipulation of how the data is to be plotted is required, do it
-            float magnitude = colour_calculator(immediate_data[jj],highwatermark,lowwatermark);
+            float magnitude = colour_calculator(displaydata[jj],highwatermark,lowwatermark);
             glBegin(GL_LINE_STRIP);
             for(int i=updateline; i>=itop1; i--) {          // For each column of elements to the right / newer than the current line
                workingwithdata=INITZERO?0.0:NOTDEFINEDFLOAT;            // default to invalid
                //if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj]/(float)pow(2.0,FIXEDPOINT);
-               if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj];
+               if (history_value(&history_data, i, jj)>(NOTDEFINEDFLOAT+1)) workingwithdata=history_value(&history_data, i, jj);
                if (workingwithdata>(NOTDEFINEDFLOAT+1)) {
                   int y=(int)(((float)windowBorder+((workingwithdata-lowwatermark)*y_scaling_factor)));
                   //printf("y:%u: Orig:%f, DataWorkedWith:%f, LowWater=%f\n",i,history_data[i][jj],workingwithdata,lowwatermark);
@@ -2290,7 +4984,7 @@ void display(void)
             for(int i=(HISTORYSIZE-1); i>itop2; i--) {      // For each column of elements to the right / newer than the current line
                workingwithdata=INITZERO?0.0:NOTDEFINEDFLOAT;            // default to invalid
                //if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj]/(float)pow(2.0,FIXEDPOINT);
-               if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj];
+               if (history_value(&history_data, i, jj)>(NOTDEFINEDFLOAT+1)) workingwithdata=history_value(&history_data, i, jj);
                if (workingwithdata>(NOTDEFINEDFLOAT+1)) {
                   int y=(int)(((float)windowBorder+((workingwithdata-lowwatermark)*y_scaling_factor)));
                   if (y>(windowHeight-windowBorder)) y=(windowHeight-windowBorder);
@@ -2300,6 +4994,13 @@ void display(void)
                   //printf("i: %d, x: %d.\n",i,(windowWidth-windowBorder-keyWidth)-((HISTORYSIZE)-i));
                }
             }
+            int back=(linestodraw<plotWidth) ? older_value(jj, updateline, linestodraw, NOTDEFINEDFLOAT) : -1;
+            if (back>0) {                               // join up with the trace in the ring
+               int y=(int)(((float)windowBorder+((history_value(&history_data, (updateline+HISTORYSIZE-back)%(HISTORYSIZE), jj)-lowwatermark)*y_scaling_factor)));
+               if (y>(windowHeight-windowBorder)) y=(windowHeight-windowBorder);
+               if (y<windowBorder) y=windowBorder;
+               glVertex2f((windowWidth-windowBorder-keyWidth)-(back*x_scaling_factor),y);
+            }
             glEnd();
          }
          glLineWidth(1.0);
@@ -2317,12 +5018,12 @@ void display(void)
             glVertex2f(windowBorder+plotWidth+10,windowBorder+((int)(eegrowheight*(float)j)));
             glEnd();
             glLineWidth(2.0);
-            float magnitude = colour_calculator(immediate_data[jj],highwatermark,lowwatermark);
+            float magnitude = colour_calculator(displaydata[jj],highwatermark,lowwatermark);
             glBegin(GL_LINE_STRIP);
             for(int i=updateline; i>=itop1; i--) {              // For each column of elements to the right / newer than the current line
                workingwithdata=INITZERO?0.0:NOTDEFINEDFLOAT;                // default to invalid
                //if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj]/(float)pow(2.0,FIXEDPOINT);
-               if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj];
+               if (history_value(&history_data, i, jj)>(NOTDEFINEDFLOAT+1)) workingwithdata=history_value(&history_data, i, jj);
                if (workingwithdata>=lowwatermark) {
                   int y=(int)(((float)windowBorder+((workingwithdata-lowwatermark)*y_scaling_factor)));
                   y+=(int)(eegrowheight*(float)j);        // EEGSTYLE difference to LINES: add on row offset up screen
@@ -2337,7 +5038,7 @@ void display(void)
             for(int i=(HISTORYSIZE-1); i>itop2; i--) {          // For each column of elements to the right / newer than the current line
                workingwithdata=INITZERO?0.0:NOTDEFINEDFLOAT;                // default to invalid
                //if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj]/(float)pow(2.0,FIXEDPOINT);
-               if (history_data[i][jj]>(NOTDEFINEDFLOAT+1)) workingwithdata=history_data[i][jj];
+               if (history_value(&history_data, i, jj)>(NOTDEFINEDFLOAT+1)) workingwithdata=history_value(&history_data, i, jj);
                if (workingwithdata>=lowwatermark) {
                   int y=(int)(((float)windowBorder+((workingwithdata-lowwatermark)*y_scaling_factor)));
                   y+=(int)(eegrowheight*(float)j);        // EEGSTYLE difference to LINES: add on row offset up screen
@@ -2348,6 +5049,14 @@ void display(void)
                   //printf("i: %d, x: %d.\n",i,(windowWidth-windowBorder-keyWidth)-((HISTORYSIZE)-i));
                }
             }
+            int back=(linestodraw<plotWidth) ? older_value(jj, updateline, linestodraw, lowwatermark) : -1;
+            if (back>0) {                               // join up with the trace in the ring
+               int y=(int)(((float)windowBorder+((history_value(&history_data, (updateline+HISTORYSIZE-back)%(HISTORYSIZE), jj)-lowwatermark)*y_scaling_factor)));
+               y+=(int)(eegrowheight*(float)j);
+               if (y>(windowHeight-windowBorder)) y=(windowHeight-windowBorder);
+               if (y<windowBorder) y=windowBorder;
+               glVertex2f((windowWidth-windowBorder-keyWidth)-(back*x_scaling_factor),y);
+            }
             glEnd();
          }
          glColor4f(0.7,0.7,0.7,1.0);
@@ -2357,6 +5066,7 @@ void display(void)
          glVertex2f(windowBorder+plotWidth+10,windowBorder+((int)(eegrowheight*(float)numberofrasterplots)));
          glEnd();
       }
+      draw_scrolled_plot(scroll, currentline, linestodraw);
 
 
    }
@@ -2364,9 +5074,6 @@ void display(void)
 //}
 
 
-   if (DECAYPROPORTION>0.0) { // CP - if used!
-      if(freezedisplay==0) for (int i=0; i<(xdim*ydim); i++) if (immediate_data[i]>(NOTDEFINEDFLOAT+1)) immediate_data[i]*=DECAYPROPORTION;   // puts a decay on the data per frame plotted
-   }
 
 
 
@@ -2397,13 +5104,16 @@ void display(void)
    }
 #endif
 
+   if (drawingpanels) return;    // (display_panels finishes the frame once they're all drawn)
 
    glutSwapBuffers();             // no flickery gfx
    somethingtoplot=0;            // indicate we have finished plotting
+   framesdrawn++;
 } // display
 
 
 
+
 // called whenever the display window is resized
 void reshape(int width, int height)
 {
@@ -2436,12 +5146,131 @@ void reshape(int width, int height)
    glLoadIdentity();
    somethingtoplot=1;                // indicate we will need to refresh the screen
 
-} // reshape
+} // reshape
+
+
+// with several panels: each is drawn by display() into its own part of the window, clipped to it, switched to its state
+void display_panels(void)
+{
+   int windowto = windowToUpdate;
+   drawingpanels=1;
+   glEnable(GL_SCISSOR_TEST);
+   for (int p=0; p<numpanels; p++) {
+      switch_panel(p);
+      panelx=panels[p].x;
+      panely=panels[p].y;
+      glViewport(panelx, panely, panels[p].width, panels[p].height);
+      glScissor(panelx, panely, panels[p].width, panels[p].height);    // (so its clear and labels stay in its part)
+      glMatrixMode(GL_PROJECTION);
+      glLoadIdentity();
+      glOrtho(0.0, panels[p].width, 0.0, panels[p].height, -50.0, 50.0);
+      glMatrixMode(GL_MODELVIEW);
+      windowToUpdate=windowto;
+      display();
+   }
+   switch_panel(focusedpanel);    // (where the renderer's other callbacks act)
+   glDisable(GL_SCISSOR_TEST);
+   drawingpanels=0;
+   panelx=panely=0;
+
+   glutSwapBuffers();             // no flickery gfx
+   somethingtoplot=0;            // indicate we have finished plotting
+   framesdrawn++;
+}
+
+// with several panels: the one at window position (x,y) (from the top left, as GLUT gives them), -1 if none
+int panel_at (int x, int y)
+{
+   for (int p=0; p<numpanels; p++)
+      if (x>=panels[p].x && x<panels[p].x+panels[p].width && y>=panel_top(p) && y<panel_top(p)+panels[p].height) return p;
+   return -1;
+}
+
+// lay the panels out in a grid over the window, and tell each its size as if it were the window
+void reshape_panels(int width, int height)
+{
+   panelwindowheight=height;
+   int panelwidth=width/panelcolumns, panelheight=height/panelrows;
+   for (int p=0; p<numpanels; p++) {
+      panels[p].width=panelwidth;
+      panels[p].height=panelheight;
+      panels[p].x=(p%panelcolumns)*panelwidth;
+      panels[p].y=(panelrows-1-(p/panelcolumns))*panelheight;
+      switch_panel(p);
+      reshape(panelwidth, panelheight);
+   }
+   switch_panel(focusedpanel);
+}
+
+// GLUT callbacks with several panels: run on the state of the panel the mouse is over (or was last over, for menus),
+//   with coordinates from its top left
+template <void (*CALLBACK)(unsigned char, int, int)> void panel_keys (unsigned char key, int x, int y)
+{
+   if (numpanels<=1) {
+      CALLBACK(key, x, y);
+      return;
+   }
+   if (panel_at(x, y)>=0) focusedpanel=panel_at(x, y);
+   switch_panel(focusedpanel);
+   CALLBACK(key, x-panels[focusedpanel].x, y-panel_top(focusedpanel));
+}
+
+template <void (*CALLBACK)(int, int, int)> void panel_special (int key, int x, int y)
+{
+   if (numpanels<=1) {
+      CALLBACK(key, x, y);
+      return;
+   }
+   if (panel_at(x, y)>=0) focusedpanel=panel_at(x, y);
+   switch_panel(focusedpanel);
+   CALLBACK(key, x-panels[focusedpanel].x, y-panel_top(focusedpanel));
+}
+
+template <void (*CALLBACK)(int, int, int, int)> void panel_mouse (int button, int state, int x, int y)
+{
+   if (numpanels<=1) {
+      CALLBACK(button, state, x, y);
+      return;
+   }
+   if (panel_at(x, y)<0) return;          // (between panels)
+   focusedpanel=panel_at(x, y);
+   switch_panel(focusedpanel);
+   CALLBACK(button, state, x-panels[focusedpanel].x, y-panel_top(focusedpanel));
+}
+
+template <void (*CALLBACK)(int)> void panel_menu (int value)
+{
+   if (numpanels>1) switch_panel(focusedpanel);
+   CALLBACK(value);
+}
+
+// the menus act on the panel the mouse was last over
+void track_panel (int x, int y)
+{
+   if (panel_at(x, y)>=0) focusedpanel=panel_at(x, y);
+}
 
 
 // Called when arrow keys (and some others) are pressed
 void specialDown(int key, int x, int y)
 {
+   if (replaying) {                                    // timeline controls
+      switch(key)
+      {
+      case GLUT_KEY_HOME:
+         replay_seek(0, 0);
+         break;
+      case GLUT_KEY_END:
+         replay_seek(0x7FFFFFFFFFFFFFFFLL, 0);       // (the replay stops at the end)
+         break;
+      case GLUT_KEY_PAGE_UP:
+         replay_seek(replay_position()-replay_page(), 0);
+         break;
+      case GLUT_KEY_PAGE_DOWN:
+         replay_seek(replay_position()+replay_page(), 0);
+         break;
+      }
+   }
    if (SIMULATION==RATEPLOT|| SIMULATION==RATEPLOTLEGACY) {
       if (INTERACTION) {
          int xc, yc;
@@ -2645,6 +5474,18 @@ void keyDown (unsigned char key, int x, int y)
       needtorebuildmenu=1;;
       break;
    }
+   case ',':
+      replay_seek(replay_position()-replay_frame(), 1);    // step back a frame (paused)
+      break;
+   case '.':
+      replay_seek(replay_position()+replay_frame(), 1);    // step forward a frame (paused)
+      break;
+   case '(':
+      if (replaying) replay_mark_loop_start();
+      break;
+   case ')':
+      if (replaying) replay_mark_loop_end();
+      break;
    case '#':
       if (plotvaluesinblocks==0) {
          plotvaluesinblocks = 1;
@@ -2678,11 +5519,11 @@ void keyDown (unsigned char key, int x, int y)
       if (displaymode==RASTER || displaymode==LINES || ((SIMULATION==RATEPLOT|| SIMULATION==RATEPLOTLEGACY) && rasterpopulation!=-1)) {
          // only if a scrolling mode in operation on the main plot!  (or (surrounded by ifdefs) its a 2ndary rasterised plot)
       case '>':
-         displayWindow+=0.1;
-         if (displayWindow>100) displayWindow=100;
+         displayWindow+=(displayWindow<1) ? 0.1 : displayWindow*0.25;    // (in proportion once the window is long)
+         if (displayWindow>maxdisplaywindow()) displayWindow=maxdisplaywindow();
          break;
       case '<':
-         displayWindow-=0.1;
+         displayWindow-=(displayWindow<=1) ? 0.1 : displayWindow*0.2;
          if (displayWindow<0.1) displayWindow=0.1;
          break;
       }
@@ -2994,6 +5835,11 @@ void keyUp (unsigned char key, int x, int y)
 // called when something happs with the moosie
 void mousehandler(int button, int state, int x, int y)
 {
+   int64_t timelinetarget;
+   if (state==GLUT_DOWN && button==GLUT_LEFT_BUTTON && replay_timeline_hit(x, y, &timelinetarget)) {
+      replay_seek(timelinetarget, 0);        // go to where was clicked on the replay timeline
+      return;
+   }
    if(state==GLUT_DOWN && button==GLUT_LEFT_BUTTON) {
       for (int boxer=0; boxer<3; boxer++) {
          int boxsize=40, gap=10;
@@ -3285,7 +6131,9 @@ void MouseMotion(int x, int y)
 void idleFunction()
 {
    if (needtorebuildmenu==1 && menuopen == 0) {
+      if (numpanels>1) switch_panel(focusedpanel);    // (the menus show the panel they'll act on)
       filemenu();
+      replaymenu();
       rebuildmenu();    // if menu is not open we can make changes
       needtorebuildmenu=0;
    }
@@ -3296,7 +6144,7 @@ void idleFunction()
    int64_t nowtime,howlongrunning, howlongtowait;            // for timings
 
 
-   if (plotWidth!=windowWidth-(2*windowBorder)-keyWidth) printf("NOT SAME: windowWidth-(2*windowBorder)-keyWidth=%d, plotWidth=%d.\n",windowWidth-(2*windowBorder)-keyWidth,plotWidth);
+   if (numpanels==1 && plotWidth!=windowWidth-(2*windowBorder)-keyWidth) printf("NOT SAME: windowWidth-(2*windowBorder)-keyWidth=%d, plotWidth=%d.\n",windowWidth-(2*windowBorder)-keyWidth,plotWidth);
 
    gettimeofday(&stopwatchus,NULL);                // grab current time
    howlongtowait = ((int64_t)starttimez+((int64_t)counter*(int64_t)usecperframe)) - (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);    // how long in us until we need to draw the next frame
@@ -3329,6 +6177,11 @@ void idleFunction()
        }
    */     //keepalive message no longer used (5th Oct)
 
+   if (STATSINTERVAL>0 && nowtime > (laststatstime + ((int64_t)STATSINTERVAL*1000000))) {
+      laststatstime = nowtime;                 // periodically report how each stage of the pipeline is keeping up
+      print_ingest_stats();
+   }
+
    if (printpktgone!=0 && nowtime > (printpktgone + 1000000)) {
       printpktgone = 0;                    // if packet send message has been displayed for more than 1s, stop its display
       somethingtoplot=1;                    // force refresh screen
@@ -3358,6 +6211,7 @@ void myinit (void)
    glColor3f (1.0, 1.0, 1.0);
    glShadeModel (GL_SMOOTH);   // permits nice shading between plot points for interpolation if required
    filemenu();
+   replaymenu();
    transformmenu();
    modemenu();
    colmenu();
@@ -3378,6 +6232,10 @@ void myfilemenu (int value)
          outputfileformat=2;
          open_or_close_output_file();    //  or neurotools format
       }
+      if (value==menuitem++) {
+         outputfileformat=3;
+         open_or_close_output_file();    //  or binary spike records
+      }
    } else {                                    // savefile open
       if (writingtofile==2)    {
          if (value==menuitem++) {
@@ -3400,10 +6258,11 @@ void filemenu (void)
 {
    int menuitem=1;
    glutDestroyMenu(filesubmenu);
-   filesubmenu = glutCreateMenu(myfilemenu);
+   filesubmenu = glutCreateMenu(panel_menu<myfilemenu>);
    if (outputfileformat==0) {                    // no savefile open
       glutAddMenuEntry("Save Input Data in .spinn format (replayable)",menuitem++);        // start saving data in spinn
       glutAddMenuEntry("Save Input Spike Data as write-only .neuro Neurotools format",menuitem++);//  or neurotools format
+      glutAddMenuEntry("Save Input Spike Data as binary .spikes records",menuitem++);//  or binary spike records
    } else {                                        // savefile open
       if (writingtofile==2)    glutAddMenuEntry("Resume Saving Data to file",menuitem++);    //   and paused
       else glutAddMenuEntry("Pause Saving Data to file",menuitem++);            //   or running
@@ -3412,6 +6271,36 @@ void filemenu (void)
 }
 
 
+void myreplaymenu (int value)
+{
+   int menuitem=1;
+   if (value==menuitem++) replay_seek(0, 0);
+   if (value==menuitem++) replay_seek(replay_position()-replay_page(), 0);
+   if (value==menuitem++) replay_seek(replay_position()+replay_page(), 0);
+   if (value==menuitem++) replay_seek(0x7FFFFFFFFFFFFFFFLL, 0);
+   if (value==menuitem++) replay_seek(replay_position()-replay_frame(), 1);
+   if (value==menuitem++) replay_seek(replay_position()+replay_frame(), 1);
+   if (value==menuitem++) replay_mark_loop_start();
+   if (value==menuitem++) replay_mark_loop_end();
+   needtorebuildmenu=1;
+}
+
+void replaymenu (void)
+{
+   int menuitem=1;
+   glutDestroyMenu(replaysubmenu);
+   replaysubmenu = glutCreateMenu(panel_menu<myreplaymenu>);
+   glutAddMenuEntry("(Home) Jump to the Start",menuitem++);
+   glutAddMenuEntry("(Page Up) Back a Plot Width",menuitem++);
+   glutAddMenuEntry("(Page Down) Forward a Plot Width",menuitem++);
+   glutAddMenuEntry("(End) Jump to the End",menuitem++);
+   glutAddMenuEntry("(,) Step Back a Frame",menuitem++);
+   glutAddMenuEntry("(.) Step Forward a Frame",menuitem++);
+   glutAddMenuEntry("(() Loop from Here",menuitem++);
+   if (replayloopend>=0) glutAddMenuEntry("()) Stop Looping",menuitem++);
+   else glutAddMenuEntry("()) Loop back from Here",menuitem++);
+}
+
 void mytransformmenu (int value)
 {
    int menuitem=1;
@@ -3432,7 +6321,7 @@ void transformmenu (void)
 {
    int menuitem=1;
    glutDestroyMenu(transformsubmenu);
-   transformsubmenu = glutCreateMenu(mytransformmenu);
+   transformsubmenu = glutCreateMenu(panel_menu<mytransformmenu>);
    glutAddMenuEntry("(X) Mirror (left to right swop)",menuitem++);
    glutAddMenuEntry("(Y) Reflect (top to bottom swop)",menuitem++);
    glutAddMenuEntry("(V) Vector Swop (Full X+Y Reversal)",menuitem++);
@@ -3459,7 +6348,7 @@ void colmenu (void)
 {
    int menuitem=1;
    glutDestroyMenu(coloursubmenu);
-   coloursubmenu = glutCreateMenu(mycolmenu);
+   coloursubmenu = glutCreateMenu(panel_menu<mycolmenu>);
    glutAddMenuEntry("(1) MultiColoured",menuitem++);
    glutAddMenuEntry("(2) Greys",menuitem++);
    glutAddMenuEntry("(3) Reds",menuitem++);
@@ -3488,7 +6377,7 @@ void modemenu (void)
 {
    int menuitem=1;
    glutDestroyMenu(modesubmenu);
-   modesubmenu = glutCreateMenu(mymodemenu);
+   modesubmenu = glutCreateMenu(panel_menu<mymodemenu>);
    glutAddMenuEntry("(T)iled",menuitem++);
    glutAddMenuEntry("(H)istogram",menuitem++);
    glutAddMenuEntry("(I)nterpolated",menuitem++);
@@ -3502,7 +6391,7 @@ void rebuildmenu (void)
 //    printf("hello rasterpop:%d, livebox:%d.\n",rasterpopulation,livebox);
    int menuitem=1;
    glutDestroyMenu(RHMouseMenu);
-   RHMouseMenu = glutCreateMenu(mymenu);
+   RHMouseMenu = glutCreateMenu(panel_menu<mymenu>);
 
    if (SIMULATION==RATEPLOT|| SIMULATION==RATEPLOTLEGACY) { 
       //if (displaymode==HISTOGRAM || displaymode==TILED) {
@@ -3523,6 +6412,7 @@ void rebuildmenu (void)
    glutAddSubMenu("Transform Plot",transformsubmenu);
    glutAddSubMenu("Colours",coloursubmenu);
    glutAddSubMenu("Save Data Operations",filesubmenu);
+   if (replaying) glutAddSubMenu("Replay",replaysubmenu);
 
    glutAddMenuEntry("-----",menuitem++); // segmenter
    if (displaymode==HISTOGRAM || displaymode==TILED) {
@@ -3664,6 +6554,7 @@ void logifmenuopen(int status, int x, int y)
    else {
       if (needtorebuildmenu==1) {
          filemenu();
+         replaymenu();
          rebuildmenu();
       }
       menuopen = 0;            // if menu is not open we can make changes
@@ -3685,18 +6576,37 @@ void safelyshut(void)
 
       open_or_close_output_file();        // Close down any open output file
       if (fileinput!=NULL) fclose(fileinput);    // deal with input file
+      print_ingest_stats();                       // how did the receiver cope
 
       // free up mallocs made for dynamic arrays
       if (SIMULATION == RATEPLOT || RATEPLOTLEGACY) free(biascurrent);
 
       //free(immediate_data);  // superfluous
 
-      for (ii=0; ii<HISTORYSIZE; ii++) free(history_data[ii]);
-      free(history_data);
-      for (ii=0; ii<HISTORYSIZE; ii++) free(history_data_set2[ii]);
-      free(history_data_set2);
+      free(history_data.data);
+      free(history_data_set2.data);
+      free(historyepoch);
+      free_pyramid();
+      free_event_history(&historyevents);
+      free_event_history(&historyevents2);
 
       free(immediate_data);
+      free(immediatetime);
+      for (int i=0; i<3; i++) free(immediatesnap[i]);
+      free(displaydata);
+      free(maingrid.corners);
+      free(minigrid.corners);
+      free(tilecolours);
+      free(tiledata);
+      free(rasterrow);
+      free(heatmapimage);
+      free(tilepixel);
+      free(datacolours);
+      free(datafills);
+      if (retinalut!=NULL) free(retinalut);
+      if (keyranges!=NULL) free(keyranges);
+      if (recordchunk!=NULL) free(recordchunk);
+      if (recordindex!=NULL) free(recordindex);
 
       for (ii=0; ii<XDIMENSIONS*YDIMENSIONS; ii++) free(maplocaltoglobal[ii]);
       free(maplocaltoglobal);
@@ -3709,6 +6619,719 @@ void safelyshut(void)
    exit(0);                // kill program dead
 }
 
+// -----------------------------------------------------------------------------------------------------
+// PACMAN report loading. placement_by_vertex.rpt gives each population's slices and the core each is placed on,
+// edge_routing_info.rpt the cores that actually send spikes (with the slice they carry). A core's routing key is
+// x<<24 | y<<16 | p<<11, with the neuron in the bottom 11 bits, so together these give key -> population & atom.
+
+int find_population(const char *name)
+{
+   for (int i=0; i<numpacmanpopulations; i++) if (strcmp(pacmanpopulations[i].name, name)==0) return i;
+   return -1;
+}
+
+int add_population(const char *name, int size)
+{
+   int population=find_population(name);
+   if (population>=0) return population;
+   if (numpacmanpopulations>=MAXPOPULATIONS) return -1;
+   strncpy(pacmanpopulations[numpacmanpopulations].name, name, 63);
+   pacmanpopulations[numpacmanpopulations].name[63]=0;
+   pacmanpopulations[numpacmanpopulations].size=size;
+   return numpacmanpopulations++;
+}
+
+// the key range holding this routing key, searching the first (sorted) ranges entries. NULL if it isn't one of ours. O(log n)
+keyrange_t* search_key_ranges(uint key, int ranges)
+{
+   int lo=0, hi=ranges-1;
+   while (lo<=hi) {                         // find the last range starting at or below key
+      int mid=(lo+hi)/2;
+      if (keyranges[mid].key<=key) lo=mid+1;
+      else hi=mid-1;
+   }
+   if (hi>=0 && (key&keyranges[hi].mask)==keyranges[hi].key) return &keyranges[hi];
+   return NULL;
+}
+
+int compare_key_ranges(const void *a, const void *b)
+{
+   uint keya=((keyrange_t*)a)->key, keyb=((keyrange_t*)b)->key;
+   return (keya>keyb)-(keya<keyb);
+}
+
+void add_key_range(int x, int y, int p, int population, int firstatom, int lastatom)
+{
+   static int allocated=0;
+   if (numkeyranges==allocated) {
+      allocated = allocated?allocated*2:256;
+      keyranges = (keyrange_t*) realloc(keyranges, allocated*sizeof(keyrange_t));
+   }
+   keyranges[numkeyranges].key = (x<<24) | (y<<16) | (p<<11);
+   keyranges[numkeyranges].mask = 0xFFFFF800;
+   keyranges[numkeyranges].population = population;
+   keyranges[numkeyranges].sliceoffset = firstatom;
+   keyranges[numkeyranges].atoms = lastatom-firstatom+1;
+   numkeyranges++;
+}
+
+// parse the two reports from directory reportdir. Returns the number of key ranges found.
+int load_pacman_reports(const char *reportdir)
+{
+   char filename[300], line[512], name[64];
+   int population=-1, confirmed=0, added=0, size, first, last, x, y, p;
+   FILE *reportfile;
+
+   snprintf(filename, sizeof(filename), "%s/placement_by_vertex.rpt", reportdir);
+   if ((reportfile = fopen(filename, "r")) == NULL) {
+      printf("Can't read the PACMAN placement report %s.\n", filename);
+      return 0;
+   }
+   while (fgets(line, sizeof(line), reportfile) != NULL) {
+      if (sscanf(line, "**** Vertex: '%63[^']'", name) == 1) population = add_population(name, 0);
+      else if (population>=0 && sscanf(line, "Pop sz: %d", &size) == 1) pacmanpopulations[population].size = size;
+      else if (population>=0 && sscanf(line, " Slice %d:%d (%*d atoms) on core (%d, %d, %d)", &first, &last, &x, &y, &p) == 5)
+         add_key_range(x, y, p, population, first, last);
+   }
+   fclose(reportfile);
+   qsort(keyranges, numkeyranges, sizeof(keyrange_t), compare_key_ranges);
+
+   snprintf(filename, sizeof(filename), "%s/edge_routing_info.rpt", reportdir);
+   if ((reportfile = fopen(filename, "r")) != NULL) {        // optional, but confirms which cores send and adds any missed
+      int sorted=numkeyranges;
+      while (fgets(line, sizeof(line), reportfile) != NULL) {
+         if (sscanf(line, "**** Edge '%*[^']', from vertex: '%63[^']' (size: %d)", name, &size) == 2) population = add_population(name, size);
+         else if (population>=0 && sscanf(line, "Sub-edge from core (%d, %d, %d), atoms %d:%d", &x, &y, &p, &first, &last) == 5) {
+            uint key = (x<<24) | (y<<16) | (p<<11);
+            keyrange_t *range = search_key_ranges(key, sorted);      // the placement part, anything new is added (once) after it
+            if (range!=NULL && range->population==population && range->sliceoffset==first) {
+               confirmed++;
+            } else if (range==NULL) {
+               int seen=0;
+               for (int i=sorted; i<numkeyranges; i++) if (keyranges[i].key==key) seen=1;
+               if (!seen) { add_key_range(x, y, p, population, first, last); added++; }
+            } else {
+               printf("Routing report has core (%d, %d, %d) as %s atoms %d:%d, placement disagrees.\n", x, y, p, name, first, last);
+            }
+         }
+      }
+      fclose(reportfile);
+      qsort(keyranges, numkeyranges, sizeof(keyrange_t), compare_key_ranges);
+   }
+
+   printf("PACMAN reports: %d populations on %d cores (%d sub-edges confirmed by the routing report, %d cores added from it).\n",
+          numpacmanpopulations, numkeyranges, confirmed, added);
+   return numkeyranges;
+}
+
+// RETINA2: size the key lookup to the chips the keys can come from. That's a board's 8x8, but BOARDS offsets move a board's
+//   keys up to (chipx+7, chipy+7), and the reports place cores across the whole machine. (Read from BOARDS itself, as
+//   the boards are only resolved once we start listening.) Sized once, as every panel's lookup is indexed the same way.
+void size_retina_lut(void)
+{
+   static int sized=0;
+   if (sized++) return;
+   for (const char *at=strchr(BOARDS, ':'); at!=NULL; at=strchr(at, ':')) {
+      int chipx=0, chipy=0;
+      sscanf(at, ":%d:%d", &chipx, &chipy);
+      if (chipx>=0 && chipx+8>retinalutchipsx) retinalutchipsx=(chipx>248)?256:chipx+8;
+      if (chipy>=0 && chipy+8>retinalutchipsy) retinalutchipsy=(chipy>248)?256:chipy+8;
+      at+=strcspn(at, ", ");                   // (on to the next board)
+   }
+   for (int i=0; i<numkeyranges; i++) {
+      int x=keyranges[i].key>>24, y=(keyranges[i].key>>16)&0xFF;
+      if (x>=retinalutchipsx) retinalutchipsx=x+1;
+      if (y>=retinalutchipsy) retinalutchipsy=y+1;
+   }
+}
+
+// RETINA2: fill the key lookup table from the reports for the named population, in place of the POPULATION_CORES file
+void build_retina_lut_from_reports(const char *populationname)
+{
+   int population=find_population(populationname);
+   if (population<0) {
+      printf("Population '%s' isn't in the PACMAN reports, choose from:", populationname);
+      for (int i=0; i<numpacmanpopulations; i++) printf(" '%s'", pacmanpopulations[i].name);
+      printf("\n");
+      return;
+   }
+   size_retina_lut();
+   retinalut = (int*) malloc(retinalutchipsx*retinalutchipsy*32*sizeof(int));
+   for (int i=0; i<retinalutchipsx*retinalutchipsy*32; i++) retinalut[i]=-1;
+   int mappedcores=0;
+   for (int i=0; i<numkeyranges; i++) {
+      uint x=keyranges[i].key>>24, y=(keyranges[i].key>>16)&0xFF, p=(keyranges[i].key>>11)&0x1F;
+      if (keyranges[i].population!=population) continue;
+      if (x>=(uint)retinalutchipsx || y>=(uint)retinalutchipsy) {    // (another panel sized the lookup before the reports were read)
+         printf("Core (%u, %u, %u) of '%s' is outside the %dx%d chip lookup, ignored.\n", x, y, p, populationname, retinalutchipsx, retinalutchipsy);
+         continue;
+      }
+      retinalut[(((x*retinalutchipsy) + y)<<5) | p] = keyranges[i].sliceoffset;
+      mappedcores++;
+   }
+   printf("RETINA2 key lookup built from reports: %d cores of '%s' (%d neurons) map to the display.\n",
+          mappedcores, populationname, pacmanpopulations[population].size);
+}
+
+// RETINA2: flatten the board map, population chip list and per core offsets loaded from the POPULATION_CORES file
+//   into one table indexed by the chip x, chip y and core (5 bits) fields of a routing key.
+//   Decoding a spike is then a single lookup plus the neuron number. The file describes the board at (0,0), so a board
+//   BOARDS offsets elsewhere is in the table's range but its chips are unmapped.
+void build_retina_lut(int populationchips)
+{
+   size_retina_lut();
+   retinalut = (int*) malloc(retinalutchipsx*retinalutchipsy*32*sizeof(int));
+   for (int i=0; i<retinalutchipsx*retinalutchipsy*32; i++) retinalut[i]=-1;
+   int mappedcores=0;
+   for (int x=0; x<8; x++) {
+      for (int y=0; y<8; y++) {
+         int chip_num = BOARD_CONF[x][y];
+         int virtual_chip = (chip_num>=0 && chip_num<48) ? POPULATION_CHIP[chip_num] : -1;
+         for (int core=0; core<32; core++) {
+            int corebase = -1;
+            if (virtual_chip>=0 && virtual_chip<populationchips && core>=1 && core<=16) corebase = POPULATION_CORE[virtual_chip][core-1];
+            retinalut[(((x*retinalutchipsy) + y)<<5) | core] = corebase;
+            if (corebase>=0) mappedcores++;
+         }
+      }
+   }
+   printf("RETINA2 key lookup built: %d cores map to the display.\n", mappedcores);
+}
+
+// the decode benchmarks' synthetic packets, shaped for the configured SIMULATION
+#define BENCHPACKETS 64
+unsigned char benchbuffer[BENCHPACKETS][sizeof(struct sdp_msg)];
+int benchlength[BENCHPACKETS];
+struct sockaddr_in benchfrom;
+
+// make the benchmark packets, returns the words of data in all of them
+int64_t build_bench_packets(void)
+{
+   int64_t wordsdecoded=0;
+   int chipsx = (XCHIPS>0)?XCHIPS:1, chipsy = (YCHIPS>0)?YCHIPS:1;
+   int corespop = EACHCHIPX*EACHCHIPY;
+   if (corespop<1 || corespop>16) corespop=16;
+
+   srand(1);                                 // same packets every run so numbers are comparable
+   memset(&benchfrom, 0, sizeof(benchfrom));
+   benchfrom.sin_addr = spinnakerboardip;
+   for (int p=0; p<BENCHPACKETS; p++) {
+      struct sdp_msg *msg = (sdp_msg*) benchbuffer[p];
+      struct spinnpacket *spinn = (spinnpacket*) benchbuffer[p];
+      int words = 64;                        // a typical spike packet
+      memset(benchbuffer[p], 0, sizeof(struct sdp_msg));
+      msg->srce_addr = ((rand()%chipsx)<<8) + (rand()%chipsy);
+      msg->srce_port = 1+(rand()%corespop);
+      if (SIMULATION==RETINA) {
+         spinn->cmd_rc = htonl(STIM_IN_SPINN_PACKET);
+         for (int i=0; i<words; i++) spinn->data[i] = rand()&0xFF;
+         benchlength[p] = 18+(words*4);
+         wordsdecoded += words;
+         continue;
+      }
+      if (SIMULATION==SEVILLERETINA) {
+         msg->cmd_rc = 0x4943;
+         msg->arg1 = rand()%XDIMENSIONS;     // column
+         msg->arg2 = YDIMENSIONS;            // rows
+         words = YDIMENSIONS/2;              // 2 pixels per word
+      } else if (SIMULATION==RATEPLOT || SIMULATION==MAR12RASTER) {
+         msg->cmd_rc = (SIMULATION==RATEPLOT)?64:80;
+         for (int i=0; i<words; i+=2) {      // key, value pairs
+            msg->data[i] = ((rand()%chipsx)<<24) + ((rand()%chipsy)<<16) + ((rand()%corespop)<<11);
+            msg->data[i+1] = rand()%100;
+         }
+      } else if (SIMULATION==RATEPLOTLEGACY) {
+         msg->cmd_rc = 257;
+         msg->arg2 = 63;                     // interval ms
+         msg->arg3 = 100;                    // neurons in population
+         words = 1;
+         msg->data[0] = rand()%100;
+      } else if (SIMULATION==HEATMAP || SIMULATION==CPUUTIL || SIMULATION==INTEGRATORFG || SIMULATION==CHIPTEMP || SIMULATION==LINKCHECK) {
+         words = EACHCHIPX*EACHCHIPY;        // a chip's worth of values
+         msg->arg1 = rand()&0x3F;            // links seen (LINKCHECK)
+         msg->arg2 = 9300; msg->arg3 = 30000;// sensors (CHIPTEMP)
+         for (int i=0; i<words; i++) msg->data[i] = rand()&0xFFFFF;
+      } else if (SIMULATION==COCHLEA) {
+         words = 1;                          // only the first key is used
+         msg->data[0] = ((1+(rand()%16))<<11) + (rand()&0xFF);
+      } else {                               // RETINA2, SPIKERVC: routing keys
+         for (int i=0; i<words; i++) msg->data[i] = ((rand()%8)<<24) + ((rand()%8)<<16) + ((1+(rand()%16))<<11) + (rand()&0xFF);
+      }
+      benchlength[p] = 26+(words*4);
+      wordsdecoded += words;
+   }
+   return wordsdecoded;
+}
+
+// decode benchmark: times the decode stage on its own (no socket, no display) by feeding it synthetic packets
+//   shaped for the configured SIMULATION, then prints the throughput. Invoked with -benchdecode on the command line.
+void benchmark_decode(int64_t packets)
+{
+   struct timeval stopwatchus;
+   int64_t wordsdecoded = build_bench_packets();
+
+   gettimeofday(&stopwatchus,NULL);
+   int64_t benchstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   int64_t simtime = starttimez;
+   for (int64_t n=0; n<packets; n++) {
+      simtime += 100;                        // packets arrive every 100us of simulated time, so history lines roll as normal
+      process_sdp_packet(benchbuffer[n%BENCHPACKETS], benchlength[n%BENCHPACKETS], &benchfrom, simtime);
+   }
+   gettimeofday(&stopwatchus,NULL);
+   float elapsed = (float)((((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec) - benchstart)/1000000.0;
+   if (elapsed<=0) elapsed=0.000001;
+   wordsdecoded = (wordsdecoded*packets)/BENCHPACKETS;
+
+   printf("Decode benchmark, SIMULATION %d: %lld packets (%lld words) in %3.3fs = %3.0f packets/s, %3.2f Mwords/s.\n",
+          SIMULATION, (long long int)packets, (long long int)wordsdecoded, elapsed, (float)packets/elapsed, (float)wordsdecoded/(elapsed*1000000.0));
+}
+
+typedef struct {
+   int thread, threads;
+   int64_t packets;
+   int sharded;
+} benchthread_t;
+
+// one of the scaling benchmark's decoders: takes its turn at the packets, as the receiver hands them round the rings
+void* benchmark_decode_thread (void *ptr)
+{
+   benchthread_t *bench = (benchthread_t*) ptr;
+   if (bench->sharded) decodeshard = &spikeshards[bench->thread];
+   for (int64_t n=bench->thread; n<bench->packets; n+=bench->threads) {
+      int64_t simtime = starttimez+((n+1)*100);    // (every 100us of simulated time, whichever thread has the packet)
+      if (decodeshard!=NULL) {
+         process_sdp_packet(benchbuffer[n%BENCHPACKETS], benchlength[n%BENCHPACKETS], &benchfrom, simtime);
+      } else {
+         pthread_mutex_lock(&decodelock);
+         process_sdp_packet(benchbuffer[n%BENCHPACKETS], benchlength[n%BENCHPACKETS], &benchfrom, simtime);
+         pthread_mutex_unlock(&decodelock);
+      }
+   }
+   if (decodeshard!=NULL) {
+      pthread_mutex_lock(&decodelock);
+      merge_shard(decodeshard);
+      pthread_mutex_unlock(&decodelock);
+   }
+   return NULL;
+}
+
+// decode thread scaling benchmark: the same packets shared between 1 to maxthreads decode threads, taking turns under
+//   decodelock for each packet and (if the SIMULATION counts spikes) counting into their own shards. Invoked with
+//   -benchthreads on the command line.
+void benchmark_threads(int maxthreads, int64_t packets)
+{
+   struct timeval stopwatchus;
+   int64_t wordsdecoded = (build_bench_packets()*packets)/BENCHPACKETS;
+   pthread_t *threads = (pthread_t*) malloc(maxthreads*sizeof(pthread_t));
+   benchthread_t *bench = (benchthread_t*) malloc(maxthreads*sizeof(benchthread_t));
+
+   printf("Decode thread scaling benchmark, SIMULATION %d: %lld packets (%lld words) shared by 1 to %d decode threads.\n",
+          SIMULATION, (long long int)packets, (long long int)wordsdecoded, maxthreads);
+   if (merge_shard==NULL) printf("(this SIMULATION's decoders don't count spikes, so always take turns under decodelock)\n");
+   else alloc_spike_shards(maxthreads, dc.numberofpoints);
+   printf("%8s %18s %18s\n", "threads", "locked Mwords/s", "sharded Mwords/s");
+
+   for (int t=1; t<=maxthreads; t++) {
+      float rate[2] = {0, 0};
+      for (int sharded=0; sharded<=(merge_shard!=NULL ? 1 : 0); sharded++) {
+         forget_history();                     // (so each run starts with the same empty history)
+         gettimeofday(&stopwatchus,NULL);
+         int64_t benchstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+         for (int i=0; i<t; i++) {
+            bench[i].thread = i;
+            bench[i].threads = t;
+            bench[i].packets = packets;
+            bench[i].sharded = sharded;
+            pthread_create(&threads[i], NULL, benchmark_decode_thread, &bench[i]);
+         }
+         for (int i=0; i<t; i++) pthread_join(threads[i], NULL);
+         gettimeofday(&stopwatchus,NULL);
+         float elapsed = (float)((((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec) - benchstart)/1000000.0;
+         if (elapsed<=0) elapsed=0.000001;
+         rate[sharded] = (float)wordsdecoded/(elapsed*1000000.0);
+      }
+      if (merge_shard!=NULL) printf("%8d %18.2f %18.2f\n", t, rate[0], rate[1]);
+      else printf("%8d %18.2f %18s\n", t, rate[0], "-");
+   }
+   free(threads);
+   free(bench);
+}
+
+// key distribution by name, -1 if we don't know it
+int parse_key_distribution(const char *name)
+{
+   if (strcmp(name, "uniform") == 0) return KEYSUNIFORM;
+   if (strcmp(name, "hotspot") == 0) return KEYSHOTSPOT;
+   if (strcmp(name, "sweep") == 0) return KEYSSWEEP;
+   return -1;
+}
+
+static inline uint generator_random (uint *seed)    // xorshift: cheap, and the same sequence every run
+{
+   *seed ^= *seed<<13;
+   *seed ^= *seed>>17;
+   *seed ^= *seed<<5;
+   return *seed;
+}
+
+static inline uint generator_pick_key (uint *seed, int64_t packetnumber)
+{
+   uint pick = generator_random(seed);
+   uint band = (generatorkeycount+15)/16;
+   if (generatordistribution==KEYSHOTSPOT && (pick%10)!=0) return generatorkeys[(pick>>8)%band];
+   if (generatordistribution==KEYSSWEEP) return generatorkeys[(packetnumber+((pick>>8)%band))%generatorkeycount];
+   return generatorkeys[pick%generatorkeycount];
+}
+
+// traffic generator: list the keys the configured SIMULATION would plot, laid out as its decoder expects them,
+//   and how many spikes go in a packet. Returns 0 if we can't generate for this SIMULATION.
+int build_generator_keys(void)
+{
+   int points = XDIMENSIONS*YDIMENSIONS;
+   int chipblock = EACHCHIPX*EACHCHIPY;
+   int chipsacross = XDIMENSIONS/EACHCHIPX, chipsdown = YDIMENSIONS/EACHCHIPY;
+   int allocated = (points>1)?points:1;                   // never more keys than points on the plot
+   if (SIMULATION==RETINA2 && retinalut==NULL) allocated = 8*8*16*256;
+
+   generatorkeys = (uint*) malloc(allocated*sizeof(uint));
+   generatorkeycount = 0;
+   switch (SIMULATION) {
+      case HEATMAP:
+      case CPUUTIL:            // a packet per chip with a value for each of its points, so the key is the chip address
+         for (int c=0; c<chipsacross*chipsdown && (c+1)*chipblock<=points; c++)
+            generatorkeys[generatorkeycount++] = ((c/chipsacross)<<8) + (c%chipsacross);
+         generatorspikesperpacket = chipblock;
+         break;
+      case RATEPLOT:           // (key, rate) pairs, a key per population
+         for (int x=0; x<XCHIPS; x++) for (int y=0; y<YCHIPS; y++) for (int core=0; core<16 && (core<<BITSOFPOPID)<chipblock; core++) {
+            if (chipblock*((x*YCHIPS)+y) + (core<<BITSOFPOPID) < points) generatorkeys[generatorkeycount++] = (x<<24) + (y<<16) + (core<<11);
+         }
+         generatorspikesperpacket = 32;                      // 64 words, as the board sends them
+         break;
+      case RETINA:             // SpiNNaker packets, the bottom 8 bits of the key are the pixel
+         for (int i=0; i<points && i<256; i++) generatorkeys[generatorkeycount++] = i;
+         generatorspikesperpacket = 64;
+         break;
+      case RETINA2:            // keys of the cores in the routing key table, a core's neurons run up to the next core's first pixel
+         if (retinalut==NULL) {
+            printf("RETINA2: no key lookup (BOARD 5 or REPORTDIR), generated keys won't map to pixels and will be counted as unmapped.\n");
+            for (int x=0; x<8; x++) for (int y=0; y<8; y++) for (int core=1; core<=16; core++) for (int n=0; n<256; n++)
+               generatorkeys[generatorkeycount++] = (x<<24) + (y<<16) + (core<<11) + n;
+         } else {
+            int entries=retinalutchipsx*retinalutchipsy*32;
+            for (int entry=0; entry<entries; entry++) {
+               int corebase = retinalut[entry];
+               if (corebase<0) continue;
+               int nextbase = points;
+               for (int other=0; other<entries; other++) if (retinalut[other]>corebase && retinalut[other]<nextbase) nextbase=retinalut[other];
+               int chip=entry>>5;
+               for (int n=0; n<nextbase-corebase && n<0x800 && generatorkeycount<allocated; n++)
+                  generatorkeys[generatorkeycount++] = ((chip/retinalutchipsy)<<24) + ((chip%retinalutchipsy)<<16) + ((entry&0x1F)<<11) + n;
+            }
+         }
+         generatorspikesperpacket = 64;
+         break;
+      case COCHLEA:            // a spike a packet, core (1-16) and neuron (0-255) as the cochlea sends them
+         for (int core=1; core<=16; core++) for (int n=0; n<256; n++) {
+            if (((((core-1)*4)+(n%4))*64) + (n/4) < points) generatorkeys[generatorkeycount++] = (core<<11) + n;
+         }
+         generatorspikesperpacket = 1;
+         break;
+      default:
+         break;
+   }
+   if (generatorkeycount==0) {
+      printf("Can't generate traffic for SIMULATION %d (HEATMAP, RATEPLOT, RETINA, RETINA2, COCHLEA and CPUUTIL only), or nothing would land on the plot.\n", SIMULATION);
+      free(generatorkeys);
+      generatorkeys = NULL;
+      return 0;
+   }
+   printf("Generating SIMULATION %d traffic: %d keys, %d spikes a packet, %s keys.\n", SIMULATION, generatorkeycount, generatorspikesperpacket,
+          (generatordistribution==KEYSHOTSPOT)?"hotspot":(generatordistribution==KEYSSWEEP)?"sweep":"uniform");
+   return 1;
+}
+
+// build generated packet number packetnumber into buffer, returns its length
+int generate_packet (unsigned char *buffer, int64_t packetnumber, uint *seed)
+{
+   struct sdp_msg *msg = (sdp_msg*) buffer;
+   struct spinnpacket *spinn = (spinnpacket*) buffer;
+   int words = generatorspikesperpacket;
+
+   memset(buffer, 0, SDPHEADERLEN);
+   if (SIMULATION==RETINA) {
+      spinn->cmd_rc = htonl(STIM_IN_SPINN_PACKET);
+      for (int i=0; i<words; i++) spinn->data[i] = generator_pick_key(seed, packetnumber);
+      return 18+(words*4);
+   }
+   if (SIMULATION==HEATMAP || SIMULATION==CPUUTIL) {
+      msg->srce_addr = generator_pick_key(seed, packetnumber);
+      for (int i=0; i<words; i++) msg->data[i] = generator_random(seed)%((SIMULATION==CPUUTIL)?100:(100<<FIXEDPOINT));
+   } else if (SIMULATION==RATEPLOT) {
+      msg->cmd_rc = 64;
+      for (int i=0; i<words; i++) {
+         msg->data[2*i] = generator_pick_key(seed, packetnumber);
+         msg->data[(2*i)+1] = generator_random(seed)%100;      // spikes per neuron per second
+      }
+      words *= 2;
+   } else {                    // RETINA2, COCHLEA: a routing key per spike
+      for (int i=0; i<words; i++) msg->data[i] = generator_pick_key(seed, packetnumber);
+   }
+   return SDPHEADERLEN+(words*4);
+}
+
+// a UDP socket connected to the board address (-ip, else 127.0.0.1) on SDPPORT, as the board would send to us
+int generator_socket(void)
+{
+   struct sockaddr_in destination;
+   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+   if (sockfd == -1) {
+      perror("generator: socket");
+      exit(1);
+   }
+   memset(&destination, 0, sizeof(destination));
+   destination.sin_family = AF_INET;
+   destination.sin_port = htons(SDPPORT);
+   destination.sin_addr = spinnakerboardip;
+   if (connect(sockfd, (struct sockaddr*)&destination, sizeof(destination)) == -1) {
+      perror("generator: connect");
+      exit(1);
+   }
+   return sockfd;
+}
+
+// send generated packets at spikespersecond for seconds (0 for ever), paced against the clock a batch at a time.
+//   Returns how many packets the kernel took, any it refused are added to *sendfailures.
+int64_t generate_traffic(int sockfd, double spikespersecond, double seconds, int64_t *sendfailures)
+{
+   static unsigned char packets[GENERATEBATCH][sizeof(struct sdp_msg)];
+   static uint seed = 0x2545F491;
+   struct mmsghdr sendmsgs[GENERATEBATCH];
+   struct iovec sendiovecs[GENERATEBATCH];
+   struct timeval stopwatchus;
+   double packetspersecond = spikespersecond/(double)generatorspikesperpacket;
+   int64_t offered=0, sent=0;
+
+   memset(sendmsgs, 0, sizeof(sendmsgs));
+   for (int m=0; m<GENERATEBATCH; m++) {
+      sendiovecs[m].iov_base = packets[m];
+      sendmsgs[m].msg_hdr.msg_iov = &sendiovecs[m];
+      sendmsgs[m].msg_hdr.msg_iovlen = 1;
+   }
+   gettimeofday(&stopwatchus,NULL);
+   int64_t startedat = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   while (1) {
+      gettimeofday(&stopwatchus,NULL);
+      int64_t elapsed = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec) - startedat;
+      if (seconds>0 && elapsed>=(int64_t)(seconds*1000000.0)) break;
+      int64_t due = (int64_t)(packetspersecond*(double)elapsed/1000000.0) - offered;    // how far behind the clock we are
+      if (due<=0) {
+         usleep(100);
+         continue;
+      }
+      int batch = (due<GENERATEBATCH) ? (int)due : GENERATEBATCH;
+      for (int m=0; m<batch; m++) sendiovecs[m].iov_len = generate_packet(packets[m], offered+m, &seed);
+      int went = sendmmsg(sockfd, sendmsgs, batch, 0);
+      if (went<0) went=0;                      // e.g. ECONNREFUSED when nobody is listening yet, keep offering
+      sent += went;
+      (*sendfailures) += batch-went;
+      offered += batch;
+   }
+   return sent;
+}
+
+// the kernel's count of datagrams dropped at our listening socket (its receive buffer was full), -1 if we can't tell
+int64_t socket_drops(int port)
+{
+   FILE *udp = fopen("/proc/net/udp", "r");
+   char line[512];
+   int64_t drops = -1;
+
+   if (udp == NULL) return -1;
+   while (fgets(line, sizeof(line), udp) != NULL) {
+      unsigned int localport;
+      unsigned long long dropped;
+      // sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode ref pointer drops
+      if (sscanf(line, " %*d: %*x:%x %*x:%*x %*x %*x:%*x %*x:%*x %*x %*u %*d %*u %*d %*s %llu", &localport, &dropped) == 2 && (int)localport == port)
+         drops = (int64_t)dropped;
+   }
+   fclose(udp);
+   return drops;
+}
+
+// ingest benchmark: the generator offers our own receiver ever more load over loopback, and we count where packets go
+//   missing - in the kernel (the socket overflowed, which is where a backlog waits once the decoders' rings are full) or
+//   elsewhere on the way. Ring full counts how often the receiver found no room in a ring. Load doubles each step, for
+//   stepseconds, until over half is lost or the generator can't keep up. Invoked with -benchingest on the command line.
+void benchmark_ingest(double stepseconds)
+{
+   int rcvbuf=0;
+   socklen_t optlen = sizeof(rcvbuf);
+   double firstloss=0, bestlossless=0;
+
+   if (!build_generator_keys()) return;
+   int sockfd = generator_socket();
+   getsockopt(sockfd_input, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
+   printf("Ingest benchmark, SIMULATION %d: %d decode thread(s), %d byte socket buffer, %3.1fs a step.\n", SIMULATION, DECODETHREADS, rcvbuf, stepseconds);
+   if (socket_drops(SDPPORT)<0) printf("(no socket drop counter in /proc/net/udp, socket losses are shown as unaccounted)\n");
+   printf("%12s %10s %10s %10s %10s %10s %10s %10s %7s\n", "offered sp/s", "packets/s", "sent/s", "received", "sock drop", "ring full", "unacctd", "decoded", "loss");
+
+   double spikespersecond = 1000.0*generatorspikesperpacket;    // start at 1000 packets a second
+   for (int step=0; step<20; step++, spikespersecond*=2) {
+      int64_t receivedat=recvpackets, socketdropsat=socket_drops(SDPPORT), ringfullat=0, decodedat=0, sendfailures=0;
+      for (int i=0; i<DECODETHREADS; i++) {
+         ringfullat += packetrings[i].full;
+         decodedat += packetrings[i].decoded;
+      }
+
+      int64_t sent = generate_traffic(sockfd, spikespersecond, stepseconds, &sendfailures);
+
+      int64_t received=0, decoded=0, ringfull=0, queued=1;
+      for (int waits=0; waits<40 && (queued>0 || waits<2); waits++) {    // let the socket and the rings drain (up to 2s)
+         usleep(50000);
+         int64_t nowreceived = recvpackets-receivedat;
+         decoded=0, ringfull=0, queued=0;
+         for (int i=0; i<DECODETHREADS; i++) {
+            ringfull += packetrings[i].full;
+            decoded += packetrings[i].decoded;
+            queued += packetrings[i].head-packetrings[i].tail;
+         }
+         if (nowreceived!=received) queued++;      // still coming off the socket
+         received = nowreceived;
+      }
+      ringfull -= ringfullat;
+      decoded -= decodedat;
+      int64_t socketdrops = (socketdropsat<0) ? 0 : socket_drops(SDPPORT)-socketdropsat;
+      int64_t unaccounted = sent-received-socketdrops;            // lost elsewhere on the way (or the counter isn't there)
+      float loss = (sent>0) ? 100.0*(float)(sent-decoded)/(float)sent : 0;
+      float packetspersecond = spikespersecond/generatorspikesperpacket;
+
+      printf("%12.0f %10.0f %10.0f %10lld %10lld %10lld %10lld %10lld %6.2f%%\n", spikespersecond, packetspersecond, (float)(sent+sendfailures)/stepseconds,
+             (long long int)received, (long long int)socketdrops, (long long int)ringfull, (long long int)unaccounted, (long long int)decoded, loss);
+      if (sendfailures>0) printf("   (%lld packets refused by the sending socket)\n", (long long int)sendfailures);
+
+      if (decoded<sent) {
+         if (firstloss==0) firstloss=spikespersecond;
+      } else if (firstloss==0) bestlossless=spikespersecond;
+      if (loss>50.0) break;
+      if ((float)(sent+sendfailures) < 0.9*packetspersecond*stepseconds) {
+         printf("The generator can't offer any more load from this machine.\n");
+         break;
+      }
+   }
+   if (firstloss>0) printf("Loss starts between %3.0f and %3.0f spikes/s (%3.0f - %3.0f packets/s).\n", bestlossless, firstloss,
+                           bestlossless/generatorspikesperpacket, firstloss/generatorspikesperpacket);
+   else printf("No loss up to %3.0f spikes/s (%3.0f packets/s).\n", bestlossless, bestlossless/generatorspikesperpacket);
+   print_ingest_stats();
+   close(sockfd);
+}
+
+// colour benchmark: times colouring whole frames, value by value as colour_calculator does (less the glColor4f) against
+//   each colour mapping kernel this CPU can run, for every colour map. Invoked with -benchcolour on the command line.
+void benchmark_colour(int frames)
+{
+   int points = XDIMENSIONS*YDIMENSIONS;
+   float *values = (float*) malloc(points*sizeof(float));
+   float *fills = (float*) malloc(points*sizeof(float)), *scalarfills = (float*) malloc(points*sizeof(float));
+   unsigned int *rgba = (unsigned int*) malloc(points*sizeof(unsigned int)), *scalarrgba = (unsigned int*) malloc(points*sizeof(unsigned int));
+   float hiwater=100.0, lowater=0.0;
+   struct timeval stopwatchus;
+
+   typedef void (*colourkernel_t) (const float*, int, float, float, const unsigned int*, unsigned int*, float*);
+   const char *kernelname[3] = {"scalar", "SSE2", "AVX2"};
+   colourkernel_t kernel[3] = {colour_map_scalar, NULL, NULL};
+#if defined(__x86_64__) || defined(__i386__)
+   if (__builtin_cpu_supports("sse2")) kernel[1] = colour_map_sse2;
+   if (__builtin_cpu_supports("avx2")) kernel[2] = colour_map_avx2;
+#endif
+
+   srand(1);                                 // same frame every run so numbers are comparable
+   for (int i=0; i<points; i++) values[i] = (rand()%8==0) ? NOTDEFINEDFLOAT : ((float)(rand()%20000)/100.0)-50.0;    // some off each end of the scale
+   printf("Colour mapping benchmark: %d x %d points, %d frames for each of the %d colour maps (kernel in use: %s).\n", XDIMENSIONS, YDIMENSIONS, frames, COLOURMAPS, colourkernelname);
+
+   gettimeofday(&stopwatchus,NULL);
+   int64_t benchstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+   for (int colourmap=1; colourmap<=COLOURMAPS; colourmap++) {
+      for (int f=0; f<frames; f++) {
+         for (int i=0; i<points; i++) {
+            float rgb[3] = {0.0, 0.0, 0.0};
+            GLubyte colour[4];
+            fills[i] = colour_fill(values[i], hiwater, lowater);
+            colour_rgb(colourmap, fills[i], rgb);
+            for (int c=0; c<3; c++) colour[c] = (GLubyte)((rgb[c]*255.0)+0.5);
+            colour[3] = (values[i]>(NOTDEFINEDFLOAT+1)) ? 255 : 0;
+            memcpy(&rgba[i], colour, 4);
+         }
+      }
+   }
+   gettimeofday(&stopwatchus,NULL);
+   float percall = (float)((((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec) - benchstart)/1000000.0;
+   if (percall<=0) percall=0.000001;
+   float pointsdone = (float)points*(float)frames*(float)COLOURMAPS;
+   printf("   %-10s %7.2f ns/point  %8.1f Mpoints/s\n", "per value", (percall*1000000000.0)/pointsdone, pointsdone/(percall*1000000.0));
+
+   for (int k=0; k<3; k++) {
+      if (kernel[k]==NULL) {
+         printf("   %-10s not supported by this CPU\n", kernelname[k]);
+         continue;
+      }
+      int mismatches=0, worstchannel=0;
+      gettimeofday(&stopwatchus,NULL);
+      benchstart = (((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec);
+      for (int colourmap=1; colourmap<=COLOURMAPS; colourmap++) {
+         for (int f=0; f<frames; f++) kernel[k](values, points, hiwater, lowater, colourlut[colourmap], rgba, fills);
+      }
+      gettimeofday(&stopwatchus,NULL);
+      float elapsed = (float)((((int64_t)stopwatchus.tv_sec*(int64_t)1000000) + (int64_t)stopwatchus.tv_usec) - benchstart)/1000000.0;
+      if (elapsed<=0) elapsed=0.000001;
+
+      for (int colourmap=1; colourmap<=COLOURMAPS; colourmap++) {    // check: identical to the scalar kernel, near the per value colours
+         kernel[k](values, points, hiwater, lowater, colourlut[colourmap], rgba, fills);
+         colour_map_scalar(values, points, hiwater, lowater, colourlut[colourmap], scalarrgba, scalarfills);
+         for (int i=0; i<points; i++) {
+            float rgb[3] = {0.0, 0.0, 0.0};
+            colour_rgb(colourmap, colour_fill(values[i], hiwater, lowater), rgb);
+            if (rgba[i]!=scalarrgba[i] || fills[i]!=scalarfills[i]) mismatches++;
+            for (int c=0; c<3; c++) worstchannel = max(worstchannel, abs((int)((GLubyte*)&rgba[i])[c] - (int)((rgb[c]*255.0)+0.5)));
+         }
+      }
+      printf("   %-10s %7.2f ns/point  %8.1f Mpoints/s  %5.1fx per value, %d differ from scalar, colours within %d/255 of per value\n",
+             kernelname[k], (elapsed*1000000000.0)/pointsdone, pointsdone/(elapsed*1000000.0), percall/elapsed, mismatches, worstchannel);
+   }
+   free(values); free(fills); free(scalarfills); free(rgba); free(scalarrgba);
+}
+
+void print_ingest_stats(void)
+{
+   if (recvsyscalls>0) {
+      printf("Ingest: %lld packets in %lld recvmmsg calls, %3.2f packets/syscall (best %d of a possible %d).\n",
+             (long long int)recvpackets, (long long int)recvsyscalls, (float)recvpackets/(float)recvsyscalls, recvbatchmax, RECVBATCH);
+   }
+   if (recvwaits>0) printf("Receiver waited %lld times for the decoders to make room (packets held in the socket buffer).\n", (long long int)recvwaits);
+   for (int i=0; numlisteners>1 && i<numlisteners; i++)
+      printf("Port %d: %lld packets.\n", listenports[i], (long long int)listenerpackets[i]);
+   for (int s=0; numsources>1 && s<numsources; s++)
+      printf("Board %d (%s): %lld packets.\n", s, inet_ntoa(packetsources[s].ip), (long long int)packetsources[s].packets);
+   if (unlistedpackets>0) printf("%lld packets from boards not in BOARDS, dropped.\n", (long long int)unlistedpackets);
+   for (int s=0; s<numsources; s++) if (packetsources[s].offmachine>0)
+      printf("Board %d (%s): %lld keys (or packets) offset off the edge of the machine, dropped.\n", s, inet_ntoa(packetsources[s].ip), (long long int)packetsources[s].offmachine);
+   for (int i=0; packetrings!=NULL && i<DECODETHREADS; i++) {
+      packetring_t *ring = &packetrings[i];
+      printf("Decoder %d: queue depth %u/%u (deepest %u), %lld queued, %lld decoded, found full %lld times.\n",
+             i, ring->head-ring->tail, ring->size, ring->highwater, (long long int)ring->pushed, (long long int)ring->decoded, (long long int)ring->full);
+   }
+   printf("Render: %lld frames drawn.\n", (long long int)framesdrawn);
+   if (spikequeue.written>0 || spikequeue.dropped>0)
+      printf("Spike recorder: %lld spikes written, %lld dropped, %u waiting.\n", (long long int)spikequeue.written, (long long int)spikequeue.dropped, spikequeue.head-spikequeue.tail);
+   panelstate_t *was=thispanel;
+   for (int p=0; p<numpanels; p++) {
+      switch_panel(p);
+      if (SIMULATION==RETINA2) printf("RETINA2: %lld spike keys didn't map to a pixel.\n", (long long int)retinaunmapped);
+      if (heatmapoverflows>0) printf("HEATMAP: %lld packets didn't fit the plot (chip out of range, or too much data).\n", (long long int)heatmapoverflows);
+   }
+   thispanel=was;
+}
+
 void display_win2(void)
 {
    glutSetWindow(win2);
@@ -3774,6 +7397,8 @@ void open_or_close_output_file(void)
    //fprintf(fileoutput,"# SpiNNaker Dump File Format\n");  // ! writing header for neurotools format file
 
    if (fileoutput==NULL) {                // If file isn't already open, so this is a request to open it
+      spikequeue.written=0;                // recorder counts are per file
+      spikequeue.dropped=0;
       if (outputfileformat==2) {               //SAVE AS NEUROTOOLS FORMAT
          strftime (filenamebuffer,80,"packets-20%y%b%d_%H%M.neuro",timeinfo);
          printf("Saving spike packets in this file:\n       %s\n",filenamebuffer);
@@ -3784,14 +7409,32 @@ void open_or_close_output_file(void)
          fprintf(fileoutput,"# dimensions = [          ]\n");  // ! writing header for neurotools format file
          fprintf(fileoutput,"# last_id =          \n");  // ! writing header for neurotools format file
          //fprintf(fileoutput,"# Note: If entries above are blank - the file was not closed properly with 'q' or Graphic 'X'\n");  // ! writing header for neurotools format file
+      } else if (outputfileformat==3) {           //SAVE AS BINARY SPIKE RECORDS
+         strftime (filenamebuffer,80,"packets-20%y%b%d_%H%M.spikes",timeinfo);
+         printf("Saving spikes as binary (int64 ms, uint32 neuron ID) records in this file:\n       %s\n",filenamebuffer);
+         fileoutput = fopen(filenamebuffer, "wb");
       } else if (outputfileformat==1) {           //SAVE AS SPINN (UDP Payload) FORMAT
          strftime (filenamebuffer,80,"packets-20%y%b%d_%H%M.spinn",timeinfo);
          printf("Saving all input data in this file:\n       %s\n",filenamebuffer);
+         pthread_mutex_lock(&spinnlock);           // (decoders may already be trying to add packets)
          fileoutput = fopen(filenamebuffer, "wb");
+         if (fileoutput!=NULL) spinn2_open();
+         pthread_mutex_unlock(&spinnlock);
       }
    } else {                    // File is open already, so we need to close
+      if (outputfileformat>=2) {               // spike records: let the recorder thread write out what's queued
+         writingtofile=2;            // stop any more being queued
+         struct timespec ts;
+         ts.tv_sec = 0;
+         ts.tv_nsec = 1000000;
+         while (spikequeue.tail!=spikequeue.head) nanosleep(&ts,NULL);
+         pthread_mutex_lock(&recorderlock);    // and make sure it's finished with the file
+      } else {
+         pthread_mutex_lock(&spinnlock);      // wait for a packet being added to finish
+         writingtofile=2;            // no more packets
+         spinn2_close();
+      }
       if (outputfileformat==2) {               // File was in neurotools format
-         do {} while (writingtofile==1);     // busy wait for file to finish being updated if in-flight
          writingtofile=2;            // stop anybody else writing the file, pause further updating
          fseek(fileoutput,13 ,SEEK_SET);     // pos 13 First ID
          fprintf(fileoutput,"%d",minneuridrx);        // write lowest detected neurid
@@ -3804,14 +7447,33 @@ void open_or_close_output_file(void)
       }
       fflush(fileoutput);
       fclose(fileoutput);
-      printf("File Save Completed\n");
+      if (outputfileformat>=2) printf("File Save Completed: %lld spikes written, %lld dropped.\n", (long long int)spikequeue.written, (long long int)spikequeue.dropped);
+      else printf("File Save Completed\n");
       fileoutput=NULL;
+      if (outputfileformat>=2) pthread_mutex_unlock(&recorderlock);
+      else pthread_mutex_unlock(&spinnlock);
       outputfileformat=0;
       writingtofile=0;
    }
 }
 
-int paramload(char* config_file_name) {
+// simparams may name several parameter groups, separated by commas, one for each panel: the n'th of them, and how many there are
+int simparams_group(const char *simparams, int n, char *name, int size)
+{
+   int groups=0;
+   name[0]=0;
+   for (const char *at=simparams; *at!=0; ) {
+      int length=strcspn(at, ", ");
+      if (length>0 && groups++==n) snprintf(name, size, "%.*s", length, at);
+      at+=length;
+      at+=strspn(at, ", ");
+   }
+   return groups;
+}
+
+// load the parameters of panel 'panel' (just the one, unless simparams names several) and allocate its data. Returns
+//   how many panels there are. Anything a later panel's group doesn't set is as it was for the one before.
+int paramload(char* config_file_name, int panel) {
    // check if visparam exists
    // if not then use in-built defaults
    // if it does then deal with it
@@ -3819,11 +7481,14 @@ int paramload(char* config_file_name) {
    config_t cfg;               /*Returns all parameters in this structure */
    config_setting_t *setting;
    const char *paramblock;
+   char groupname[200];
+   int groups=1;
    const char *titletemp;
    const char *cores_file;
    int tmp;
    int ii; // used for 2dimensional loops and setting up pointers to lists
    //const char *config_file_name = "visparam.ini";
+   strncpy(configfilename, config_file_name, sizeof(configfilename)-1);
 
    config_init(&cfg);     /*Initialization */
 
@@ -3835,9 +7500,15 @@ int paramload(char* config_file_name) {
    } else {
       /* Get the simulation parameters to use. */
       if (config_lookup_string(&cfg, "simparams", &paramblock)) printf("Sim params specified: %s\n", paramblock);
-      else printf("No 'simparams' settings in configuration file.\n");
+      else {
+         printf("No 'simparams' settings in configuration file.\n");
+         paramblock="";
+      }
 
-      setting = config_lookup(&cfg, paramblock);  /*Read the simulation parameters group*/
+      groups = simparams_group(paramblock, panel, groupname, sizeof(groupname));
+      if (groups<1) groups=1;
+      if (groups>1) printf("Panel %d of %d: %s\n", panel+1, groups, groupname);
+      setting = config_lookup(&cfg, groupname);  /*Read the simulation parameters group*/
    }
 
    if (setting != NULL)
@@ -3845,10 +7516,16 @@ int paramload(char* config_file_name) {
       
       if (!(config_setting_lookup_string(setting, "TITLE", &titletemp))) titletemp="NO SIMULATION TITLE SUPPLIED";
       if (!(config_setting_lookup_string(setting, "POPULATION_CORES", &cores_file))) cores_file="NO FILE";
+      const char *stringvalue;
+      if (config_setting_lookup_string(setting, "REPORTDIR", &stringvalue)) strncpy(REPORTDIR, stringvalue, sizeof(REPORTDIR)-1);
+      if (config_setting_lookup_string(setting, "POPULATION", &stringvalue)) strncpy(POPULATION, stringvalue, sizeof(POPULATION)-1);
 
       long long VALUE=0;
 
       if (config_setting_lookup_int64(setting, "SIMULATION", &VALUE)) SIMULATION=(int)VALUE;
+      KEYBASE=KEYMASK=0;                   // (each panel's keys are its own: unset, it takes whatever the panels before it don't)
+      if (config_setting_lookup_int64(setting, "KEYBASE", &VALUE)) KEYBASE=(unsigned int)VALUE;
+      if (config_setting_lookup_int64(setting, "KEYMASK", &VALUE)) KEYMASK=(unsigned int)VALUE;
 
 
       if (config_setting_lookup_int64(setting, "WINBORDER", &VALUE)) WINBORDER=(int)VALUE;
@@ -3879,6 +7556,12 @@ int paramload(char* config_file_name) {
 
       if (config_setting_lookup_int64(setting, "HISTORYSIZE", &VALUE)) HISTORYSIZE=(int)VALUE;
       if (config_setting_lookup_int64(setting, "MAXRASTERISEDNEURONS", &VALUE)) MAXRASTERISEDNEURONS=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "RASTEREVENTS", &VALUE)) RASTEREVENTS=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "HISTORYTYPE", &VALUE)) HISTORYTYPE=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "PYRAMIDLEVELS", &VALUE)) PYRAMIDLEVELS=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "PYRAMIDBIN", &VALUE)) PYRAMIDBIN=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "PYRAMIDLINES", &VALUE)) PYRAMIDLINES=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "PYRAMIDEVENTS", &VALUE)) PYRAMIDEVENTS=(int)VALUE;
 
       if (config_setting_lookup_int64(setting, "XFLIP", &VALUE)) XFLIP=(int)VALUE;
       if (config_setting_lookup_int64(setting, "YFLIP", &VALUE)) YFLIP=(int)VALUE;
@@ -3903,6 +7586,13 @@ int paramload(char* config_file_name) {
       //printf("FPS: %d, On Demand:%d.\n",MAXFRAMERATE,PLOTONLYONDEMAND);
 
       if (config_setting_lookup_int64(setting, "SDPPORT", &VALUE)) SDPPORT=(int)VALUE;
+      if (config_setting_lookup_string(setting, "SDPPORTS", &stringvalue)) strncpy(SDPPORTS, stringvalue, sizeof(SDPPORTS)-1);
+      if (config_setting_lookup_string(setting, "BOARDS", &stringvalue)) strncpy(BOARDS, stringvalue, sizeof(BOARDS)-1);
+      if (config_setting_lookup_int64(setting, "RECVBATCH", &VALUE)) RECVBATCH=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "DECODETHREADS", &VALUE)) DECODETHREADS=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "PACKETRING", &VALUE)) PACKETRING=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "STATSINTERVAL", &VALUE)) STATSINTERVAL=(int)VALUE;
+      if (config_setting_lookup_int64(setting, "RECORDQUEUE", &VALUE)) RECORDQUEUE=(int)VALUE;
       //printf("*****\n\nSDPPORT: %d %ld\n\n****",SDPPORT,VALUE);
 
       if (config_setting_lookup_int64(setting, "FIXEDPOINT", &VALUE)) FIXEDPOINT=(int)VALUE;
@@ -3949,16 +7639,38 @@ int paramload(char* config_file_name) {
    //float immediate_data[XDIMENSIONS*YDIMENSIONS];  // this stores the value of each plotted point data (time == now)
    //immediate_data = (float*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float)); // allocate an array of floats   superfluous
 
-   //float history_data[HISTORYSIZE][XDIMENSIONS*YDIMENSIONS];   // this stores the historic value the plotted points (double the initial width should be sufficient)
-   history_data = (float**) malloc (HISTORYSIZE*sizeof(float*)); // allocate an array of pointers (rows), then cols
-   for (ii=0; ii<HISTORYSIZE; ii++) history_data[ii]=(float*) malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float*));
-
-   //float history_data_set2[HISTORYSIZE][MAXRASTERISEDNEURONS];      // 2nd set of data for ancillary raster plot window
-   history_data_set2 = (float**) malloc (HISTORYSIZE*sizeof(float*)); // allocate an array of pointers (rows), then cols
-   for (ii=0; ii<HISTORYSIZE; ii++) history_data_set2[ii]=(float*) malloc(MAXRASTERISEDNEURONS*sizeof(float*));
+   if (HISTORYTYPE!=1 && HISTORYTYPE!=2 && HISTORYTYPE!=4)    // not set (or not one we have): spike counts for the spiking visualisations
+      HISTORYTYPE = (SIMULATION==RETINA || SIMULATION==RETINA2 || SIMULATION==COCHLEA || SIMULATION==SPIKERVC) ? 2 : 4;
+   alloc_history(&history_data, HISTORYTYPE, XDIMENSIONS*YDIMENSIONS, HISTORYSIZE);    // history of the plotted points
+   alloc_history(&history_data_set2, 1, MAXRASTERISEDNEURONS, HISTORYSIZE);            // 2nd set of data for ancillary raster plot window (spike counts)
+   printf("History: %d lines of %d points, %d byte values, %3.1fMB.\n", HISTORYSIZE, XDIMENSIONS*YDIMENSIONS, HISTORYTYPE,
+          (float)(HISTORYSIZE*(history_data.stride+history_data_set2.stride))/(1024.0*1024.0));
+   alloc_pyramid(HISTORYTYPE, XDIMENSIONS*YDIMENSIONS);
+   if (PYRAMIDLEVELS>0) printf("History pyramid: %d levels of %d bins from %3.3fs to %3.3fs each, %3.1fMB.\n", PYRAMIDLEVELS, PYRAMIDLINES,
+          (float)PYRAMIDBIN/1000000.0, (float)pyramid[PYRAMIDLEVELS-1].binus/1000000.0,
+          (float)(((PYRAMIDLEVELS-1)*PYRAMIDLINES*pyramid[PYRAMIDLEVELS-1].data.stride)+((pyramidmask+1)*sizeof(pyramidevent_t)))/(1024.0*1024.0));
+   historyepoch = (int64_t*) malloc(HISTORYSIZE*sizeof(int64_t));
+   forget_history();                                // (so none of it needs clearing now)
+   alloc_event_history(&historyevents, XDIMENSIONS*YDIMENSIONS);    // and the events in them, for the raster
+   alloc_event_history(&historyevents2, MAXRASTERISEDNEURONS);
 
    //int immediate_data[XDIMENSIONS*YDIMENSIONS];        // this creates a buffer tally for the Ethernet packets (1 ID = one plotted point)
    immediate_data = (float*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float)); // allocate an array of floats
+   displaydata = (float*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float));    // and the renderer's copy of it
+   immediatetime = (int64_t*)calloc(XDIMENSIONS*YDIMENSIONS, sizeof(int64_t));    // and when each was updated (for decay)
+   for (int i=0; i<3; i++) immediatesnap[i] = (float*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float));    // and the copies published to the renderer
+   maingrid.corners = (GLfloat*)malloc(XDIMENSIONS*YDIMENSIONS*8*sizeof(GLfloat));    // tile corners for the plot
+   minigrid.corners = (GLfloat*)malloc(XDIMENSIONS*YDIMENSIONS*8*sizeof(GLfloat));    // and the mini-plot
+   maingrid.layout[0] = minigrid.layout[0] = -1;                                       // not laid out yet
+   tilecolours = (GLubyte*)malloc(XDIMENSIONS*YDIMENSIONS*4*4*sizeof(GLubyte));        // and the colour of their corners
+   tiledata = (int*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(int));
+   rasterrow = (int*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(int));
+   heatmapimage = (unsigned int*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(unsigned int));    // the INTERPOLATED texture image
+   tilepixel = (int*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(int));
+   datacolours = (unsigned int*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(unsigned int));    // each frame's colours
+   datafills = (float*)malloc(XDIMENSIONS*YDIMENSIONS*sizeof(float));
+   build_colour_luts();
+   select_colour_kernel();
 
    //int maplocaltoglobal[XDIMENSIONS*YDIMENSIONS][2];  // always 2 wide.  Size of mapping from X&Y coords #of pops
    maplocaltoglobal = (int**) malloc (XDIMENSIONS*YDIMENSIONS*sizeof(int*)); // allocate an array of pointers (rows), then cols
@@ -3975,19 +7687,25 @@ int paramload(char* config_file_name) {
 
 
    config_destroy(&cfg);
-
+   return groups;
 }
 
 int main(int argc, char **argv)
 {
    //printf("\n\n\n\nSystem Bit Size Detected = %d bit.\n\n\n\n",(int) MACHINEBITS);
 
+   init_panel_state(0);    // (the first panel, or the only one, starts with the defaults)
+
    // read and check the command line arguments
 
    int errfound=0;
    int gotconfigfn=0, gotreplayfn=0, gotl2gfn=0, gotg2lfn=0, gotanipaddr;
-   char *configfn, *replayfn, *l2gfn, *g2lfn, *sourceipaddr;
+   char *configfn, *replayfn=NULL, *l2gfn=NULL, *g2lfn=NULL, *sourceipaddr;
    float replayspeed=1.0;
+   int64_t benchpackets=0;
+   int benchcolourframes=0;
+   int benchthreads=0;
+   double generaterate=0, generateseconds=10, benchingestseconds=0;
 
    int commandlooper;
    for (commandlooper = 1; commandlooper < argc; commandlooper++) {  // go through all the arguments
@@ -4008,11 +7726,15 @@ int main(int argc, char **argv)
             replayfn = argv[commandlooper+1];
             printf("Attempting to load file for replay: %s.\n",replayfn);
             commandlooper++;
-            if ((commandlooper+1 < argc) && (atof(argv[commandlooper+1])>=0.1) && (atof(argv[commandlooper+1])<=100.0) ) {
+            if ((commandlooper+1 < argc) && (atof(argv[commandlooper+1])>0.0)) {
                // if next argument is a number then this is the multiplier
                replayspeed=atof(argv[commandlooper+1]);
                printf("** Replay multiplier: %f.\n",replayspeed);
                commandlooper++;
+            } else if ((commandlooper+1 < argc) && (strcmp(argv[commandlooper+1], "max") == 0)) {
+               replayunthrottled=1;                  // or as fast as we can go
+               printf("** Replay multiplier: max.\n");
+               commandlooper++;
             }
             else {
                printf("** Note: no multiplier option supplied.\n ");
@@ -4041,6 +7763,53 @@ int main(int argc, char **argv)
             errfound++;
             printf("**** No G to L filename provided. Error.\n");
          }
+      } else if (strcmp(argv[commandlooper], "-benchdecode") == 0) {
+         benchpackets=1000000;                         // time the decode stage for the configured simulation and exit
+         if ((commandlooper+1 < argc) && (atoll(argv[commandlooper+1])>0)) {
+            benchpackets=atoll(argv[commandlooper+1]);    // if next argument is a number then this is how many packets
+            commandlooper++;
+         }
+      } else if (strcmp(argv[commandlooper], "-benchthreads") == 0) {
+         benchthreads=4;                               // time 1 to this many decode threads sharing the packets and exit
+         benchpackets=1000000;
+         if ((commandlooper+1 < argc) && (atoi(argv[commandlooper+1])>0)) {
+            benchthreads=atoi(argv[commandlooper+1]);    // if next argument is a number then this is the most threads
+            commandlooper++;
+            if ((commandlooper+1 < argc) && (atoll(argv[commandlooper+1])>0)) {
+               benchpackets=atoll(argv[commandlooper+1]);    // and then how many packets
+               commandlooper++;
+            }
+         }
+      } else if (strcmp(argv[commandlooper], "-benchcolour") == 0) {
+         benchcolourframes=100;                        // time colouring whole frames and exit
+         if ((commandlooper+1 < argc) && (atoi(argv[commandlooper+1])>0)) {
+            benchcolourframes=atoi(argv[commandlooper+1]);    // if next argument is a number then this is how many frames
+            commandlooper++;
+         }
+      } else if (strcmp(argv[commandlooper], "-generate") == 0) {
+         generaterate=100000;                          // be the board: send packets for the configured simulation and exit
+         if ((commandlooper+1 < argc) && (atof(argv[commandlooper+1])>0)) {
+            generaterate=atof(argv[commandlooper+1]);     // if next argument is a number then this is the spikes per second
+            commandlooper++;
+            if ((commandlooper+1 < argc) && argv[commandlooper+1][0]>='0' && argv[commandlooper+1][0]<='9') {
+               generateseconds=atof(argv[commandlooper+1]);    // and then for how long (0 for ever)
+               commandlooper++;
+            }
+         }
+         if ((commandlooper+1 < argc) && (parse_key_distribution(argv[commandlooper+1])>=0)) {
+            generatordistribution=parse_key_distribution(argv[commandlooper+1]);
+            commandlooper++;
+         }
+      } else if (strcmp(argv[commandlooper], "-benchingest") == 0) {
+         benchingestseconds=1.0;                       // find where we start losing packets for the configured simulation and exit
+         if ((commandlooper+1 < argc) && (atof(argv[commandlooper+1])>0)) {
+            benchingestseconds=atof(argv[commandlooper+1]);    // if next argument is a number then this is the seconds per step
+            commandlooper++;
+         }
+         if ((commandlooper+1 < argc) && (parse_key_distribution(argv[commandlooper+1])>=0)) {
+            generatordistribution=parse_key_distribution(argv[commandlooper+1]);
+            commandlooper++;
+         }
       } else if (strcmp(argv[commandlooper], "-ip") == 0) {
          // spinnakerboardip is set
          if (commandlooper+1 < argc) {                 // check to see if a 2nd argument provided
@@ -4077,7 +7846,7 @@ int main(int argc, char **argv)
 
    if(errfound>0) {
       printf("\n Unsure of your command line options old chap.\n\n");
-      fprintf(stderr, "usage: %s [-c configfile] [-r savedspinnfile [replaymultiplier(0.1->100)]] [-l2g localtoglobalmapfile] [-g2l globaltolocalmapfile] [-ip boardhostname|ipaddr]\n", argv[0]);
+      fprintf(stderr, "usage: %s [-c configfile] [-r savedspinnfile [replaymultiplier|max]] [-l2g localtoglobalmapfile] [-g2l globaltolocalmapfile] [-ip boardhostname|ipaddr] [-benchdecode [packets]] [-benchthreads [threads [packets]]] [-benchcolour [frames]] [-generate [spikes/s [seconds]] [uniform|hotspot|sweep]] [-benchingest [seconds] [uniform|hotspot|sweep]]\n", argv[0]);
       exit(1);
    }
 
@@ -4086,7 +7855,12 @@ int main(int argc, char **argv)
    printf("\n\n"); // give some spacing for the output
 
 
-   paramload(configfn);    // recover the parameters from the file used to configure this visualisation
+   numpanels = paramload(configfn, 0);    // recover the parameters from the file used to configure this visualisation (the first panel's)
+   select_decoder();       // and pick the packet decoder to suit
+   if (numpanels>MAXPANELS) {
+      printf("Only the first %d of the %d panels are shown.\n", MAXPANELS, numpanels);
+      numpanels=MAXPANELS;
+   }
 
 
    if (gotl2gfn==1 && gotg2lfn==1) {  // if both translations are provided
@@ -4105,7 +7879,11 @@ int main(int argc, char **argv)
    //convert_coord_to_index(int x, int y)
 
        
-   if (BOARD == 5 ){
+   if (REPORTDIR[0]!=0) {
+      load_pacman_reports(REPORTDIR);    // key maps straight from what PACMAN placed, no hand written files
+      if (SIMULATION==RETINA2) build_retina_lut_from_reports(POPULATION);
+   }
+   else if (BOARD == 5 ){
        FILE *confile ;
        confile = fopen(POPULATION_CORES,"r");
        
@@ -4169,6 +7947,7 @@ int main(int argc, char **argv)
                 
                 
        fclose(confile);
+       build_retina_lut(count);
        printf("\nSpin5 is using.\n");
        
    }
@@ -4176,6 +7955,25 @@ int main(int argc, char **argv)
        printf("\nNo specific board is using.\n");
 
    cleardown();    // reset the plot buffer to something sensible (i.e. 0 to start with)
+
+   keep_panel(0);
+   if (numpanels>1) {                     // the other panels are set up the same way (but with key maps only from REPORTDIR)
+      for (int p=1; p<numpanels; p++) {
+         init_panel_state(p);
+         switch_panel(p);
+         paramload(configfn, p);
+         select_decoder();
+         if (REPORTDIR[0]!=0) {
+            if (numpacmanpopulations==0) load_pacman_reports(REPORTDIR);
+            if (SIMULATION==RETINA2) build_retina_lut_from_reports(POPULATION);
+         }
+         cleardown();
+         keep_panel(p);
+      }
+      switch_panel(0);
+      while (panelcolumns*panelcolumns<numpanels) panelcolumns++;    // as square a grid as they'll go in
+      panelrows = (numpanels+panelcolumns-1)/panelcolumns;
+   }
    //if (!printlabels) keyWidth=0;    // only if borders are wide enough then print the labelling/controls/titles around the screen
    //printf("Labels: %d, keyWidth: %d\n",printlabels,keyWidth);
    gettimeofday(&startimeus,NULL);
@@ -4184,55 +7982,114 @@ int main(int argc, char **argv)
 
    //printf ("Sizes of int: %d, long: %d, and int64_t: %d\n",sizeof(int), sizeof(long), sizeof(int64_t));
 
-   for(int j=0; j<(HISTORYSIZE); j++) for(int i=0; i<(xdim*ydim); i++) history_data[j][i]=INITZERO?0.0:NOTDEFINEDFLOAT;
    //for(int j=0;j<(HISTORYSIZE);j++) for(int i=0;i<(xdim*ydim);i++) history_data[j][i]=(((float)i*7.0)+(float)(rand() % 10))*((float)j/((float)HISTORYSIZE));
 
+   if (benchpackets>0) {
+      if (spinnakerboardipset==0) inet_aton("127.0.0.1",&spinnakerboardip);
+      spinnakerboardipset++;                   // pretend we know our board, so nothing is sent back to it
+      spinnakerboardport=SDPPORT;
+      if (benchthreads>0) benchmark_threads(benchthreads, benchpackets);
+      else benchmark_decode(benchpackets);
+      exit(0);
+   }
+
+   if (benchcolourframes>0) {
+      benchmark_colour(benchcolourframes);
+      exit(0);
+   }
+
+   if (generaterate>0) {
+      if (spinnakerboardipset==0) inet_aton("127.0.0.1",&spinnakerboardip);
+      if (!build_generator_keys()) exit(1);
+      int64_t sendfailures=0;
+      printf("Sending %3.0f spikes/s to %s port %d", generaterate, inet_ntoa(spinnakerboardip), SDPPORT);
+      if (generateseconds>0) printf(" for %3.1fs.\n", generateseconds);
+      else printf(" until stopped.\n");
+      int64_t sent = generate_traffic(generator_socket(), generaterate, generateseconds, &sendfailures);
+      printf("Sent %lld packets (%lld refused).\n", (long long int)sent, (long long int)sendfailures);
+      exit(0);
+   }
+
+   if (benchingestseconds>0) {
+      if (gotreplayfn==1) printf("Ingest benchmark takes packets from the network, the replay file is ignored.\n");
+      gotreplayfn=0;
+      inet_aton("127.0.0.1",&spinnakerboardip);   // we are the board, over loopback
+      spinnakerboardipset++;
+      spinnakerboardport=SDPPORT;
+   }
+
    if (gotreplayfn == 0) {
       fprintf(stderr, "No Input File provided.   Using Ethernet Frames Only\n");
    }
    else {
       playbackmultiplier = replayspeed;
-      if (playbackmultiplier==0.0) playbackmultiplier=1;      // if mis-understood set to default 1
-      if (playbackmultiplier<0.01) playbackmultiplier=0.01;      // if too slow, floor at 0.01 speed.
-      if (playbackmultiplier>100) playbackmultiplier=100;      // if too fast a multiplier ceiling at 100.
+      if (playbackmultiplier<=0.0) playbackmultiplier=1;      // if mis-understood set to default 1 (any other compression factor goes)
       printf("\nGot a request for a file called: %s.\n",replayfn);
-      if (playbackmultiplier!=1) printf("    Requested Playback speed will be at %3.2f rate.\n",playbackmultiplier);
-      pthread_t p1;
+      if (replayunthrottled) printf("    Requested Playback as fast as possible, ignoring the recorded times.\n");
+      else if (playbackmultiplier!=1) printf("    Requested Playback speed will be at %3.2f rate.\n",playbackmultiplier);
       if ((fileinput = fopen(replayfn, "rb")) == NULL) {
          fprintf(stderr, "I can't read the file you've specified you muppet:\n");
          exit(2);
       }  // check if file is readable
 
-      // setup with target 127.0.0.1 on right port if not already set
+      // the recording goes straight to the decoders, so there's no board and no sockets. Its packets appear to come from 127.0.0.1
       if (spinnakerboardipset==0) inet_aton("127.0.0.1",&spinnakerboardip);
-      spinnakerboardport=SDPPORT; // SDPPORT is used for outgoing cnnx
+      spinnakerboardport=SDPPORT;
       spinnakerboardipset++;
-      init_sdp_sender();
-      printf("Set up to receive internally from %s on port: %d\n", inet_ntoa(spinnakerboardip),SDPPORT);
-      //fprintf(fileoutput,"# SpiNNaker Dump File Format\n");  // ! writing header for neurotools format file
-      pthread_create (&p1, NULL, load_stimulus_data_from_file, NULL);    // away the file receiver goes
+      printf("Replaying in-process to the decoders (no network needed).\n");
+      replaying=1;
+   }
+
+   unsigned int queuesize=1;
+   while (queuesize<(unsigned int)RECORDQUEUE) queuesize<<=1;
+   spikequeue.records = (spikerecord_t*) malloc(queuesize*sizeof(spikerecord_t));
+   spikequeue.size = queuesize;
+   pthread_t precorder;
+   pthread_create (&precorder, NULL, spike_recorder_thread, NULL);    // writes any spikes we are asked to save
+
+   for (int p=0; p<numpanels && DECODETHREADS>1; p++) {    // several decoders only for spike counts, which add up the same in any order
+      if (panels[p].simulation!=RETINA && panels[p].simulation!=RETINA2 && panels[p].simulation!=COCHLEA) {
+         printf("SIMULATION %d keeps latest values rather than counts, so is decoded by one thread in order (not DECODETHREADS=%d).\n", panels[p].simulation, DECODETHREADS);
+         DECODETHREADS=1;
+      }
+   }
+   init_packet_rings();        // the queues between the packet source and the decoders
+   if (DECODETHREADS>1 && merge_shard!=NULL && replaying==0 && numpanels==1) alloc_spike_shards(DECODETHREADS, dc.numberofpoints);    // (a replay's seeks rebuild under decodelock)
+   decodethreads = (pthread_t*) malloc(DECODETHREADS*sizeof(pthread_t));
+   for (int i=0; i<DECODETHREADS; i++) {
+      pthread_create (&decodethreads[i], NULL, decode_thread, &packetrings[i]);    // decoders first, so they're waiting for the receiver
+   }
+   if (replaying) {
+      pthread_t p1;
+      pthread_create (&p1, NULL, load_stimulus_data_from_file, NULL);    // away the file replay goes
+   } else {
+      pthread_t p2;            // this sets up the thread that can come back to here from type
+      init_sdp_listening();        //initialization of the port for receiving SDP frames
+      pthread_create (&p2, NULL, input_thread_SDP, NULL);    // away the SDP network receiver goes
    }
 
-   pthread_t p2;            // this sets up the thread that can come back to here from type
-   init_sdp_listening();        //initialization of the port for receiving SDP frames
-   pthread_create (&p2, NULL, input_thread_SDP, NULL);    // away the SDP network receiver goes
+   if (benchingestseconds>0) {
+      benchmark_ingest(benchingestseconds);     // the real receive and decode stages, but no display
+      exit(0);
+   }
 
    glutInit(&argc, argv);  /* Initialise OpenGL */
 
    glutInitDisplayMode (GLUT_DOUBLE|GLUT_RGB);    /* Set the display mode */
-   glutInitWindowSize (windowWidth+keyWidth,windowHeight);   /* Set the window size */
+   glutInitWindowSize ((windowWidth+keyWidth)*panelcolumns,windowHeight*panelrows);   /* Set the window size (for all the panels) */
    glutInitWindowPosition (0, 100);    /* Set the window position */
    win1 = glutCreateWindow ("VisRT - plotting your network data in real time");  /* Create the window */
    windowToUpdate = win1;
    myinit();
    glutDisplayFunc(display);   /* Register the "display" function */
-   glutReshapeFunc(reshape);   /* Register the "reshape" function */
+   glutReshapeFunc((numpanels>1) ? reshape_panels : reshape);   /* Register the "reshape" function */
    glutIdleFunc(idleFunction); /* Register the idle function */
-   glutSpecialFunc (specialDown);  /* Register the special key press function  */
-   glutSpecialUpFunc (specialUp); /* Register the special key release function */
-   glutKeyboardFunc(keyDown); /* Register the key press function */
-   glutKeyboardUpFunc(keyUp); /* Register the key release function */
-   glutMouseFunc(mousehandler); /* Register the mouse handling function */
+   glutSpecialFunc (panel_special<specialDown>);  /* Register the special key press function  */
+   glutSpecialUpFunc (panel_special<specialUp>); /* Register the special key release function */
+   glutKeyboardFunc(panel_keys<keyDown>); /* Register the key press function */
+   glutKeyboardUpFunc(panel_keys<keyUp>); /* Register the key release function */
+   glutMouseFunc(panel_mouse<mousehandler>); /* Register the mouse handling function */
+   if (numpanels>1) glutPassiveMotionFunc(track_panel);    /* and which panel the mouse is over, for the menus */
 #ifdef TESTING
    glutMotionFunc (MouseMotion); /* Register the mouse handling function when a button depressed */
 #endif